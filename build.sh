@@ -12,7 +12,7 @@ build_vc_example() {
 
 mkdir -p ./build/
 
-clang -Wall -Wextra -ggdb -o ./build/test -Ithirdparty test.c -lm &
+clang -Wall -Wextra -ggdb -o ./build/test -Ithirdparty test.c -lm -lpthread &
 clang -Wall -Wextra -ggdb -o ./build/gallery -Ithirdparty -I. examples/gallery.c &
 clang -Wall -Wextra -ggdb -o ./build/png2c -Ithirdparty png2c.c -lm &
 wait
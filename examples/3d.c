@@ -1,8 +1,6 @@
 #define WREN_IMPLEMENTATION
 #include "wren.c"
 
-float sqrtf(float x);
-float atan2f(float y, float x);
 float sinf(float x);
 float cosf(float x);
 
@@ -15,8 +13,11 @@ float cosf(float x);
 #define GRID_COUNT 10
 #define GRID_PAD 0.5/GRID_COUNT
 #define GRID_SIZE ((GRID_COUNT - 1)*GRID_PAD)
-#define CIRCLE_RADIUS 5
+#define POINTS_COUNT (GRID_COUNT*GRID_COUNT*GRID_COUNT)
+#define POINT_RADIUS 5
 #define Z_START 0.25
+#define Z_NEAR 0.1
+#define Z_FAR 1.0
 #define TEXT_PADDING 50
 
 uint32_t circleColors[] = {
@@ -30,49 +31,63 @@ uint32_t circleColors[] = {
 #define circleColorsCount (sizeof(circleColors)/sizeof(circleColors[0]))
 
 static uint32_t pixels[WIDTH*HEIGHT];
+static uint16_t depth[WIDTH*HEIGHT];
+static int32_t xs[POINTS_COUNT], ys[POINTS_COUNT], zs[POINTS_COUNT];
+static uint32_t colors[POINTS_COUNT];
+static int sxs[POINTS_COUNT], sys[POINTS_COUNT];
+static uint32_t szs[POINTS_COUNT];
 static float angle = 0;
 
-void init() {}
+#define FIXED(x) ((int32_t) ((x)*WREN_FIXED_ONE))
 
-uint32_t *render(float dt) {
-    angle += 0.25f*PI*dt;
-
-    WrenCanvas wc = wrenCanvas(pixels, WIDTH, HEIGHT, WIDTH);
-
-    wrenFill(wc, BACKGROUND_COLOR);
+void init() {
+    size_t i = 0;
     for (int ix = 0; ix < GRID_COUNT; ix++) {
         for (int iy = 0; iy < GRID_COUNT; iy++) {
             for (int iz = 0; iz < GRID_COUNT; iz++) {
-                float x = ix*GRID_PAD - GRID_SIZE/2;
-                float y = iy*GRID_PAD - GRID_SIZE/2;
-                float z = Z_START + iz*GRID_PAD;
-
-                float cx = 0.0f;
-                float cz = Z_START + GRID_SIZE/2;
-
-                float dx = x - cx;
-                float dz = z - cz;
-                
-                float a = atan2f(dz, dx);
-                float m = sqrtf(dx*dx + dz*dz);
-
-                dx = cosf(a + angle)*m;
-                dz = sinf(a + angle)*m;
-
-                x = dx + cx;
-                z = dz + cz;
-
-                x /= z;
-                y /= z;
+                xs[i] = FIXED(ix*GRID_PAD - GRID_SIZE/2);
+                ys[i] = FIXED(iy*GRID_PAD - GRID_SIZE/2);
+                zs[i] = FIXED(Z_START + iz*GRID_PAD);
 
                 uint32_t r = ix*255/GRID_COUNT;
                 uint32_t g = iy*255/GRID_COUNT;
                 uint32_t b = iz*255/GRID_COUNT;
-                uint32_t color = 0xFF000000 | (r<<(0*8)) | (g<<(1*8)) | (b<<(2*8));
-                wrenCircle(wc, (x + 1)/2*WIDTH, (y + 1)/2*HEIGHT, CIRCLE_RADIUS, color);
+                colors[i] = 0xFF000000 | (r<<(0*8)) | (g<<(1*8)) | (b<<(2*8));
+                i++;
             }
         }
     }
+}
+
+uint32_t *render(float dt) {
+    angle += 0.25f*PI*dt;
+
+    WrenCanvas wc = wrenAttachDepth16(wrenCanvas(pixels, WIDTH, HEIGHT, WIDTH), depth, WIDTH);
+
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenClearDepth(wc);
+
+    // Turn the grid about its center on the y axis, then divide x and y by z.
+    // Depth goes from 0 at Z_NEAR to 1 at Z_FAR.
+    float c = cosf(angle), s = sinf(angle);
+    float cz = Z_START + GRID_SIZE/2;
+    float a = Z_FAR/(Z_FAR - Z_NEAR), b = -Z_NEAR*a;
+    WrenMatrix m = {{
+        FIXED(c), 0, FIXED(-s), FIXED(s*cz),
+        0, FIXED(1), 0, 0,
+        FIXED(a*s), 0, FIXED(a*c), FIXED(a*(cz - c*cz) + b),
+        FIXED(s), 0, FIXED(c), FIXED(cz - c*cz),
+    }};
+    wrenTransformVertices(wc, m, xs, ys, zs, POINTS_COUNT, sxs, sys, szs);
+
+    // The depth test keeps the closest point in front whatever order the
+    // grid is drawn in.
+    for (size_t i = 0; i < POINTS_COUNT; i++) {
+        int px = sxs[i], py = sys[i], h = POINT_RADIUS;
+        uint32_t d = szs[i], color = colors[i];
+        wrenTriangleZ(wc, px - h, py - h, d, px + h, py - h, d, px + h, py + h, d, color, color, color);
+        wrenTriangleZ(wc, px - h, py - h, d, px + h, py + h, d, px - h, py + h, d, color, color, color);
+    }
 
     size_t size = 8;
     wrenText(wc, "abcd", TEXT_PADDING, HEIGHT - TEXT_PADDING - defaultFont.height*size, defaultFont, size, 0xFFFFFFFF);
@@ -15,20 +15,18 @@ static float circleY = HEIGHT/2;
 static float circleDx = 100;
 static float circleDy = 100;
 
-float sqrtf(float x);
-float atan2f(float y, float x);
 float sinf(float x);
 float cosf(float x);
 
 #define PI 3.14159265359
 
-static inline void rotatePoint(float *x, float *y) {
+// Rotates around the center of the canvas by the angle whose cosine and sine
+// are c and s, which are computed once per frame.
+static inline void rotatePoint(float *x, float *y, float c, float s) {
     float dx = *x - WIDTH/2;
     float dy = *y - HEIGHT/2;
-    float mag = sqrtf(dx*dx + dy*dy);
-    float dir = atan2f(dy, dx) + triangleAngle;
-    *x = cosf(dir)*mag + WIDTH/2;
-    *y = sinf(dir)*mag + HEIGHT/2;
+    *x = c*dx - s*dy + WIDTH/2;
+    *y = s*dx + c*dy + HEIGHT/2;
 }
 
 void init() {}
@@ -39,13 +37,14 @@ uint32_t *render(float dt) {
     wrenFill(wc, 0xFF181818);
     {
         triangleAngle += 0.5f*PI*dt;
+        float c = cosf(triangleAngle), s = sinf(triangleAngle);
 
         float x1 = WIDTH/2, y1 = HEIGHT/8;
         float x2 = WIDTH/8, y2 = HEIGHT/2;
         float x3 = WIDTH*7/8, y3 = HEIGHT*7/8;
-        rotatePoint(&x1, &y1);
-        rotatePoint(&x2, &y2);
-        rotatePoint(&x3, &y3);
+        rotatePoint(&x1, &y1, c, s);
+        rotatePoint(&x2, &y2, c, s);
+        rotatePoint(&x3, &y3, c, s);
 
         wrenTriangle3(wc, x1, y1, x2, y2, x3, y3, 0xFF2020FF, 0xFF20FF20, 0xFFFF2020);
     }
@@ -2,10 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define WREN_IMPLEMENTATION
+#include "wren.c"
+
 const char *shift(int *argc, char ***argv) {
     assert(*argc > 0);
     const char *result = *argv[0];
@@ -17,8 +21,14 @@ const char *shift(int *argc, char ***argv) {
 int main(int argc, char *argv[]) {
     shift(&argc, &argv);
 
+    bool rle = false;
+    if (argc > 0 && strcmp(argv[0], "-rle") == 0) {
+        rle = true;
+        shift(&argc, &argv);
+    }
+
     if (argc <= 0) {
-        fprintf(stderr, "Usage: png2c <filepath.png>\n");
+        fprintf(stderr, "Usage: png2c [-rle] <filepath.png>\n");
         fprintf(stderr, "ERROR: expected file path\n");
         exit(1);
     }
@@ -37,12 +47,27 @@ int main(int argc, char *argv[]) {
     printf("#define PNG_H_\n");
     printf("size_t png_width = %d;\n", x);
     printf("size_t png_height = %d;\n", y);
-    printf("uint32_t png[] = {");
-    for (size_t i = 0; i < (size_t)(x * y); i++) {
-        printf("0x%x, ", data[i]);
+    if (rle) {
+        // Run-length encoded for wrenBlitRLE: WrenRLE png_sprite = {png_rle, png_width, png_height};
+        WrenCanvas wc = wrenCanvas(data, x, y, x);
+        size_t size = wrenEncodeRLE(wc, NULL, 0);
+        uint32_t *encoded = malloc(size*sizeof(uint32_t));
+        assert(encoded != NULL);
+        wrenEncodeRLE(wc, encoded, size);
+        printf("uint32_t png_rle[] = {");
+        for (size_t i = 0; i < size; i++) {
+            printf("0x%x, ", encoded[i]);
+        }
+        printf("};\n");
+        free(encoded);
+    } else {
+        printf("uint32_t png[] = {");
+        for (size_t i = 0; i < (size_t)(x * y); i++) {
+            printf("0x%x, ", data[i]);
+        }
+        printf("};\n");
     }
-    printf("};\n");
     printf("#endif // PNG_H_\n");
 
     return 0;
-}
\ No newline at end of file
+}
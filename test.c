@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -10,6 +11,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define WREN_THREADS
 #define WREN_IMPLEMENTATION
 #include "wren.c"
 
@@ -176,6 +178,80 @@ void testDrawLine() {
     wrenLine(wc, WIDTH, 0, 0, HEIGHT, BLUE_COLOR);
 }
 
+void testPolyline() {
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+
+    // Translucent so that vertices painted twice would show.
+    int wave[2*17];
+    for (int i = 0; i < 17; i++) {
+        wave[2*i] = i*WIDTH/16 - WIDTH/32;
+        wave[2*i + 1] = HEIGHT/4 + (i%2 ? HEIGHT/8 : -HEIGHT/8) + (i%3)*HEIGHT/16;
+    }
+    wrenPolyline(wc, wave, 17, 0xAAAAAA20);
+
+    int steep[] = {
+        WIDTH/8, HEIGHT/2, WIDTH/8 + 8, HEIGHT - 4, WIDTH/8 + 16, HEIGHT/2,
+        WIDTH/2, HEIGHT/2, WIDTH/2, HEIGHT*3/4, WIDTH/4, HEIGHT*3/4,
+    };
+    wrenPolyline(wc, steep, 6, 0xAA2020AA);
+
+    int ticks[4*8];
+    for (int i = 0; i < 8; i++) {
+        ticks[4*i] = WIDTH*5/8 + i*WIDTH/24;
+        ticks[4*i + 1] = HEIGHT*9/16;
+        ticks[4*i + 2] = WIDTH*5/8 + i*WIDTH/24 + (i - 4)*6;
+        ticks[4*i + 3] = HEIGHT*15/16;
+    }
+    wrenLines(wc, ticks, 16, 0xAA20AA20);
+}
+
+void testThickLines() {
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenLineAA(wc, 0, 0, WIDTH, HEIGHT/3, RED_COLOR);
+    wrenLineAA(wc, WIDTH/8, HEIGHT, WIDTH/3, -HEIGHT/4, GREEN_COLOR);
+
+    wrenThickLine(wc, WIDTH/8, HEIGHT/8, WIDTH*7/8, HEIGHT/4, 7, WREN_CAP_BUTT, BLUE_COLOR);
+    wrenThickLine(wc, WIDTH/8, HEIGHT*3/8, WIDTH*7/8, HEIGHT*3/8, 9, WREN_CAP_SQUARE, 0xAA20AA20);
+    wrenThickLine(wc, WIDTH*3/4, HEIGHT/16, WIDTH*3/4, HEIGHT/2, 10, WREN_CAP_ROUND, 0x992020AA);
+
+    // Translucent joins: pieces overlapping at a corner must blend once.
+    int zigzag[] = {
+        WIDTH/10, HEIGHT*9/16,
+        WIDTH*3/10, HEIGHT*15/16,
+        WIDTH*5/10, HEIGHT*9/16,
+        WIDTH*7/10, HEIGHT*15/16,
+        WIDTH*9/10, HEIGHT*9/16,
+    };
+    wrenThickPolyline(wc, zigzag, 5, 8, WREN_CAP_BUTT, WREN_JOIN_MITER, 0xAAAA2020);
+    for (int i = 0; i < 10; i++) zigzag[i] += i%2 ? -HEIGHT/6 : 0;
+    wrenThickPolyline(wc, zigzag, 5, 6, WREN_CAP_ROUND, WREN_JOIN_ROUND, 0xAA20AAAA);
+    for (int i = 0; i < 10; i++) zigzag[i] += i%2 ? -HEIGHT/6 : 0;
+    wrenThickPolyline(wc, zigzag, 5, 5, WREN_CAP_SQUARE, WREN_JOIN_BEVEL, 0xAAAAAA20);
+
+    // Rows crossed more often than WREN_STROKE_RANGES times light the same
+    // pixels as the segments drawn one by one, away from the corners where
+    // neighbouring segments overlap.
+    static uint32_t strokePixels[640*64], linePixels[640*64];
+    int teeth[2*129];
+    for (int i = 0; i < 129; i++) {
+        teeth[2*i] = 5*i;
+        teeth[2*i + 1] = i%2 ? 0 : 63;
+    }
+    WrenCanvas stroke = wrenCanvas(strokePixels, 640, 64, 640);
+    WrenCanvas lines = wrenCanvas(linePixels, 640, 64, 640);
+    wrenFill(stroke, 0);
+    wrenFill(lines, 0);
+    wrenThickPolyline(stroke, teeth, 129, 2, WREN_CAP_BUTT, WREN_JOIN_BEVEL, RED_COLOR);
+    for (int i = 0; i < 128; i++) {
+        wrenThickLine(lines, teeth[2*i], teeth[2*i + 1], teeth[2*i + 2], teeth[2*i + 3], 2, WREN_CAP_BUTT, RED_COLOR);
+    }
+    for (int i = 24*640; i < 40*640; i++) {
+        if (strokePixels[i] != linePixels[i]) UNREACHABLE("expected crowded rows to cover only the segments");
+    }
+}
+
 void testFillTriangle() {
     WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
     wrenFill(wc, BACKGROUND_COLOR);
@@ -202,6 +278,200 @@ void testFillTriangle() {
     }
 }
 
+void testDepthTriangle() {
+    static uint32_t depth32[WIDTH*HEIGHT];
+    static uint16_t depth16[WIDTH*HEIGHT];
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+
+    // Two triangles sloping through each other in depth, then a translucent
+    // one that is hidden where it passes behind them.
+    WrenCanvas top = wrenAttachDepth32(wrenSubcanvas(wc, 0, 0, WIDTH, HEIGHT/2), depth32, WIDTH);
+    wrenClearDepth(top);
+    wrenTriangleZ(top, 8, 8, 0, 120, 16, 0xFFFFFFFF, 16, 56, 0, RED_COLOR, RED_COLOR, 0xFFAA20AA);
+    wrenTriangleZ(top, 100, 4, 0, 110, 60, 0, 4, 30, 0xFFFFFFFF, GREEN_COLOR, BLUE_COLOR, GREEN_COLOR);
+    wrenTriangleZ(top, 40, -10, 0x80000000, 90, 50, 0x80000000, 20, 60, 0x80000000, 0xAAFFFFFF, 0xAAFFFFFF, 0xAAFFFFFF);
+
+    // The same with a 16-bit buffer on a subcanvas that starts mid-buffer.
+    WrenCanvas full = wrenAttachDepth16(wc, depth16, WIDTH);
+    WrenCanvas bottom = wrenSubcanvas(full, 0, HEIGHT/2, WIDTH, HEIGHT/2);
+    wrenClearDepth(bottom);
+    wrenTriangleZ(bottom, 8, 8, 0, 120, 16, 0xFFFFFFFF, 16, 56, 0, RED_COLOR, RED_COLOR, 0xFFAA20AA);
+    wrenTriangleZ(bottom, 100, 4, 0, 110, 60, 0, 4, 30, 0xFFFFFFFF, GREEN_COLOR, BLUE_COLOR, GREEN_COLOR);
+    wrenTriangleZ(bottom, 40, -10, 0x80000000, 90, 50, 0x80000000, 20, 60, 0x80000000, 0xAAFFFFFF, 0xAAFFFFFF, 0xAAFFFFFF);
+}
+
+void testHiZ() {
+    static uint32_t depth[WIDTH*HEIGHT], plainDepth[WIDTH*HEIGHT];
+    static uint32_t plainPixels[WIDTH*HEIGHT];
+    static uint32_t tiles[WREN_HIZ_COUNT(WIDTH, HEIGHT)];
+    WrenHiZ hiz = wrenHiZ(tiles, (WIDTH + WREN_HIZ_TILE_SIZE - 1)/WREN_HIZ_TILE_SIZE);
+    WrenCanvas wc = wrenAttachHiZ(wrenAttachDepth32(wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH), depth, WIDTH), &hiz);
+    WrenCanvas plain = wrenAttachDepth32(wrenCanvas(plainPixels, WIDTH, HEIGHT, WIDTH), plainDepth, WIDTH);
+
+    // A near wall with a window, a fan of triangles behind it that only shows
+    // through the window, small ones wholly behind it, and a sloped triangle
+    // cutting through the wall.
+    for (int pass = 0; pass < 2; pass++) {
+        WrenCanvas c = pass == 0 ? wc : plain;
+        wrenFill(c, BACKGROUND_COLOR);
+        wrenClearDepth(c);
+        wrenTriangleZ(c, 0, 0, 0x40000000, WIDTH, 0, 0x40000000, 0, HEIGHT, 0x40000000, 0xFF404040, 0xFF404040, 0xFF404040);
+        wrenTriangleZ(c, WIDTH, 0, 0x40000000, WIDTH, HEIGHT, 0x40000000, 0, HEIGHT, 0x40000000, 0xFF404040, 0xFF404040, 0xFF404040);
+        wrenClearDepth(wrenSubcanvas(c, 40, 40, 48, 48));
+        for (int i = 0; i < 16; i++) {
+            int x = i*WIDTH/16, y = (i*37)%HEIGHT;
+            wrenTriangleZ(c, x, y, 0x80000000, WIDTH - y, x, 0x90000000, WIDTH/2, HEIGHT - x/2, 0xA0000000, RED_COLOR, GREEN_COLOR, BLUE_COLOR);
+        }
+        for (int i = 0; i < 4; i++) {
+            wrenTriangleZ(c, 4 + i*30, 4, 0x80000000, 28 + i*30, 12, 0x80000000, 12 + i*30, 30, 0x80000000, RED_COLOR, RED_COLOR, RED_COLOR);
+        }
+        wrenTriangleZ(c, 8, 100, 0, 120, 90, 0x7FFFFFFF, 20, 124, 0, 0xFFAAAA20, 0xFFAAAA20, 0xFF20AAAA);
+    }
+
+    // Culling must not change a pixel.
+    for (size_t i = 0; i < WIDTH*HEIGHT; i++) {
+        if (actualPixels[i] != plainPixels[i] || depth[i] != plainDepth[i]) actualPixels[i] = ERROR_COLOR;
+    }
+    if (hiz.culledTriangles == 0 || hiz.culledBlocks == 0) UNREACHABLE("expected hidden triangles and blocks to be culled");
+}
+
+void testMesh() {
+    static uint32_t depth[WIDTH*HEIGHT], plainDepth[WIDTH*HEIGHT];
+    static uint32_t plainPixels[WIDTH*HEIGHT];
+    WrenCanvas wc = wrenAttachDepth32(wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH), depth, WIDTH);
+    WrenCanvas plain = wrenAttachDepth32(wrenCanvas(plainPixels, WIDTH, HEIGHT, WIDTH), plainDepth, WIDTH);
+
+    // A wavy grid that runs off the left edge, with 16-bit indices.
+    int gx[36], gy[36];
+    uint32_t gz[36], gc[36];
+    uint16_t grid[5*5*6];
+    for (int j = 0; j < 6; j++) {
+        for (int i = 0; i < 6; i++) {
+            gx[j*6 + i] = -20 + i*28 + (j%2)*6;
+            gy[j*6 + i] = 4 + j*24 + (i%2)*6;
+            gz[j*6 + i] = (uint32_t) (i + j) << 28;
+            gc[j*6 + i] = (i + j)%3 == 0 ? RED_COLOR : (i + j)%3 == 1 ? GREEN_COLOR : BLUE_COLOR;
+        }
+    }
+    for (int j = 0; j < 5; j++) {
+        for (int i = 0; i < 5; i++) {
+            uint16_t *q = &grid[(j*5 + i)*6];
+            q[0] = j*6 + i, q[1] = j*6 + i + 1, q[2] = (j + 1)*6 + i;
+            q[3] = j*6 + i + 1, q[4] = (j + 1)*6 + i + 1, q[5] = (j + 1)*6 + i;
+        }
+    }
+
+    // A quad with 32-bit indices piercing the grid in depth.
+    int qx[] = {10, 118, 118, 10}, qy[] = {50, 40, 90, 80};
+    uint32_t qz[] = {0, 0xFFFFFFFF, 0xFFFFFFFF, 0}, qc[] = {0xFFAAAA20, 0xFFAAAA20, 0xFF20AAAA, 0xFF20AAAA};
+    uint32_t quad[] = {0, 1, 2, 0, 2, 3};
+
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenClearDepth(wc);
+    wrenDrawMesh(wc, (WrenMeshPositions) {gx, gy, gz}, gc, (WrenMeshIndices) {.i16 = grid}, 50);
+    wrenDrawMesh(wc, (WrenMeshPositions) {qx, qy, qz}, qc, (WrenMeshIndices) {.i32 = quad}, 2);
+
+    wrenFill(plain, BACKGROUND_COLOR);
+    wrenClearDepth(plain);
+    for (int t = 0; t < 50; t++) {
+        uint16_t *q = &grid[3*t];
+        wrenTriangleZ(plain, gx[q[0]], gy[q[0]], gz[q[0]], gx[q[1]], gy[q[1]], gz[q[1]], gx[q[2]], gy[q[2]], gz[q[2]], gc[q[0]], gc[q[1]], gc[q[2]]);
+    }
+    for (int t = 0; t < 2; t++) {
+        uint32_t *q = &quad[3*t];
+        wrenTriangleZ(plain, qx[q[0]], qy[q[0]], qz[q[0]], qx[q[1]], qy[q[1]], qz[q[1]], qx[q[2]], qy[q[2]], qz[q[2]], qc[q[0]], qc[q[1]], qc[q[2]]);
+    }
+
+    // The mesh must draw exactly what its triangles do one by one.
+    for (size_t i = 0; i < WIDTH*HEIGHT; i++) {
+        if (actualPixels[i] != plainPixels[i]) actualPixels[i] = ERROR_COLOR;
+    }
+}
+
+void testTransform() {
+    static uint32_t depth[WIDTH*HEIGHT];
+    WrenCanvas wc = wrenAttachDepth32(wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH), depth, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenClearDepth(wc);
+
+    // A cube with corners at +-1 turned about y by cos 0.8, sin 0.6, moved 4
+    // away and 1.5 below the eye, and projected with depth from 1 to 8.
+    WrenMatrix m = {{
+        41943, 0, 31457, 0,
+        0, 52429, 0, 78643,
+        -44939, 0, 59919, 224695,
+        -39322, 0, 52429, 262144,
+    }};
+
+    // Four corners for every face so that faces get flat colors.
+    int32_t x[24], y[24], z[24];
+    uint32_t colors[24];
+    uint16_t indices[36];
+    uint32_t faceColors[] = {RED_COLOR, GREEN_COLOR, BLUE_COLOR, 0xFF20AAAA, 0xFFAA20AA, 0xFFAAAA20};
+    for (int f = 0; f < 6; f++) {
+        int axis = f/2, side = f%2 ? 1 : -1;
+        for (int k = 0; k < 4; k++) {
+            int32_t p[3];
+            p[axis] = side*WREN_FIXED_ONE;
+            p[(axis + 1)%3] = (k == 1 || k == 2) ? WREN_FIXED_ONE : -WREN_FIXED_ONE;
+            p[(axis + 2)%3] = k >= 2 ? WREN_FIXED_ONE : -WREN_FIXED_ONE;
+            x[4*f + k] = p[0], y[4*f + k] = p[1], z[4*f + k] = p[2];
+            colors[4*f + k] = faceColors[f];
+        }
+        uint16_t quad[] = {0, 1, 2, 0, 2, 3};
+        for (int k = 0; k < 6; k++) indices[6*f + k] = 4*f + quad[k];
+    }
+
+    int sx[24], sy[24];
+    uint32_t sz[24];
+    if (wrenTransformVertices(wc, m, x, y, z, 24, sx, sy, sz) != 0) UNREACHABLE("the cube is in front of the eye");
+    wrenDrawMesh(wc, (WrenMeshPositions) {sx, sy, sz}, colors, (WrenMeshIndices) {.i16 = indices}, 12);
+}
+
+void testClipping() {
+    static uint32_t depth[WIDTH*HEIGHT];
+    WrenCanvas wc = wrenAttachDepth32(wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH), depth, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenClearDepth(wc);
+
+    // A floor 1 below the eye running from behind it to 10 ahead, and a wall
+    // with a corner behind the eye, projected with depth from 1 to 8.
+    WrenMatrix m = {{
+        WREN_FIXED_ONE, 0, 0, 0,
+        0, WREN_FIXED_ONE, 0, 0,
+        0, 0, 74898, -74898,
+        0, 0, WREN_FIXED_ONE, 0,
+    }};
+    int32_t x[38], y[38], z[38];
+    uint32_t colors[38];
+    uint16_t indices[3*49];
+    size_t n = 0;
+    for (int r = 0; r < 7; r++) {
+        for (int c = 0; c < 5; c++) {
+            x[5*r + c] = (2*c - 4)*WREN_FIXED_ONE;
+            y[5*r + c] = WREN_FIXED_ONE;
+            z[5*r + c] = (2*r - 2)*WREN_FIXED_ONE;
+            colors[5*r + c] = (r + c)%2 ? RED_COLOR : GREEN_COLOR;
+            if (r > 0 && c > 0) {
+                uint16_t quad[] = {5*(r - 1) + c - 1, 5*(r - 1) + c, 5*r + c, 5*r + c - 1};
+                uint16_t split[] = {0, 1, 2, 0, 2, 3};
+                for (int k = 0; k < 6; k++) indices[n++] = quad[split[k]];
+            }
+        }
+    }
+    x[35] = 3*WREN_FIXED_ONE, y[35] = -2*WREN_FIXED_ONE, z[35] = 6*WREN_FIXED_ONE;
+    x[36] = 3*WREN_FIXED_ONE, y[36] = WREN_FIXED_ONE, z[36] = 6*WREN_FIXED_ONE;
+    x[37] = WREN_FIXED_ONE, y[37] = -WREN_FIXED_ONE/2, z[37] = -3*WREN_FIXED_ONE;
+    colors[35] = colors[36] = BLUE_COLOR, colors[37] = 0xFFAAAA20;
+    indices[n++] = 35, indices[n++] = 36, indices[n++] = 37;
+    wrenProjectMesh(wc, m, x, y, z, colors, (WrenMeshIndices) {.i16 = indices}, n/3);
+
+    // Triangles reaching billions of pixels past the canvas.
+    wrenTriangle3(wc, INT_MIN, 0, INT_MAX, 0, WIDTH/2, HEIGHT/4, RED_COLOR, BLUE_COLOR, GREEN_COLOR);
+    wrenTriangle(wc, WIDTH*3/4, HEIGHT/8, INT_MIN, INT_MIN, INT_MIN, INT_MAX/2, 0x55AAAA20);
+}
+
 void testAlphaBlending() {
     WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
     wrenFill(wc, BACKGROUND_COLOR);
@@ -211,12 +481,620 @@ void testAlphaBlending() {
     wrenTriangle(wc, 0, HEIGHT, WIDTH, HEIGHT, WIDTH/2, 0, 0xBB20AAAA);
 }
 
+void testGouraudTriangle() {
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenTriangle3(wc, WIDTH/2, 0, -WIDTH/8, HEIGHT*5/8, WIDTH*7/8, HEIGHT*7/8, RED_COLOR, GREEN_COLOR, BLUE_COLOR);
+
+    // Translucent fan: shared edges and vertex rows must not be blended twice.
+    int cx = WIDTH/2, cy = HEIGHT/2;
+    int xs[] = {WIDTH/8, WIDTH/2, WIDTH*7/8, WIDTH*5/8, WIDTH/4};
+    int ys[] = {HEIGHT/4, HEIGHT/8, HEIGHT/3, HEIGHT*7/8, HEIGHT*3/4};
+    for (int i = 0; i < 5; i++) {
+        int j = (i + 1)%5;
+        wrenTriangle(wc, cx, cy, xs[i], ys[i], xs[j], ys[j], 0x7720AAAA);
+    }
+}
+
+void testCompositeOps() {
+    static uint32_t layerPixels[WIDTH/4*HEIGHT/4];
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wc.premultiplied = true;
+    wrenFill(wc, BACKGROUND_COLOR);
+
+    for (int op = WREN_OP_SRC; op <= WREN_OP_SCREEN; op++) {
+        WrenCanvas layer = wrenCanvas(layerPixels, WIDTH/4, HEIGHT/4, WIDTH/4);
+        layer.premultiplied = true;
+        wrenFill(layer, 0);
+        wrenCircle(layer, WIDTH/8, HEIGHT/8, WIDTH/10, 0xBB2020AA);
+        wrenRect(layer, 0, HEIGHT/8, WIDTH/4, HEIGHT/8, 0x8820AA20);
+
+        int x = (op%3)*WIDTH/3 + 4;
+        int y = (op/3)*HEIGHT/3 + 4;
+        WrenCanvas cell = wrenSubcanvas(wc, x, y, WIDTH/4, HEIGHT/4);
+        wrenRect(cell, 0, 0, WIDTH/4, HEIGHT/8, 0x99AA2020);
+        wrenComposite(wc, layer, x, y, op);
+    }
+
+    // Empty sources, such as subcanvases lying off the canvas, leave it as is.
+    uint32_t pixels[4] = {1, 2, 3, 4};
+    WrenCanvas small = wrenCanvas(pixels, 2, 2, 2);
+    wrenComposite(small, wrenSubcanvas(wc, WIDTH + 100, HEIGHT + 100, 4, 4), 0, 0, WREN_OP_SRC);
+    wrenComposite(small, wrenSubcanvas(wc, 4, 4, 0, 0), 0, 0, WREN_OP_OVER);
+    for (int i = 0; i < 4; i++) {
+        if (pixels[i] != (uint32_t) i + 1) UNREACHABLE("expected empty sources to leave the canvas unchanged");
+    }
+}
+
+void testStampMask() {
+    // Diagonal ramp from empty to full coverage, with full and empty runs.
+    static uint8_t values[32*32];
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+            int v = x + y - 16;
+            values[y*32 + x] = v < 0 ? 0 : v > 24 ? 24 : v;
+        }
+    }
+    WrenMask mask = wrenMask(values, 32, 32, 32, 24);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenStampMask(wc, mask, WIDTH/8, HEIGHT/8, RED_COLOR);
+    wrenStampMask(wc, mask, WIDTH/2, HEIGHT/4, 0x8820AA20);
+    wrenStampMask(wc, mask, -8, HEIGHT*3/4, BLUE_COLOR);
+    wrenStampMask(wc, mask, WIDTH - 16, HEIGHT - 20, GREEN_COLOR);
+    for (int i = 0; i < 6; i++) {
+        wrenCircle(wc, WIDTH/8 + i*WIDTH/7, HEIGHT*5/8, i + 2, 0xCCFFFFFF);
+    }
+
+    // Values above max count as max.
+    uint8_t over[4] = {12, 200, 255, 24};
+    uint32_t pixels[4] = {0};
+    wrenStampMask(wrenCanvas(pixels, 4, 1, 4), wrenMask(over, 4, 1, 4, 24), 0, 0, RED_COLOR);
+    for (int i = 1; i < 4; i++) {
+        if ((pixels[i]&0x00FFFFFF) != (RED_COLOR&0x00FFFFFF)) UNREACHABLE("expected values above max to be opaque");
+    }
+}
+
+void testCopy() {
+    static uint32_t spritePixels[24*16];
+    WrenCanvas sprite = wrenCanvas(spritePixels, 24, 16, 24);
+    wrenFill(sprite, GREEN_COLOR);
+    wrenCircle(sprite, 12, 8, 6, RED_COLOR);
+    wrenLine(sprite, 0, 15, 23, 0, BLUE_COLOR);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenCopy(sprite, wrenSubcanvas(wc, 4, 4, 24, 16));
+    wrenCopy(sprite, wrenSubcanvas(wc, 36, 4, 88, 56));
+    wrenCopy(sprite, wrenSubcanvas(wc, 4, 28, 24, 40));
+    wrenCopy(sprite, wrenSubcanvas(wc, 4, 76, 120, 13));
+    wrenCopy(sprite, wrenSubcanvas(wc, 4, 96, 11, 7));
+}
+
+void testResample() {
+    // Fine stripes and a circle: nearest neighbour aliases them when
+    // shrinking, the box filter averages them to gray.
+    static uint32_t patternPixels[64*64];
+    static uint32_t scratch[WREN_RESAMPLE_SCRATCH(WIDTH)];
+    WrenCanvas pattern = wrenCanvas(patternPixels, 64, 64, 64);
+    wrenFill(pattern, BACKGROUND_COLOR);
+    for (int x = 0; x < 64; x += 2) wrenRect(pattern, x, 0, 1, 32, 0xFFFFFFFF);
+    wrenCircle(pattern, 32, 40, 20, RED_COLOR);
+    wrenTriangle3(pattern, 0, 63, 63, 63, 32, 44, RED_COLOR, GREEN_COLOR, BLUE_COLOR);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenCopy(pattern, wrenSubcanvas(wc, 4, 4, 27, 21));
+    wrenCopyBox(pattern, wrenSubcanvas(wc, 36, 4, 27, 21), scratch);
+    wrenCopyBilinear(pattern, wrenSubcanvas(wc, 68, 4, 27, 21), scratch);
+    wrenCopyBox(pattern, wrenSubcanvas(wc, 100, 4, 16, 16), scratch);
+    wrenCopyBilinear(pattern, wrenSubcanvas(wc, 4, 32, 120, 92), scratch);
+}
+
+void testBlit() {
+    // Antialiased circle and an opaque bar on transparency. Premultiplied, so
+    // that drawing gives the sprite alpha and the transparent background is
+    // black for WREN_BLIT_KEY.
+    static uint32_t spritePixels[32*32];
+    WrenCanvas sprite = wrenCanvas(spritePixels, 32, 32, 32);
+    sprite.premultiplied = true;
+    wrenFill(sprite, 0);
+    wrenCircle(sprite, 16, 16, 13, 0xFF20AAAA);
+    wrenCircle(sprite, 16, 16, 6, 0x80FFFFFF);
+    wrenRect(sprite, 0, 26, 32, 6, 0xFFFF00FF);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2 - 8, WIDTH, 16, RED_COLOR);
+    for (int mode = WREN_BLIT_COPY; mode <= WREN_BLIT_KEY; mode++) {
+        int x = 4 + mode*WIDTH/4;
+        wrenBlit(wc, sprite, x, HEIGHT/2 - 36, mode, 0xFF, 0);
+        wrenBlit(wc, sprite, x, HEIGHT/2 + 4, mode, 0x80, 0);
+    }
+    wrenBlit(wc, sprite, -16, -16, WREN_BLIT_OVER, 0xFF, 0);
+    wrenBlit(wc, sprite, WIDTH - 16, HEIGHT - 16, WREN_BLIT_ADD, 0xFF, 0);
+}
+
+void testBlitRLE() {
+    static uint32_t spritePixels[32*32];
+    static uint32_t encoded[2*32*32 + 32];
+    WrenCanvas sprite = wrenCanvas(spritePixels, 32, 32, 32);
+    sprite.premultiplied = true;
+    wrenFill(sprite, 0);
+    wrenCircle(sprite, 16, 16, 13, 0xFF20AAAA);
+    wrenCircle(sprite, 16, 16, 6, 0x80FFFFFF);
+    wrenRect(sprite, 0, 26, 32, 6, 0xFFFF00FF);
+    size_t size = wrenEncodeRLE(sprite, encoded, sizeof(encoded)/sizeof(encoded[0]));
+    assert(size <= sizeof(encoded)/sizeof(encoded[0]));
+    // One word short leaves the buffer untouched.
+    static uint32_t partial[2*32*32 + 32];
+    if (wrenEncodeRLE(sprite, partial, size - 1) != size) UNREACHABLE("expected the encoded size");
+    for (size_t i = 0; i < size; i++) {
+        if (partial[i] != 0) UNREACHABLE("expected nothing written past capacity");
+    }
+    WrenRLE rle = {encoded, 32, 32};
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2 - 8, WIDTH, 16, RED_COLOR);
+    for (int i = 0; i < 5; i++) {
+        wrenBlitRLE(wc, rle, -16 + i*WIDTH/4, HEIGHT/2 - 36 + i*8, 0xFF);
+        wrenBlitRLE(wc, rle, -8 + i*WIDTH/4, HEIGHT - 40 + i*8, 0xFF - i*0x30);
+    }
+}
+
+void testBlitAffine() {
+    static uint32_t spritePixels[32*32];
+    WrenCanvas sprite = wrenCanvas(spritePixels, 32, 32, 32);
+    sprite.premultiplied = true;
+    wrenFill(sprite, 0);
+    wrenCircle(sprite, 16, 16, 13, 0xFF20AAAA);
+    wrenCircle(sprite, 16, 16, 6, 0x80FFFFFF);
+    wrenRect(sprite, 0, 26, 32, 6, 0xFFFF00FF);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2 - 8, WIDTH, 16, RED_COLOR);
+
+    // 30 degrees at 1.5x, then a shear, with both filters. cos(30) = 0.866,
+    // sin(30) = 0.5 in 16.16.
+    int32_t c = 56756*3/2, s = 32768*3/2;
+    for (int filter = WREN_FILTER_NEAREST; filter <= WREN_FILTER_BILINEAR; filter++) {
+        int x = 24 + filter*WIDTH/2;
+        WrenAffine rotate = {c, -s, s, c, x*WREN_FIXED_ONE, 4*WREN_FIXED_ONE};
+        wrenBlitAffine(sprite, wc, rotate, filter);
+        WrenAffine shear = {WREN_FIXED_ONE, WREN_FIXED_ONE/2, 0, 2*WREN_FIXED_ONE, (x - 16)*WREN_FIXED_ONE, 64*WREN_FIXED_ONE};
+        wrenBlitAffine(sprite, wc, shear, filter);
+    }
+
+    // Upside down and hanging off the corner.
+    WrenAffine flip = {-2*WREN_FIXED_ONE, 0, 0, -2*WREN_FIXED_ONE, 20*WREN_FIXED_ONE, 20*WREN_FIXED_ONE};
+    wrenBlitAffine(sprite, wc, flip, WREN_FILTER_BILINEAR);
+}
+
+void testText() {
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2, WIDTH, HEIGHT/2, RED_COLOR);
+
+    // Letters repeat within and across the strings, so most glyphs are
+    // stamped from the cache.
+    int y = 2;
+    for (size_t size = 1; size <= 4; size++) {
+        wrenText(wc, "face", 2, y, defaultFont, size, 0xFFFFFFFF);
+        wrenText(wc, "bead", 2 + 22*size, y, defaultFont, size, 0x9920AAAA);
+        y += 6*size;
+    }
+
+    // Clipped on every side and wider than one mask word.
+    wrenText(wc, "dope", -9, HEIGHT - 20, defaultFont, 7, 0xCCFFFFFF);
+    wrenText(wc, "cafe", WIDTH - 30, -12, defaultFont, 4, 0xFF20AA20);
+}
+
+// Proportional font: 'i' is narrow, 'm' is wide and 'g' goes below the
+// baseline.
+static const char testBDF[] =
+    "STARTFONT 2.1\n"
+    "FONT -test-proportional\n"
+    "SIZE 7 75 75\n"
+    "FONTBOUNDINGBOX 6 9 0 -2\n"
+    "STARTPROPERTIES 2\n"
+    "FONT_ASCENT 7\n"
+    "FONT_DESCENT 2\n"
+    "ENDPROPERTIES\n"
+    "CHARS 4\n"
+    "STARTCHAR i\n"
+    "ENCODING 105\n"
+    "DWIDTH 3 0\n"
+    "BBX 1 7 1 0\n"
+    "BITMAP\n"
+    "80\n00\n80\n80\n80\n80\n80\n"
+    "ENDCHAR\n"
+    "STARTCHAR m\n"
+    "ENCODING 109\n"
+    "DWIDTH 7 0\n"
+    "BBX 5 5 1 0\n"
+    "BITMAP\n"
+    "D0\nA8\nA8\nA8\nA8\n"
+    "ENDCHAR\n"
+    "STARTCHAR g\n"
+    "ENCODING 103\n"
+    "DWIDTH 5 0\n"
+    "BBX 4 7 0 -2\n"
+    "BITMAP\n"
+    "70\n90\n90\n70\n10\n90\n60\n"
+    "ENDCHAR\n"
+    "STARTCHAR space\n"
+    "ENCODING 32\n"
+    "DWIDTH 3 0\n"
+    "BBX 0 0 0 0\n"
+    "BITMAP\n"
+    "ENDCHAR\n"
+    "ENDFONT\n";
+
+void testBitmapFont() {
+    // The default font as a PC Screen Font 2 without a Unicode table.
+    static uint8_t psf[32 + 128*DEFAULT_FONT_HEIGHT];
+    uint32_t header[8] = {0x864AB572, 0, 32, 0, 128, DEFAULT_FONT_HEIGHT, DEFAULT_FONT_HEIGHT, DEFAULT_FONT_WIDTH};
+    for (size_t i = 0; i < 32; i++) psf[i] = header[i/4] >> (i%4*8);
+    for (size_t c = 0; c < 128; c++) {
+        for (size_t y = 0; y < DEFAULT_FONT_HEIGHT; y++) {
+            uint8_t row = 0;
+            for (size_t x = 0; x < DEFAULT_FONT_WIDTH; x++) {
+                if (defaultFontGlyphs[c][y][x]) row |= 0x80 >> x;
+            }
+            psf[32 + c*DEFAULT_FONT_HEIGHT + y] = row;
+        }
+    }
+
+    static WrenGlyph psfMetrics[128], bdfMetrics[128];
+    static uint32_t psfBits[128], bdfBits[64];
+    WrenFont psfFont, bdfFont;
+    size_t n = wrenLoadPSF2(&psfFont, psf, sizeof(psf), psfMetrics, 128, psfBits, 128);
+    assert(n > 0 && n <= 128);
+    n = wrenLoadBDF(&bdfFont, testBDF, sizeof(testBDF) - 1, bdfMetrics, 128, bdfBits, 64);
+    assert(n > 0 && n <= 64);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2, WIDTH, HEIGHT/2, RED_COLOR);
+    wrenText(wc, "food cafe", 2, 2, psfFont, 1, 0xFFFFFFFF);
+    wrenText(wc, "food", 2, 10, psfFont, 3, 0x9920AAAA);
+    int y = 30;
+    for (size_t size = 1; size <= 4; size++) {
+        wrenText(wc, "mig gim", 2, y, bdfFont, size, 0xFFFFFFFF);
+        y += bdfFont.height*size;
+    }
+    wrenText(wc, "gimming", WIDTH - 40, HEIGHT - 10, bdfFont, 3, 0xCC20AA20);
+}
+
+// A tiny TrueType font with 1000 units per em, written table by table.
+// 'A' is a triangle with a hole, 'B' a ring of only off-curve points, and 'C'
+// a composite of a half-size 'B' and 'A'. 'A' and 'B' kern closer together.
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} TestFontWriter;
+
+static void putU16(TestFontWriter *w, uint32_t v) {
+    w->data[w->size++] = v >> 8;
+    w->data[w->size++] = v;
+}
+
+static void putU32(TestFontWriter *w, uint32_t v) {
+    putU16(w, v >> 16);
+    putU16(w, v);
+}
+
+// Writes the coordinate deltas of one axis: short ones as a byte with the
+// sign in the flag, repeated ones as nothing at all.
+static void putSimpleGlyph(TestFontWriter *w, const int16_t *xy, const uint8_t *on, const uint16_t *ends, size_t contours) {
+    size_t points = ends[contours - 1] + 1;
+    int16_t xMin = 0x7FFF, yMin = 0x7FFF, xMax = -0x7FFF, yMax = -0x7FFF;
+    for (size_t i = 0; i < points; i++) {
+        if (xy[2*i] < xMin) xMin = xy[2*i];
+        if (xy[2*i] > xMax) xMax = xy[2*i];
+        if (xy[2*i + 1] < yMin) yMin = xy[2*i + 1];
+        if (xy[2*i + 1] > yMax) yMax = xy[2*i + 1];
+    }
+    putU16(w, contours);
+    putU16(w, xMin), putU16(w, yMin), putU16(w, xMax), putU16(w, yMax);
+    for (size_t i = 0; i < contours; i++) putU16(w, ends[i]);
+    putU16(w, 0);
+
+    uint8_t flags[32];
+    for (size_t i = 0; i < points; i++) {
+        int dx = xy[2*i] - (i > 0 ? xy[2*i - 2] : 0), dy = xy[2*i + 1] - (i > 0 ? xy[2*i - 1] : 0);
+        flags[i] = on[i];
+        if (dx == 0) flags[i] |= 0x10;
+        else if (dx > -256 && dx < 256) flags[i] |= 0x02 | (dx > 0 ? 0x10 : 0);
+        if (dy == 0) flags[i] |= 0x20;
+        else if (dy > -256 && dy < 256) flags[i] |= 0x04 | (dy > 0 ? 0x20 : 0);
+    }
+    for (size_t i = 0; i < points;) {
+        size_t repeat = 0;
+        while (i + repeat + 1 < points && flags[i + repeat + 1] == flags[i]) repeat++;
+        if (repeat > 0) {
+            w->data[w->size++] = flags[i] | 0x08;
+            w->data[w->size++] = repeat;
+        } else {
+            w->data[w->size++] = flags[i];
+        }
+        i += repeat + 1;
+    }
+    for (size_t axis = 0; axis < 2; axis++) {
+        for (size_t i = 0; i < points; i++) {
+            int d = xy[2*i + axis] - (i > 0 ? xy[2*i - 2 + axis] : 0);
+            if (flags[i]&(0x02 << axis)) w->data[w->size++] = d < 0 ? -d : d;
+            else if (!(flags[i]&(0x10 << axis))) putU16(w, d);
+        }
+    }
+}
+
+static size_t writeTestTrueType(uint8_t *data) {
+    static const int16_t aPoints[] = {0, 0, 300, 700, 600, 0, 200, 100, 400, 100, 300, 400};
+    static const uint8_t aOn[] = {1, 1, 1, 1, 1, 1};
+    static const uint16_t aEnds[] = {2, 5};
+    static const int16_t bPoints[] = {
+        300, 0, 600, 350, 300, 700, 0, 350,
+        300, 220, 170, 220, 170, 350, 170, 480, 300, 480, 430, 480, 430, 350, 430, 220,
+    };
+    static const uint8_t bOn[] = {0, 0, 0, 0, 1, 0, 1, 0, 1, 0, 1, 0};
+    static const uint16_t bEnds[] = {3, 11};
+    enum { HEAD, HHEA, MAXP, HMTX, CMAP, GLYF, LOCA, KERN, TABLE_COUNT };
+    static const uint32_t tags[TABLE_COUNT] = {
+        0x68656164, 0x68686561, 0x6D617870, 0x686D7478, 0x636D6170, 0x676C7966, 0x6C6F6361, 0x6B65726E,
+    };
+    uint32_t offsets[TABLE_COUNT];
+    TestFontWriter w = {data, 12 + 16*TABLE_COUNT};
+
+    offsets[HEAD] = w.size;
+    putU32(&w, 0x00010000), putU32(&w, 0), putU32(&w, 0), putU32(&w, 0x5F0F3CF5);
+    putU16(&w, 0), putU16(&w, 1000);
+    for (size_t i = 0; i < 16; i++) w.data[w.size++] = 0;
+    putU16(&w, 0), putU16(&w, -200), putU16(&w, 600), putU16(&w, 800);
+    putU16(&w, 0), putU16(&w, 8), putU16(&w, 2), putU16(&w, 1), putU16(&w, 0);
+
+    offsets[HHEA] = w.size;
+    putU32(&w, 0x00010000), putU16(&w, 800), putU16(&w, -200), putU16(&w, 100);
+    for (size_t i = 0; i < 12; i++) putU16(&w, 0);
+    putU16(&w, 4);
+
+    offsets[MAXP] = w.size;
+    putU32(&w, 0x00005000), putU16(&w, 4);
+
+    // Glyph 0 is missing and only has an advance.
+    offsets[HMTX] = w.size;
+    putU16(&w, 300), putU16(&w, 0);
+    for (size_t i = 1; i < 4; i++) putU16(&w, 650), putU16(&w, 0);
+
+    // 'A' to 'C' are glyphs 1 to 3.
+    offsets[CMAP] = w.size;
+    putU16(&w, 0), putU16(&w, 1), putU16(&w, 3), putU16(&w, 1), putU32(&w, 12);
+    putU16(&w, 4), putU16(&w, 32), putU16(&w, 0), putU16(&w, 4), putU16(&w, 4), putU16(&w, 1), putU16(&w, 0);
+    putU16(&w, 'C'), putU16(&w, 0xFFFF), putU16(&w, 0);
+    putU16(&w, 'A'), putU16(&w, 0xFFFF);
+    putU16(&w, 1 - 'A'), putU16(&w, 1);
+    putU16(&w, 0), putU16(&w, 0);
+
+    uint32_t glyphs[5];
+    size_t glyf = offsets[GLYF] = w.size;
+    glyphs[0] = glyphs[1] = 0;
+    putSimpleGlyph(&w, aPoints, aOn, aEnds, 2);
+    glyphs[2] = w.size - glyf;
+    putSimpleGlyph(&w, bPoints, bOn, bEnds, 2);
+    glyphs[3] = w.size - glyf;
+    putU16(&w, -1), putU16(&w, 0), putU16(&w, -200), putU16(&w, 600), putU16(&w, 500);
+    putU16(&w, 0x0020 | 0x0008 | 0x0002), putU16(&w, 2), w.data[w.size++] = 0, w.data[w.size++] = 0, putU16(&w, 0x2000);
+    putU16(&w, 0x0002 | 0x0001), putU16(&w, 1), putU16(&w, 0), putU16(&w, -200);
+    glyphs[4] = w.size - glyf;
+
+    offsets[LOCA] = w.size;
+    for (size_t i = 0; i < 5; i++) putU32(&w, glyphs[i]);
+
+    offsets[KERN] = w.size;
+    putU16(&w, 0), putU16(&w, 1), putU16(&w, 0), putU16(&w, 14 + 2*6), putU16(&w, 0x0001);
+    putU16(&w, 2), putU16(&w, 12), putU16(&w, 1), putU16(&w, 0);
+    putU16(&w, 1), putU16(&w, 2), putU16(&w, -150);
+    putU16(&w, 2), putU16(&w, 1), putU16(&w, 100);
+
+    size_t size = w.size;
+    w.size = 0;
+    putU32(&w, 0x00010000), putU16(&w, TABLE_COUNT), putU16(&w, 128), putU16(&w, 3), putU16(&w, 0);
+    for (size_t i = 0; i < TABLE_COUNT; i++) {
+        uint32_t end = i == TABLE_COUNT - 1 ? size : offsets[i + 1];
+        putU32(&w, tags[i]), putU32(&w, 0), putU32(&w, offsets[i]), putU32(&w, end - offsets[i]);
+    }
+    return size;
+}
+
+void testTrueType() {
+    static uint8_t ttf[1024];
+    size_t size = writeTestTrueType(ttf);
+    assert(size <= sizeof(ttf));
+
+    static WrenGlyph metrics[128];
+    static WrenKerning kerning[8];
+    static uint8_t atlas[4096];
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2, WIDTH, HEIGHT/2, RED_COLOR);
+
+    int y = 2;
+    size_t pixels[] = {8, 13, 24, 40};
+    for (size_t i = 0; i < sizeof(pixels)/sizeof(pixels[0]); i++) {
+        WrenFont font;
+        size_t n = wrenLoadTrueType(&font, ttf, size, pixels[i], metrics, 128, kerning, 8, atlas, sizeof(atlas));
+        assert(n > 0 && n <= sizeof(atlas));
+        assert(font.kerningCount == 2);
+        wrenText(wc, "ABC AB BA", 2, y, font, 1, i%2 == 0 ? 0xFFFFFFFF : 0xCC20AA20);
+        y += font.height;
+    }
+
+    WrenFont font;
+    wrenLoadTrueType(&font, ttf, size, 6, metrics, 128, kerning, 8, atlas, sizeof(atlas));
+    wrenText(wc, "CAB", WIDTH - 40, HEIGHT - 24, font, 3, 0x9920AAAA);
+}
+
+void testTextLayout() {
+    int width, height;
+    wrenTextMeasure("face\nbead food", defaultFont, 2, &width, &height);
+    assert(width == 9*DEFAULT_FONT_WIDTH*2 && height == 2*DEFAULT_FONT_HEIGHT*2);
+
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    wrenFill(wc, BACKGROUND_COLOR);
+    wrenRect(wc, 0, HEIGHT/2, WIDTH, HEIGHT/2, RED_COLOR);
+
+    // One word per line, centered, with the last line cut by the box.
+    static WrenPlacedGlyph glyphs[64];
+    WrenTextLayout layout;
+    wrenRect(wc, 4, 4, 56, 44, 0xFF404040);
+    size_t n = wrenLayoutText(&layout, "face bead food cafe dope", 4, 4, 56, 44, WREN_ALIGN_CENTER, defaultFont, 2, glyphs, 64);
+    assert(n == 20 && layout.width == 40 && layout.height == 50);
+    wrenDrawTextLayout(wc, &layout, 0xFFFFFFFF);
+
+    // A word too long for the box breaks between characters.
+    wrenRect(wc, 64, 8, 60, 24, 0xFF404040);
+    wrenLayoutText(&layout, "abcdefabcdefabcdef deed", 64, 8, 60, 24, WREN_ALIGN_RIGHT, defaultFont, 1, glyphs, 64);
+    wrenDrawTextLayout(wc, &layout, 0xFF20AAAA);
+    wrenRect(wc, 64, 36, 60, 8, 0xFF404040);
+    wrenLayoutText(&layout, "fade\nbed", 64, 36, 60, 8, WREN_ALIGN_LEFT, defaultFont, 1, glyphs, 64);
+    wrenDrawTextLayout(wc, &layout, 0x9920AA20);
+
+    // Partly off the canvas, with room for only the first six glyphs.
+    n = wrenLayoutText(&layout, "bead\ndeaf", -10, HEIGHT - 24, 60, 40, WREN_ALIGN_LEFT, defaultFont, 3, glyphs, 6);
+    assert(n == 8 && layout.count == 6);
+    wrenDrawTextLayout(wc, &layout, 0xCC20AA20);
+}
+
+void recordScene(WrenCommandBuffer *cb) {
+    wrenRecordFill(cb, BACKGROUND_COLOR);
+    wrenRecordRect(cb, WIDTH/8, HEIGHT/8, WIDTH*5/8, HEIGHT/4, RED_COLOR);
+    wrenRecordCircle(cb, WIDTH/2, HEIGHT/2, WIDTH/4, 0xBB20AA20);
+    wrenRecordTriangle3(cb, WIDTH/4, HEIGHT*7/8, WIDTH*7/8, HEIGHT/3, WIDTH*5/8, HEIGHT, RED_COLOR, GREEN_COLOR, BLUE_COLOR);
+    wrenRecordTriangle(cb, 0, HEIGHT/3, WIDTH*3/4, HEIGHT*5/8, WIDTH/3, HEIGHT, 0x77AA2020);
+    wrenRecordLine(cb, 0, HEIGHT - 1, WIDTH - 1, 3, 0xFF20AAAA);
+    wrenRecordLine(cb, WIDTH/2 + 3, 0, WIDTH/2 - 5, HEIGHT - 1, 0xFFAAAA20);
+    wrenRecordText(cb, "food", WIDTH/2 - 30, HEIGHT/2 - 7, defaultFont, 3, 0xCCFFFFFF);
+}
+
+void testDeferredRender() {
+    static WrenCommand commands[16];
+    static uint32_t starts[WREN_TILE_COUNT(WIDTH, HEIGHT) + 1];
+    static uint32_t entries[64];
+    static uint32_t immediatePixels[WIDTH*HEIGHT];
+
+    WrenCommandBuffer cb = wrenCommandBuffer(commands, 16);
+    recordScene(&cb);
+
+    WrenCanvas immediate = wrenCanvas(immediatePixels, WIDTH, HEIGHT, WIDTH);
+    wrenReplay(immediate, &cb);
+
+    WrenThreadPool pool;
+    if (!wrenThreadPoolStart(&pool, 3)) UNREACHABLE("could not start the thread pool");
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    WrenBins bins = wrenBins(starts, entries, 64);
+    wrenRenderThreaded(&pool, wc, &cb, &bins);
+    wrenThreadPoolStop(&pool);
+
+    // Tiles must match immediate mode exactly.
+    for (size_t i = 0; i < WIDTH*HEIGHT; i++) {
+        if (actualPixels[i] != immediatePixels[i]) actualPixels[i] = ERROR_COLOR;
+    }
+}
+
+void recordDashboard(WrenCommandBuffer *list, const char *label, int dial) {
+    wrenClearCommands(list);
+    wrenRecordFill(list, BACKGROUND_COLOR);
+    wrenRecordRect(list, 4, 4, WIDTH - 8, HEIGHT/4, 0xFF404040);
+    wrenRecordText(list, label, 8, 8, defaultFont, 4, GREEN_COLOR);
+    wrenRecordCircle(list, WIDTH/2, HEIGHT*5/8, WIDTH/4, 0xFF404040);
+    wrenRecordLine(list, WIDTH/2, HEIGHT*5/8, WIDTH/2 + dial, HEIGHT*3/8, RED_COLOR);
+    wrenRecordTriangle(list, 4, HEIGHT - 4, 24, HEIGHT - 4, 14, HEIGHT - 20, BLUE_COLOR);
+}
+
+void testDisplayList() {
+    static WrenCommand prevCommands[16], nextCommands[16];
+    static char prevChars[32], nextChars[32];
+    static uint32_t fullPixels[WIDTH*HEIGHT];
+    WrenRect rects[4];
+
+    WrenCommandBuffer prev = wrenDisplayList(prevCommands, 16, prevChars, 32);
+    WrenCommandBuffer next = wrenDisplayList(nextCommands, 16, nextChars, 32);
+
+    // The label lives in one buffer that is rewritten between frames, so the
+    // lists have to keep their own copies for the diff to see the change.
+    char label[8] = "bad";
+    WrenCanvas wc = wrenCanvas(actualPixels, WIDTH, HEIGHT, WIDTH);
+    recordDashboard(&prev, label, -20);
+    wrenReplay(wc, &prev);
+
+    label[0] = 'f', label[1] = 'e';
+    recordDashboard(&next, label, 10);
+    size_t n = wrenDiffCommands(wc, &prev, &next, rects, 4);
+    for (size_t i = 0; i < n; i++) wrenReplayRect(wc, &next, rects[i]);
+
+    // Only redrawing the dirty rects must give the same frame as a full redraw.
+    WrenCanvas full = wrenCanvas(fullPixels, WIDTH, HEIGHT, WIDTH);
+    wrenReplay(full, &next);
+    for (size_t i = 0; i < WIDTH*HEIGHT; i++) {
+        if (actualPixels[i] != fullPixels[i]) actualPixels[i] = ERROR_COLOR;
+    }
+    if (n != 2) UNREACHABLE("expected the label and the dial to be dirty");
+
+    // The third bar joins the first two into one rect; overlapping rects
+    // would replay translucent commands twice.
+    wrenClearCommands(&prev);
+    wrenClearCommands(&next);
+    for (int i = 0; i < 3; i++) {
+        int x = i < 2 ? 30*i : 15;
+        wrenRecordRect(&prev, x, 40 + 2*i, 20, 10, 0x80AA2020);
+        wrenRecordRect(&next, x, 40 + 2*i, 20, 10, 0x8020AA20);
+    }
+    n = wrenDiffCommands(wc, &prev, &next, rects, 4);
+    if (n != 1 || rects[0].x1 != 0 || rects[0].x2 != 49) UNREACHABLE("expected overlapping rects to merge");
+
+    // Rects that do not fit come back as the whole canvas.
+    wrenClearCommands(&prev);
+    wrenClearCommands(&next);
+    for (int i = 0; i < 5; i++) {
+        wrenRecordRect(&prev, 20*i, 0, 10, 10, RED_COLOR);
+        wrenRecordRect(&next, 20*i, 0, 10, 10, GREEN_COLOR);
+    }
+    n = wrenDiffCommands(wc, &prev, &next, rects, 4);
+    if (n != 1 || rects[0].x1 != 0 || rects[0].y2 != HEIGHT - 1) UNREACHABLE("expected the whole canvas to be dirty");
+    if (wrenDiffCommands(wc, &prev, &next, rects, 0) == 0) UNREACHABLE("expected a change without room for rects");
+}
+
 TestCase testCases[] = {
     DEFINE_TEST_CASE(testFillRect),
     DEFINE_TEST_CASE(testFillCircle),
     DEFINE_TEST_CASE(testDrawLine),
+    DEFINE_TEST_CASE(testPolyline),
+    DEFINE_TEST_CASE(testThickLines),
     DEFINE_TEST_CASE(testFillTriangle),
     DEFINE_TEST_CASE(testAlphaBlending),
+    DEFINE_TEST_CASE(testGouraudTriangle),
+    DEFINE_TEST_CASE(testDepthTriangle),
+    DEFINE_TEST_CASE(testHiZ),
+    DEFINE_TEST_CASE(testMesh),
+    DEFINE_TEST_CASE(testTransform),
+    DEFINE_TEST_CASE(testClipping),
+    DEFINE_TEST_CASE(testCompositeOps),
+    DEFINE_TEST_CASE(testStampMask),
+    DEFINE_TEST_CASE(testCopy),
+    DEFINE_TEST_CASE(testResample),
+    DEFINE_TEST_CASE(testBlit),
+    DEFINE_TEST_CASE(testBlitRLE),
+    DEFINE_TEST_CASE(testBlitAffine),
+    DEFINE_TEST_CASE(testText),
+    DEFINE_TEST_CASE(testBitmapFont),
+    DEFINE_TEST_CASE(testTrueType),
+    DEFINE_TEST_CASE(testTextLayout),
+    DEFINE_TEST_CASE(testDeferredRender),
+    DEFINE_TEST_CASE(testDisplayList),
 };
 #define TEST_CASES_COUNT (sizeof(testCases)/sizeof(testCases[0]))
 
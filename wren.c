@@ -17,9 +17,39 @@
 #define WREN_SIGN(T, x) ((T)((x) > 0) - (T)((x) < 0))
 #define WREN_ABS(T, x) (WREN_SIGN(T, x)*(x))
 
+// Glyph of a packed font: columns [x, x + width) of the first height rows of
+// the atlas, drawn at (bearingX, bearingY) from the pen, which starts at the
+// top left of the line and moves right by advance.
+typedef struct {
+    uint32_t x;
+    uint16_t width, height;
+    int16_t bearingX, bearingY;
+    int16_t advance;
+} WrenGlyph;
+
+// The advance from character left to character right changes by amount.
+typedef struct {
+    uint16_t left, right;
+    int16_t amount;
+} WrenKerning;
+
+// Fonts either hold one char per pixel in glyphs, width x height cells for
+// each of the 128 ASCII characters, or are packed: glyphs is NULL and
+// character c < count is metrics[c] in an atlas. The atlas is either 1-bit in
+// bits, stride words per row laid out as in WrenBitMask, or 8-bit coverage in
+// coverage, stride bytes per row. width is the advance of the characters a
+// packed font has no glyph for and height is its line height. kerning is
+// sorted by left, then right.
 typedef struct {
     size_t width, height;
     const char *glyphs;
+    const WrenGlyph *metrics;
+    size_t count;
+    const uint32_t *bits;
+    const uint8_t *coverage;
+    size_t stride;
+    const WrenKerning *kerning;
+    size_t kerningCount;
 } WrenFont;
 
 #define DEFAULT_FONT_HEIGHT 5
@@ -89,13 +119,233 @@ static WrenFont defaultFont = {
     .height = DEFAULT_FONT_HEIGHT,
 };
 
+// Hierarchical depth: the farthest depth of every WREN_HIZ_TILE_SIZE square
+// tile of a depth buffer, in 32-bit depth units, stride tiles per row.
+// wrenTriangleZ skips whole triangles and tiles that it proves hidden and
+// counts them here.
+#ifndef WREN_HIZ_TILE_SIZE
+#define WREN_HIZ_TILE_SIZE 8
+#endif
+
+#define WREN_HIZ_COUNT(width, height) ((((width) + WREN_HIZ_TILE_SIZE - 1)/WREN_HIZ_TILE_SIZE)*(((height) + WREN_HIZ_TILE_SIZE - 1)/WREN_HIZ_TILE_SIZE))
+
+typedef struct {
+    uint32_t *tiles;
+    size_t stride;
+    size_t culledTriangles, culledBlocks;
+} WrenHiZ;
+
 typedef struct {
     uint32_t *pixels;
     size_t width;
     size_t height;
     size_t stride;
+    // Pixels hold premultiplied alpha. Primitives still take straight colors
+    // and composite them with "source over", including the destination alpha.
+    bool premultiplied;
+    // Optional depth buffer for wrenTriangleZ with depthStride values per row,
+    // either 16 or 32-bit. Smaller values are closer.
+    uint16_t *depth16;
+    uint32_t *depth32;
+    size_t depthStride;
+    // Optional hierarchical depth of the depth buffer, which starts hizX
+    // columns and hizY rows before the canvas.
+    WrenHiZ *hiz;
+    size_t hizX, hizY;
 } WrenCanvas;
 
+typedef enum {
+    WREN_OP_SRC,
+    WREN_OP_OVER,
+    WREN_OP_IN,
+    WREN_OP_OUT,
+    WREN_OP_ATOP,
+    WREN_OP_XOR,
+    WREN_OP_ADD,
+    WREN_OP_MULTIPLY,
+    WREN_OP_SCREEN,
+} WrenCompositeOp;
+
+typedef enum {
+    WREN_BLIT_COPY,
+    WREN_BLIT_OVER,
+    WREN_BLIT_ADD,
+    WREN_BLIT_KEY,
+} WrenBlitMode;
+
+// Run-length encoded sprite with straight colors. data starts with the offset
+// of every row in data. A row is a sequence of runs that covers its width;
+// each run is a word with the kind in its top two bits and the length below,
+// followed by the colors of the run unless it is a skip run.
+typedef struct {
+    const uint32_t *data;
+    size_t width;
+    size_t height;
+} WrenRLE;
+
+#define WREN_RLE_SKIP 0
+#define WREN_RLE_SOLID 1
+#define WREN_RLE_BLEND 2
+#define WREN_RLE_MAX_RUN 0x3FFFFFFF
+#define WREN_RLE_KIND(color) (WREN_ALPHA(color) == 0 ? WREN_RLE_SKIP : WREN_ALPHA(color) == 0xFF ? WREN_RLE_SOLID : WREN_RLE_BLEND)
+
+#define WREN_FIXED_ONE (1 << 16)
+
+// Affine transform in 16.16 fixed point: (x, y) maps to
+// (a*x + b*y + tx, c*x + d*y + ty).
+typedef struct {
+    int32_t a, b, c, d;
+    int32_t tx, ty;
+} WrenAffine;
+
+typedef enum {
+    WREN_FILTER_NEAREST,
+    WREN_FILTER_BILINEAR,
+} WrenFilter;
+
+// 8-bit coverage mask: a value v blends a color with its alpha scaled by
+// v/max.
+typedef struct {
+    const uint8_t *values;
+    size_t width;
+    size_t height;
+    size_t stride;
+    uint8_t max;
+} WrenMask;
+
+// 1-bit mask: pixel x of row y is set when bit b%32 of bits[y*stride + b/32]
+// is, where b = offset + x. stride counts words.
+typedef struct {
+    const uint32_t *bits;
+    size_t width;
+    size_t height;
+    size_t stride;
+    size_t offset;
+} WrenBitMask;
+
+typedef enum {
+    WREN_ALIGN_LEFT,
+    WREN_ALIGN_CENTER,
+    WREN_ALIGN_RIGHT,
+} WrenTextAlign;
+
+// Character c placed by wrenLayoutText with the top left of its glyph at
+// (x, y).
+typedef struct {
+    int x, y;
+    int c;
+} WrenPlacedGlyph;
+
+// Glyph run of a text laid out in the box at (x, y) of w x h pixels, which
+// can be drawn any number of times while font and glyphs stay alive. width
+// and height are the size of the laid out text.
+typedef struct {
+    WrenFont font;
+    size_t size;
+    const WrenPlacedGlyph *glyphs;
+    size_t count;
+    int x, y, w, h;
+    int width, height;
+} WrenTextLayout;
+
+// Circles small enough to fit a slot are stamped from a per-thread cache of
+// coverage masks. Define WREN_MASK_CACHE_SLOTS as 0 to disable it.
+#ifndef WREN_MASK_CACHE_SLOTS
+#define WREN_MASK_CACHE_SLOTS 16
+#endif
+
+#ifndef WREN_MASK_CACHE_SLOT_SIZE
+#define WREN_MASK_CACHE_SLOT_SIZE 4096
+#endif
+
+// Glyphs drawn by wrenText are rasterized once per font, glyph and size into
+// a per-thread cache of 1-bit masks. Define WREN_GLYPH_CACHE_SLOTS as 0 to
+// disable it. Slot sizes count 32-bit words.
+#ifndef WREN_GLYPH_CACHE_SLOTS
+#define WREN_GLYPH_CACHE_SLOTS 64
+#endif
+
+#ifndef WREN_GLYPH_CACHE_SLOT_SIZE
+#define WREN_GLYPH_CACHE_SLOT_SIZE 256
+#endif
+
+// Wider TrueType glyphs are left blank.
+#ifndef WREN_TRUETYPE_MAX_WIDTH
+#define WREN_TRUETYPE_MAX_WIDTH 512
+#endif
+
+// Ends and corners of thick lines.
+typedef enum {
+    WREN_CAP_BUTT,
+    WREN_CAP_SQUARE,
+    WREN_CAP_ROUND,
+} WrenLineCap;
+
+typedef enum {
+    WREN_JOIN_MITER,
+    WREN_JOIN_BEVEL,
+    WREN_JOIN_ROUND,
+} WrenLineJoin;
+
+// Miters longer than this many half widths are drawn as bevels.
+#ifndef WREN_MITER_LIMIT
+#define WREN_MITER_LIMIT 4
+#endif
+
+// Coverage ranges kept per sample row when stroking. Strokes are drawn in
+// strips of 2*(WREN_STROKE_RANGES - 1) sample columns, which always fit; it has
+// to be more than WREN_AA_RES/2.
+#ifndef WREN_STROKE_RANGES
+#define WREN_STROKE_RANGES 64
+#endif
+
+// Polyline segments wrenThickPolyline sets up at once, 64 bytes each on the
+// stack. Strips and bands of rows are sized so that their segments fit; rows
+// crossed by more are swept in several batches.
+#ifndef WREN_STROKE_BATCH
+#define WREN_STROKE_BATCH 256
+#endif
+
+// Vertices of a mesh as separate arrays: vertex i is at (x[i], y[i]) with
+// depth z[i]. Without z the mesh is drawn without a depth test.
+typedef struct {
+    const int *x;
+    const int *y;
+    const uint32_t *z;
+} WrenMeshPositions;
+
+// Triangle list of a mesh, three indices per triangle: 16-bit when i16 is set
+// and 32-bit otherwise.
+typedef struct {
+    const uint16_t *i16;
+    const uint32_t *i32;
+} WrenMeshIndices;
+
+// Vertices wrenProjectMesh keeps once transformed, looked up by index.
+#ifndef WREN_MESH_CACHE_SIZE
+#define WREN_MESH_CACHE_SIZE 32
+#endif
+
+// 4x4 transform in 16.16 fixed point, row by row: a point (x, y, z) maps to
+// the clip coordinates m[4*r]*x + m[4*r + 1]*y + m[4*r + 2]*z + m[4*r + 3] for
+// rows r = 0..3, the last one being w.
+typedef struct {
+    int32_t m[16];
+} WrenMatrix;
+
+// Farthest projected coordinate from the center of the canvas, in canvas
+// halves, that wrenTransformVertices keeps without clamping.
+#ifndef WREN_NDC_LIMIT
+#define WREN_NDC_LIMIT 4096
+#endif
+
+// Triangles with a vertex more than this many pixels outside the canvas are
+// first clipped to that band, which keeps the setup arithmetic of the
+// rasterizer in range. Canvas sides plus twice the band must stay below 2^22.
+#ifndef WREN_GUARD_BAND
+#define WREN_GUARD_BAND (1 << 20)
+#endif
+
 #define WREN_CANVAS_NULL ((WrenCanvas) {0})
 #define WREN_PIXEL(wc, x, y) (wc).pixels[(y)*(wc).stride + (x)]
 
@@ -107,23 +357,199 @@ typedef struct {
 
 WRENDEF WrenCanvas wrenCanvas(uint32_t *pixels, size_t width, size_t height, size_t stride);
 WRENDEF WrenCanvas wrenSubcanvas(WrenCanvas wc, int x, int y, int w, int h);
+WRENDEF WrenCanvas wrenAttachDepth16(WrenCanvas wc, uint16_t *depth, size_t stride);
+WRENDEF WrenCanvas wrenAttachDepth32(WrenCanvas wc, uint32_t *depth, size_t stride);
+WRENDEF WrenHiZ wrenHiZ(uint32_t *tiles, size_t stride);
+WRENDEF WrenCanvas wrenAttachHiZ(WrenCanvas wc, WrenHiZ *hiz);
+WRENDEF void wrenClearDepth(WrenCanvas wc);
 WRENDEF void wrenBlendColors(uint32_t *c1, uint32_t c2);
+WRENDEF void wrenFillSpan(uint32_t *pixels, size_t n, uint32_t color);
+WRENDEF void wrenCopySpan(uint32_t *dst, const uint32_t *src, size_t n);
+WRENDEF void wrenBlendSpanOpaque(uint32_t *pixels, size_t n, uint32_t color);
+WRENDEF void wrenBlendSpan(uint32_t *pixels, size_t n, uint32_t color);
+WRENDEF void wrenBlendSpanColors(uint32_t *pixels, const uint32_t *colors, size_t n);
+WRENDEF uint32_t wrenPremultiply(uint32_t color);
+WRENDEF uint32_t wrenUnpremultiply(uint32_t color);
+WRENDEF void wrenCompositeSpan(uint32_t *pixels, const uint32_t *colors, size_t n, WrenCompositeOp op);
+WRENDEF void wrenComposite(WrenCanvas dst, WrenCanvas src, int x, int y, WrenCompositeOp op);
+WRENDEF void wrenBlit(WrenCanvas dst, WrenCanvas src, int x, int y, WrenBlitMode mode, uint8_t opacity, uint32_t key);
+WRENDEF size_t wrenEncodeRLE(WrenCanvas src, uint32_t *out, size_t capacity);
+WRENDEF void wrenBlitRLE(WrenCanvas dst, WrenRLE sprite, int x, int y, uint8_t opacity);
+WRENDEF void wrenBlitAffine(WrenCanvas src, WrenCanvas dst, WrenAffine m, WrenFilter filter);
+WRENDEF void wrenPaintSpan(WrenCanvas wc, int x, int y, size_t n, uint32_t color);
+WRENDEF void wrenPaintSpanColors(WrenCanvas wc, int x, int y, uint32_t *colors, size_t n);
+WRENDEF WrenMask wrenMask(const uint8_t *values, size_t width, size_t height, size_t stride, uint8_t max);
+WRENDEF void wrenStampMask(WrenCanvas wc, WrenMask mask, int x, int y, uint32_t color);
+WRENDEF WrenBitMask wrenBitMask(const uint32_t *bits, size_t width, size_t height, size_t stride);
+WRENDEF void wrenStampBits(WrenCanvas wc, WrenBitMask mask, int x, int y, uint32_t color);
 WRENDEF void wrenFill(WrenCanvas wc, uint32_t color);
 WRENDEF void wrenRect(WrenCanvas wc, int x, int y, int w, int h, uint32_t color);
 WRENDEF void wrenCircle(WrenCanvas wc, int cx, int cy, int r, uint32_t color);
 WRENDEF void wrenLine(WrenCanvas wc, int x1, int y1, int x2, int y2, uint32_t color);
+WRENDEF void wrenPolyline(WrenCanvas wc, const int *xy, size_t n, uint32_t color);
+WRENDEF void wrenLines(WrenCanvas wc, const int *xy, size_t n, uint32_t color);
+WRENDEF void wrenLineAA(WrenCanvas wc, int x1, int y1, int x2, int y2, uint32_t color);
+WRENDEF void wrenThickLine(WrenCanvas wc, int x1, int y1, int x2, int y2, int width, WrenLineCap cap, uint32_t color);
+WRENDEF void wrenThickPolyline(WrenCanvas wc, const int *xy, size_t n, int width, WrenLineCap cap, WrenLineJoin join, uint32_t color);
 WRENDEF void wrenTriangle3(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t c1, uint32_t c2, uint32_t c3);
 WRENDEF void wrenTriangle(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t color);
+WRENDEF void wrenTriangleZ(WrenCanvas wc, int x1, int y1, uint32_t z1, int x2, int y2, uint32_t z2, int x3, int y3, uint32_t z3, uint32_t c1, uint32_t c2, uint32_t c3);
+WRENDEF void wrenDrawMesh(WrenCanvas wc, WrenMeshPositions positions, const uint32_t *colors, WrenMeshIndices indices, size_t count);
+WRENDEF size_t wrenTransformVertices(WrenCanvas wc, WrenMatrix m, const int32_t *x, const int32_t *y, const int32_t *z, size_t count, int *sx, int *sy, uint32_t *sz);
+WRENDEF void wrenProjectMesh(WrenCanvas wc, WrenMatrix m, const int32_t *x, const int32_t *y, const int32_t *z, const uint32_t *colors, WrenMeshIndices indices, size_t count);
 WRENDEF void wrenText(WrenCanvas wc, const char *text, int x, int y, WrenFont font, size_t size, uint32_t color);
+WRENDEF void wrenTextMeasure(const char *text, WrenFont font, size_t size, int *width, int *height);
+WRENDEF size_t wrenLayoutText(WrenTextLayout *layout, const char *text, int x, int y, int w, int h, WrenTextAlign align, WrenFont font, size_t size, WrenPlacedGlyph *glyphs, size_t capacity);
+WRENDEF void wrenDrawTextLayout(WrenCanvas wc, const WrenTextLayout *layout, uint32_t color);
+WRENDEF size_t wrenLoadPSF2(WrenFont *font, const uint8_t *data, size_t size, WrenGlyph *metrics, size_t count, uint32_t *bits, size_t capacity);
+WRENDEF size_t wrenLoadBDF(WrenFont *font, const char *data, size_t size, WrenGlyph *metrics, size_t count, uint32_t *bits, size_t capacity);
+WRENDEF size_t wrenLoadTrueType(WrenFont *font, const uint8_t *data, size_t size, size_t pixels, WrenGlyph *metrics, size_t count, WrenKerning *kerning, size_t kerningCapacity, uint8_t *atlas, size_t capacity);
 
 WRENDEF void wrenCopy(WrenCanvas src, WrenCanvas dst);
+WRENDEF void wrenCopyBilinear(WrenCanvas src, WrenCanvas dst, uint32_t *scratch);
+WRENDEF void wrenCopyBox(WrenCanvas src, WrenCanvas dst, uint32_t *scratch);
+
+// Pixels of scratch memory wrenCopyBilinear and wrenCopyBox need for a
+// destination of the given width.
+#define WREN_RESAMPLE_SCRATCH(width) (9*(width))
 
 WRENDEF bool wrenNormalizeRect(int x, int y, int w, int h, size_t pixelsWidth, size_t pixelsHeight, int *x1, int *x2, int *y1, int *y2);
 
+// Deferred rendering: draw calls are recorded into a command buffer, binned
+// into WREN_TILE_SIZE square tiles and replayed tile by tile. Every tile runs
+// its commands in recording order, so the result is identical to drawing them
+// immediately.
+#ifndef WREN_TILE_SIZE
+#define WREN_TILE_SIZE 64
+#endif
+
+#define WREN_TILE_COUNT(width, height) ((((width) + WREN_TILE_SIZE - 1)/WREN_TILE_SIZE)*(((height) + WREN_TILE_SIZE - 1)/WREN_TILE_SIZE))
+
+typedef enum {
+    WREN_COMMAND_FILL = 0,
+    WREN_COMMAND_RECT,
+    WREN_COMMAND_CIRCLE,
+    WREN_COMMAND_LINE,
+    WREN_COMMAND_TRIANGLE,
+    WREN_COMMAND_TRIANGLE3,
+    WREN_COMMAND_TEXT,
+} WrenCommandKind;
+
+typedef struct {
+    WrenCommandKind kind;
+    // Arguments of the draw call in order: coordinates go to args, colors to
+    // colors. Text is not copied and has to outlive the command.
+    int args[6];
+    uint32_t colors[3];
+    const char *text;
+    WrenFont font;
+    size_t size;
+    // Inclusive bounds of the pixels the command may touch. Fill covers
+    // everything.
+    int x1, y1, x2, y2;
+} WrenCommand;
+
+typedef struct {
+    WrenCommand *commands;
+    size_t count;
+    size_t capacity;
+    // Optional storage that recorded text is copied into, so that the buffer
+    // can be kept as a display list after the caller's strings change.
+    char *chars;
+    size_t charCount;
+    size_t charCapacity;
+} WrenCommandBuffer;
+
+// Inclusive pixel rectangle.
+typedef struct {
+    int x1, y1, x2, y2;
+} WrenRect;
+
+// Commands of tile i are entries[starts[i]..starts[i + 1]). starts holds
+// WREN_TILE_COUNT(width, height) + 1 elements.
+typedef struct {
+    uint32_t *starts;
+    uint32_t *entries;
+    size_t capacity;
+    size_t columns, rows;
+    // Set when the entries did not fit; tiles then test every command.
+    bool overflow;
+} WrenBins;
+
+WRENDEF WrenCommandBuffer wrenCommandBuffer(WrenCommand *commands, size_t capacity);
+WRENDEF WrenCommandBuffer wrenDisplayList(WrenCommand *commands, size_t capacity, char *chars, size_t charCapacity);
+WRENDEF void wrenClearCommands(WrenCommandBuffer *cb);
+WRENDEF bool wrenRecordFill(WrenCommandBuffer *cb, uint32_t color);
+WRENDEF bool wrenRecordRect(WrenCommandBuffer *cb, int x, int y, int w, int h, uint32_t color);
+WRENDEF bool wrenRecordCircle(WrenCommandBuffer *cb, int cx, int cy, int r, uint32_t color);
+WRENDEF bool wrenRecordLine(WrenCommandBuffer *cb, int x1, int y1, int x2, int y2, uint32_t color);
+WRENDEF bool wrenRecordTriangle3(WrenCommandBuffer *cb, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t c1, uint32_t c2, uint32_t c3);
+WRENDEF bool wrenRecordTriangle(WrenCommandBuffer *cb, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t color);
+WRENDEF bool wrenRecordText(WrenCommandBuffer *cb, const char *text, int x, int y, WrenFont font, size_t size, uint32_t color);
+WRENDEF void wrenRunCommand(WrenCanvas wc, const WrenCommand *cmd, int dx, int dy);
+WRENDEF void wrenReplay(WrenCanvas wc, const WrenCommandBuffer *cb);
+WRENDEF void wrenReplayRect(WrenCanvas wc, const WrenCommandBuffer *cb, WrenRect rect);
+WRENDEF bool wrenCommandEqual(const WrenCommand *a, const WrenCommand *b);
+WRENDEF size_t wrenDiffCommands(WrenCanvas wc, const WrenCommandBuffer *prev, const WrenCommandBuffer *next, WrenRect *rects, size_t capacity);
+
+WRENDEF WrenBins wrenBins(uint32_t *starts, uint32_t *entries, size_t capacity);
+WRENDEF void wrenBinCommands(WrenBins *bins, WrenCanvas wc, const WrenCommandBuffer *cb);
+WRENDEF void wrenRenderTile(WrenCanvas wc, const WrenCommandBuffer *cb, const WrenBins *bins, size_t tile);
+WRENDEF void wrenRender(WrenCanvas wc, const WrenCommandBuffer *cb, WrenBins *bins);
+
+// Define WREN_THREADS to rasterize tiles on a pthread worker pool.
+#ifdef WREN_THREADS
+#include <pthread.h>
+
+#ifndef WREN_MAX_THREADS
+#define WREN_MAX_THREADS 64
+#endif
+
+typedef struct {
+    pthread_t threads[WREN_MAX_THREADS];
+    size_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    bool stopping;
+    // Current job: indices [0, jobCount) are handed out one at a time.
+    void (*job)(void *data, size_t index);
+    void *data;
+    size_t jobCount, next, finished;
+} WrenThreadPool;
+
+WRENDEF bool wrenThreadPoolStart(WrenThreadPool *pool, size_t threads);
+WRENDEF void wrenThreadPoolStop(WrenThreadPool *pool);
+WRENDEF void wrenThreadPoolRun(WrenThreadPool *pool, void (*job)(void *data, size_t index), void *data, size_t count);
+WRENDEF void wrenRenderThreaded(WrenThreadPool *pool, WrenCanvas wc, const WrenCommandBuffer *cb, WrenBins *bins);
+
+// Internal caches are kept per thread so that workers never share them.
+#define WREN_THREAD_LOCAL _Thread_local
+#else
+#define WREN_THREAD_LOCAL
+#endif
+
 #endif
 
 #ifdef WREN_IMPLEMENTATION
 
+// Span kernels are picked at compile time from whatever the target enables.
+// Define WREN_NO_SIMD to force the scalar fallback.
+#ifndef WREN_NO_SIMD
+#if defined(__AVX2__)
+#define WREN_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define WREN_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define WREN_SIMD_NEON
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#define WREN_SIMD_WASM
+#include <wasm_simd128.h>
+#endif
+#endif
+
 WRENDEF WrenCanvas wrenCanvas(uint32_t *pixels, size_t width, size_t height, size_t stride) {
     WrenCanvas wc = {
         .pixels = pixels,
@@ -165,9 +591,70 @@ WRENDEF WrenCanvas wrenSubcanvas(WrenCanvas wc, int x, int y, int w, int h) {
     wc.pixels = &WREN_PIXEL(wc, x1, y1);
     wc.width = x2 - x1 + 1;
     wc.height = y2 - y1 + 1;
+    if (wc.depth16 != NULL) wc.depth16 += y1*wc.depthStride + x1;
+    if (wc.depth32 != NULL) wc.depth32 += y1*wc.depthStride + x1;
+    wc.hizX += x1;
+    wc.hizY += y1;
+    return wc;
+}
+
+// Depth buffers cover the whole canvas. 16-bit ones keep the top half of the
+// depth values wrenTriangleZ takes.
+WRENDEF WrenCanvas wrenAttachDepth16(WrenCanvas wc, uint16_t *depth, size_t stride) {
+    wc.depth16 = depth;
+    wc.depth32 = NULL;
+    wc.depthStride = stride;
+    return wc;
+}
+
+WRENDEF WrenCanvas wrenAttachDepth32(WrenCanvas wc, uint32_t *depth, size_t stride) {
+    wc.depth16 = NULL;
+    wc.depth32 = depth;
+    wc.depthStride = stride;
+    return wc;
+}
+
+WRENDEF WrenHiZ wrenHiZ(uint32_t *tiles, size_t stride) {
+    WrenHiZ hiz = {
+        .tiles = tiles,
+        .stride = stride,
+    };
+
+    return hiz;
+}
+
+// Attaches to a canvas with a depth buffer before any subcanvas is made of it,
+// so that tiles line up with the buffer. Clear the depth to start using it.
+WRENDEF WrenCanvas wrenAttachHiZ(WrenCanvas wc, WrenHiZ *hiz) {
+    wc.hiz = hiz;
+    wc.hizX = wc.hizY = 0;
     return wc;
 }
 
+// Tile of canvas pixel (x, y); x and y may lie before the canvas as long as
+// they are in the depth buffer.
+static inline uint32_t *wrenHiZTile(WrenCanvas wc, int x, int y) {
+    size_t tx = (x + (int) wc.hizX)/WREN_HIZ_TILE_SIZE, ty = (y + (int) wc.hizY)/WREN_HIZ_TILE_SIZE;
+    return &wc.hiz->tiles[ty*wc.hiz->stride + tx];
+}
+
+// Sets the whole depth buffer to the farthest depth.
+WRENDEF void wrenClearDepth(WrenCanvas wc) {
+    for (size_t y = 0; y < wc.height; y++) {
+        for (size_t x = 0; x < wc.width; x++) {
+            if (wc.depth16 != NULL) wc.depth16[y*wc.depthStride + x] = UINT16_MAX;
+            if (wc.depth32 != NULL) wc.depth32[y*wc.depthStride + x] = UINT32_MAX;
+        }
+    }
+    if (wc.hiz == NULL || wc.width == 0 || wc.height == 0) return;
+    for (size_t y = 0; y < wc.height + WREN_HIZ_TILE_SIZE; y += WREN_HIZ_TILE_SIZE) {
+        for (size_t x = 0; x < wc.width + WREN_HIZ_TILE_SIZE; x += WREN_HIZ_TILE_SIZE) {
+            size_t px = x < wc.width ? x : wc.width - 1, py = y < wc.height ? y : wc.height - 1;
+            *wrenHiZTile(wc, px, py) = UINT32_MAX;
+        }
+    }
+}
+
 WRENDEF void wrenBlendColors(uint32_t *c1, uint32_t c2) {
     uint32_t r1 = WREN_RED(*c1);
     uint32_t g1 = WREN_GREEN(*c1);
@@ -186,253 +673,4663 @@ WRENDEF void wrenBlendColors(uint32_t *c1, uint32_t c2) {
     *c1 = WREN_RGBA(r1, g1, b1, a1);
 }
 
-WRENDEF void wrenFill(WrenCanvas wc, uint32_t color) {
-    for (size_t y = 0; y < wc.height; y++) {
-        for (size_t x = 0; x < wc.width; x++) {
-            WREN_PIXEL(wc, x, y) = color;
-        }
-    }
+WRENDEF void wrenFillSpan(uint32_t *pixels, size_t n, uint32_t color) {
+    size_t i = 0;
+#if defined(WREN_SIMD_AVX2)
+    __m256i c = _mm256_set1_epi32((int) color);
+    for (; i < (n&~(size_t) 7); i += 8) _mm256_storeu_si256((__m256i *) &pixels[i], c);
+#elif defined(WREN_SIMD_SSE2)
+    __m128i c = _mm_set1_epi32((int) color);
+    for (; i < (n&~(size_t) 3); i += 4) _mm_storeu_si128((__m128i *) &pixels[i], c);
+#elif defined(WREN_SIMD_NEON)
+    uint32x4_t c = vdupq_n_u32(color);
+    for (; i < (n&~(size_t) 3); i += 4) vst1q_u32(&pixels[i], c);
+#elif defined(WREN_SIMD_WASM)
+    v128_t c = wasm_i32x4_splat((int32_t) color);
+    for (; i < (n&~(size_t) 3); i += 4) wasm_v128_store(&pixels[i], c);
+#endif
+    for (; i < n; i++) pixels[i] = color;
 }
 
-WRENDEF void wrenRect(WrenCanvas wc, int x, int y, int w, int h, uint32_t color) {
-    int x1, y1, x2, y2;
-    if (!wrenNormalizeRect(x, y, w, h, wc.width, wc.height, &x1, &x2, &y1, &y2)) return;
+// Copies n pixels from src to dst, which must not overlap.
+WRENDEF void wrenCopySpan(uint32_t *dst, const uint32_t *src, size_t n) {
+    size_t i = 0;
+#if defined(WREN_SIMD_AVX2)
+    for (; i < (n&~(size_t) 7); i += 8) {
+        _mm256_storeu_si256((__m256i *) &dst[i], _mm256_loadu_si256((const __m256i *) &src[i]));
+    }
+#elif defined(WREN_SIMD_SSE2)
+    for (; i < (n&~(size_t) 3); i += 4) {
+        _mm_storeu_si128((__m128i *) &dst[i], _mm_loadu_si128((const __m128i *) &src[i]));
+    }
+#elif defined(WREN_SIMD_NEON)
+    for (; i < (n&~(size_t) 3); i += 4) vst1q_u32(&dst[i], vld1q_u32(&src[i]));
+#elif defined(WREN_SIMD_WASM)
+    for (; i < (n&~(size_t) 3); i += 4) wasm_v128_store(&dst[i], wasm_v128_load(&src[i]));
+#endif
+    for (; i < n; i++) dst[i] = src[i];
+}
 
-    for (int y = y1; y <= y2; y++) {
-        for (int x = x1; x <= x2; x++) {
-            wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
-        }
+// Blending a fully opaque color replaces the color channels and, like
+// wrenBlendColors, keeps the destination alpha.
+WRENDEF void wrenBlendSpanOpaque(uint32_t *pixels, size_t n, uint32_t color) {
+    color &= 0x00FFFFFF;
+    size_t i = 0;
+#if defined(WREN_SIMD_AVX2)
+    __m256i c = _mm256_set1_epi32((int) color);
+    __m256i m = _mm256_set1_epi32((int) 0xFF000000);
+    for (; i < (n&~(size_t) 7); i += 8) {
+        __m256i d = _mm256_loadu_si256((__m256i *) &pixels[i]);
+        _mm256_storeu_si256((__m256i *) &pixels[i], _mm256_or_si256(_mm256_and_si256(d, m), c));
+    }
+#elif defined(WREN_SIMD_SSE2)
+    __m128i c = _mm_set1_epi32((int) color);
+    __m128i m = _mm_set1_epi32((int) 0xFF000000);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        __m128i d = _mm_loadu_si128((__m128i *) &pixels[i]);
+        _mm_storeu_si128((__m128i *) &pixels[i], _mm_or_si128(_mm_and_si128(d, m), c));
+    }
+#elif defined(WREN_SIMD_NEON)
+    uint32x4_t c = vdupq_n_u32(color);
+    uint32x4_t m = vdupq_n_u32(0xFF000000);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        uint32x4_t d = vld1q_u32(&pixels[i]);
+        vst1q_u32(&pixels[i], vorrq_u32(vandq_u32(d, m), c));
+    }
+#elif defined(WREN_SIMD_WASM)
+    v128_t c = wasm_i32x4_splat((int32_t) color);
+    v128_t m = wasm_i32x4_splat((int32_t) 0xFF000000);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        v128_t d = wasm_v128_load(&pixels[i]);
+        wasm_v128_store(&pixels[i], wasm_v128_or(wasm_v128_and(d, m), c));
     }
+#endif
+    for (; i < n; i++) pixels[i] = (pixels[i]&0xFF000000)|color;
 }
 
-WRENDEF void wrenCircle(WrenCanvas wc, int cx, int cy, int r, uint32_t color) {
-    int x1, x2, y1, y2;
-    int r1 = r + WREN_SIGN(int, r);
-    if (!wrenNormalizeRect(cx - r1, cy - r1, 2*r1, 2*r1, wc.width, wc.height, &x1, &x2, &y1, &y2)) return;
+#if defined(WREN_SIMD_AVX2)
+// Exact x/255 for 0 <= x <= 255*255: ((x + 1)*257) >> 16.
+static inline __m256i wrenDiv255Avx2(__m256i x) {
+    return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_set1_epi16(257));
+}
+#elif defined(WREN_SIMD_SSE2)
+// Exact x/255 for 0 <= x <= 255*255: ((x + 1)*257) >> 16.
+static inline __m128i wrenDiv255Sse2(__m128i x) {
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_set1_epi16(257));
+}
+#elif defined(WREN_SIMD_NEON)
+// Exact x/255 for 0 <= x <= 255*255: (x + 1 + (x >> 8)) >> 8, narrowed to bytes.
+static inline uint8x8_t wrenDiv255Neon(uint16x8_t x) {
+    return vshrn_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8);
+}
+#elif defined(WREN_SIMD_WASM)
+// Exact x/255 for 0 <= x <= 255*255: (x + 1 + (x >> 8)) >> 8.
+static inline v128_t wrenDiv255Wasm(v128_t x) {
+    return wasm_u16x8_shr(wasm_i16x8_add(wasm_i16x8_add(x, wasm_i16x8_splat(1)), wasm_u16x8_shr(x, 8)), 8);
+}
+#endif
 
-    for (int y = y1; y <= y2; y++) {
-        for (int x = x1; x <= x2; x++) {
-            int count = 0;
-            for (int sox = 0; sox < WREN_AA_RES; sox++) {
-                for (int soy = 0; soy < WREN_AA_RES; soy++) {
-                    int res1 = (WREN_AA_RES + 1);
-                    int dx = (x*res1*2 + 2 + sox*2 - res1*cx*2 - res1);
-                    int dy = (y*res1*2 + 2 + soy*2 - res1*cy*2 - res1);
-                    if (dx*dx + dy*dy <= res1*res1*r*r*2*2) count += 1;
-                }
-            }
-            uint32_t alpha = ((color&0xFF000000)>>(3*8))*count/WREN_AA_RES/WREN_AA_RES;
-            uint32_t updatedColor = (color&0x00FFFFFF)|(alpha<<(3*8));
-            wrenBlendColors(&WREN_PIXEL(wc, x, y), updatedColor);
+// Same arithmetic as wrenBlendColors, several pixels at a time: every color
+// channel becomes (dst*(255 - a) + src*a)/255 and the destination alpha stays.
+WRENDEF void wrenBlendSpan(uint32_t *pixels, size_t n, uint32_t color) {
+    uint32_t a = WREN_ALPHA(color);
+    if (a == 0) return;
+    if (a == 0xFF) {
+        wrenBlendSpanOpaque(pixels, n, color);
+        return;
+    }
+
+    uint32_t ra = WREN_RED(color)*a;
+    uint32_t ga = WREN_GREEN(color)*a;
+    uint32_t ba = WREN_BLUE(color)*a;
+    size_t i = 0;
+#if defined(WREN_SIMD_AVX2)
+    __m256i zero = _mm256_setzero_si256();
+    __m256i alphaMask = _mm256_set1_epi32((int) 0xFF000000);
+    __m256i inv = _mm256_set1_epi16((short) (255 - a));
+    __m256i src = _mm256_set_epi16(0, (short) ba, (short) ga, (short) ra, 0, (short) ba, (short) ga, (short) ra,
+                                   0, (short) ba, (short) ga, (short) ra, 0, (short) ba, (short) ga, (short) ra);
+    for (; i < (n&~(size_t) 7); i += 8) {
+        __m256i d = _mm256_loadu_si256((__m256i *) &pixels[i]);
+        __m256i lo = wrenDiv255Avx2(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inv), src));
+        __m256i hi = wrenDiv255Avx2(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inv), src));
+        __m256i res = _mm256_blendv_epi8(_mm256_packus_epi16(lo, hi), d, alphaMask);
+        _mm256_storeu_si256((__m256i *) &pixels[i], res);
+    }
+#elif defined(WREN_SIMD_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+    __m128i inv = _mm_set1_epi16((short) (255 - a));
+    __m128i src = _mm_set_epi16(0, (short) ba, (short) ga, (short) ra, 0, (short) ba, (short) ga, (short) ra);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        __m128i d = _mm_loadu_si128((__m128i *) &pixels[i]);
+        __m128i lo = wrenDiv255Sse2(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv), src));
+        __m128i hi = wrenDiv255Sse2(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv), src));
+        __m128i res = _mm_or_si128(_mm_andnot_si128(alphaMask, _mm_packus_epi16(lo, hi)), _mm_and_si128(d, alphaMask));
+        _mm_storeu_si128((__m128i *) &pixels[i], res);
+    }
+#elif defined(WREN_SIMD_NEON)
+    uint8x8_t inv = vdup_n_u8((uint8_t) (255 - a));
+    uint16x8_t src[3] = {vdupq_n_u16((uint16_t) ra), vdupq_n_u16((uint16_t) ga), vdupq_n_u16((uint16_t) ba)};
+    for (; i < (n&~(size_t) 15); i += 16) {
+        uint8x16x4_t d = vld4q_u8((uint8_t *) &pixels[i]);
+        for (int c = 0; c < 3; c++) {
+            uint8x8_t lo = wrenDiv255Neon(vmlal_u8(src[c], vget_low_u8(d.val[c]), inv));
+            uint8x8_t hi = wrenDiv255Neon(vmlal_u8(src[c], vget_high_u8(d.val[c]), inv));
+            d.val[c] = vcombine_u8(lo, hi);
         }
+        vst4q_u8((uint8_t *) &pixels[i], d);
+    }
+#elif defined(WREN_SIMD_WASM)
+    v128_t alphaMask = wasm_i32x4_splat((int32_t) 0xFF000000);
+    v128_t inv = wasm_i16x8_splat((int16_t) (255 - a));
+    v128_t src = wasm_u16x8_make(ra, ga, ba, 0, ra, ga, ba, 0);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        v128_t d = wasm_v128_load(&pixels[i]);
+        v128_t lo = wrenDiv255Wasm(wasm_i16x8_add(wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(d), inv), src));
+        v128_t hi = wrenDiv255Wasm(wasm_i16x8_add(wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(d), inv), src));
+        wasm_v128_store(&pixels[i], wasm_v128_bitselect(d, wasm_u8x16_narrow_i16x8(lo, hi), alphaMask));
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t d = pixels[i];
+        uint32_t r = (WREN_RED(d)*(255 - a) + ra)/255;
+        uint32_t g = (WREN_GREEN(d)*(255 - a) + ga)/255;
+        uint32_t b = (WREN_BLUE(d)*(255 - a) + ba)/255;
+        pixels[i] = WREN_RGBA(r, g, b, WREN_ALPHA(d));
     }
 }
 
-WRENDEF void wrenLine(WrenCanvas wc, int x1, int y1, int x2, int y2, uint32_t color) {
-    int dx = x2 - x1;
-    int dy = y2 - y1;
-    
-    if (dx != 0) {
-        int c = y1 - dy*x1/dx;
-
-        if (x1 > x2) WREN_SWAP(int, x1, x2);
-        for (int x = x1; x <= x2; x++) {
-            if (0 <= x && x < (int) wc.width) {
-                int sy1 = dy*x/dx + c;
-                int sy2 = dy*(x + 1)/dx + c;
-                if (sy1 > sy2) WREN_SWAP(int, sy1, sy2);
-                for (int y = sy1; y <= sy2; y++) {
-                    if (0 <= y && y < (int) wc.height) {
-                        wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
-                    }
-                }
-            }
+// Per-pixel variant of wrenBlendSpan: pixels[i] is blended with colors[i].
+// Runs of fully transparent or fully opaque source pixels skip the arithmetic.
+WRENDEF void wrenBlendSpanColors(uint32_t *pixels, const uint32_t *colors, size_t n) {
+    size_t i = 0;
+#if defined(WREN_SIMD_AVX2)
+    __m256i zero = _mm256_setzero_si256();
+    __m256i full = _mm256_set1_epi16(255);
+    __m256i alphaMask = _mm256_set1_epi32((int) 0xFF000000);
+    for (; i < (n&~(size_t) 7); i += 8) {
+        __m256i s = _mm256_loadu_si256((__m256i *) &colors[i]);
+        __m256i sa = _mm256_and_si256(s, alphaMask);
+        if (_mm256_testz_si256(sa, sa)) continue;
+        __m256i d = _mm256_loadu_si256((__m256i *) &pixels[i]);
+        __m256i res;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, alphaMask)) == -1) {
+            res = _mm256_blendv_epi8(s, d, alphaMask);
+        } else {
+            __m256i slo = _mm256_unpacklo_epi8(s, zero);
+            __m256i shi = _mm256_unpackhi_epi8(s, zero);
+            __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF);
+            __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF);
+            __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(full, alo)), _mm256_mullo_epi16(slo, alo));
+            __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(full, ahi)), _mm256_mullo_epi16(shi, ahi));
+            res = _mm256_blendv_epi8(_mm256_packus_epi16(wrenDiv255Avx2(lo), wrenDiv255Avx2(hi)), d, alphaMask);
         }
-    } else {
-        int x = x1;
-        if (0 <= x && x < (int) wc.width) {
-            if (y1 > y2) WREN_SWAP(int, y1, y2);
-            for (int y = y1; y <= y2; y++) {
-                if (0 <= y && y < (int) wc.height) {
-                    wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
-                }
-            }
+        _mm256_storeu_si256((__m256i *) &pixels[i], res);
+    }
+#elif defined(WREN_SIMD_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i full = _mm_set1_epi16(255);
+    __m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        __m128i s = _mm_loadu_si128((__m128i *) &colors[i]);
+        __m128i sa = _mm_and_si128(s, alphaMask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, zero)) == 0xFFFF) continue;
+        __m128i d = _mm_loadu_si128((__m128i *) &pixels[i]);
+        __m128i res;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, alphaMask)) == 0xFFFF) {
+            res = s;
+        } else {
+            __m128i slo = _mm_unpacklo_epi8(s, zero);
+            __m128i shi = _mm_unpackhi_epi8(s, zero);
+            __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+            __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, alo)), _mm_mullo_epi16(slo, alo));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, ahi)), _mm_mullo_epi16(shi, ahi));
+            res = _mm_packus_epi16(wrenDiv255Sse2(lo), wrenDiv255Sse2(hi));
+        }
+        res = _mm_or_si128(_mm_andnot_si128(alphaMask, res), _mm_and_si128(d, alphaMask));
+        _mm_storeu_si128((__m128i *) &pixels[i], res);
+    }
+#elif defined(WREN_SIMD_NEON)
+    for (; i < (n&~(size_t) 15); i += 16) {
+        uint8x16x4_t s = vld4q_u8((const uint8_t *) &colors[i]);
+        uint8x16x4_t d = vld4q_u8((uint8_t *) &pixels[i]);
+        uint8x16_t inv = vmvnq_u8(s.val[3]);
+        for (int c = 0; c < 3; c++) {
+            uint16x8_t lo = vmull_u8(vget_low_u8(d.val[c]), vget_low_u8(inv));
+            uint16x8_t hi = vmull_u8(vget_high_u8(d.val[c]), vget_high_u8(inv));
+            lo = vmlal_u8(lo, vget_low_u8(s.val[c]), vget_low_u8(s.val[3]));
+            hi = vmlal_u8(hi, vget_high_u8(s.val[c]), vget_high_u8(s.val[3]));
+            d.val[c] = vcombine_u8(wrenDiv255Neon(lo), wrenDiv255Neon(hi));
+        }
+        vst4q_u8((uint8_t *) &pixels[i], d);
+    }
+#elif defined(WREN_SIMD_WASM)
+    v128_t full = wasm_i16x8_splat(255);
+    v128_t alphaMask = wasm_i32x4_splat((int32_t) 0xFF000000);
+    for (; i < (n&~(size_t) 3); i += 4) {
+        v128_t s = wasm_v128_load(&colors[i]);
+        v128_t sa = wasm_v128_and(s, alphaMask);
+        if (!wasm_v128_any_true(sa)) continue;
+        v128_t d = wasm_v128_load(&pixels[i]);
+        v128_t res;
+        if (wasm_i32x4_all_true(wasm_i32x4_eq(sa, alphaMask))) {
+            res = s;
+        } else {
+            v128_t a = wasm_i8x16_shuffle(s, s, 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+            v128_t alo = wasm_u16x8_extend_low_u8x16(a);
+            v128_t ahi = wasm_u16x8_extend_high_u8x16(a);
+            v128_t lo = wasm_i16x8_add(wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(d), wasm_i16x8_sub(full, alo)),
+                                       wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(s), alo));
+            v128_t hi = wasm_i16x8_add(wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(d), wasm_i16x8_sub(full, ahi)),
+                                       wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(s), ahi));
+            res = wasm_u8x16_narrow_i16x8(wrenDiv255Wasm(lo), wrenDiv255Wasm(hi));
         }
+        wasm_v128_store(&pixels[i], wasm_v128_bitselect(d, res, alphaMask));
     }
+#endif
+    for (; i < n; i++) wrenBlendColors(&pixels[i], colors[i]);
 }
 
-uint32_t mixColors3(uint32_t c1, uint32_t c2, uint32_t c3, int t1, int t2, int t3, int den) {
-    int64_t r1 = WREN_RED(c1);
-    int64_t g1 = WREN_GREEN(c1);
-    int64_t b1 = WREN_BLUE(c1);
-    int64_t a1 = WREN_ALPHA(c1);
+// Floor of a/b for b > 0.
+static inline int64_t wrenFloorDiv(int64_t a, int64_t b) {
+    int64_t q = a/b;
+    if (a%b != 0 && a < 0) q -= 1;
+    return q;
+}
 
-    int64_t r2 = WREN_RED(c2);
-    int64_t g2 = WREN_GREEN(c2);
-    int64_t b2 = WREN_BLUE(c2);
-    int64_t a2 = WREN_ALPHA(c2);
+// Rounded x*y/255 for 0 <= x, y <= 255.
+static inline uint32_t wrenMul255(uint32_t x, uint32_t y) {
+    uint32_t t = x*y + 128;
+    return (t + (t>>8))>>8;
+}
 
-    int64_t r3 = WREN_RED(c3);
-    int64_t g3 = WREN_GREEN(c3);
-    int64_t b3 = WREN_BLUE(c3);
-    int64_t a3 = WREN_ALPHA(c3);
+// Rounded c*a/255 for all four channels of c, two channels per multiply.
+static inline uint32_t wrenScalePixel(uint32_t c, uint32_t a) {
+    uint32_t rb = (c&0x00FF00FF)*a + 0x00800080;
+    rb = ((rb + ((rb>>8)&0x00FF00FF))>>8)&0x00FF00FF;
+    uint32_t ga = ((c>>8)&0x00FF00FF)*a + 0x00800080;
+    ga = (ga + ((ga>>8)&0x00FF00FF))&0xFF00FF00;
+    return rb|ga;
+}
 
-    int64_t r4 = (r1*t1 + r2*t2 + r3*t3)/den;
-    int64_t g4 = (g1*t1 + g2*t2 + g3*t3)/den;
-    int64_t b4 = (b1*t1 + b2*t2 + b3*t3)/den;
-    int64_t a4 = (a1*t1 + a2*t2 + a3*t3)/den;
+// Per-channel c1 + c2 clamped to 255.
+static inline uint32_t wrenAddPixels(uint32_t c1, uint32_t c2) {
+    uint32_t rb = (c1&0x00FF00FF) + (c2&0x00FF00FF);
+    rb = (rb|(0x01000100 - ((rb>>8)&0x00010001)))&0x00FF00FF;
+    uint32_t ga = ((c1>>8)&0x00FF00FF) + ((c2>>8)&0x00FF00FF);
+    ga = (ga|(0x01000100 - ((ga>>8)&0x00010001)))&0x00FF00FF;
+    return rb|(ga<<8);
+}
 
-    return WREN_RGBA(r4, g4, b4, a4);
+WRENDEF uint32_t wrenPremultiply(uint32_t color) {
+    return (wrenScalePixel(color, WREN_ALPHA(color))&0x00FFFFFF)|(color&0xFF000000);
 }
 
-void barycentric(int x1, int y1, int x2, int y2, int x3, int y3, int xp, int yp, int *u1, int *u2, int *det) {
-    *det = ((x1 - x3)*(y2 - y3) - (x2 - x3)*(y1 - y3));
-    *u1  = ((y2 - y3)*(xp - x3) + (x3 - x2)*(yp - y3));
-    *u2  = ((y3 - y1)*(xp - x3) + (x1 - x3)*(yp - y3));
+WRENDEF uint32_t wrenUnpremultiply(uint32_t color) {
+    uint32_t a = WREN_ALPHA(color);
+    if (a == 0) return 0;
+    uint32_t r = (WREN_RED(color)*255 + a/2)/a;     if (r > 255) r = 255;
+    uint32_t g = (WREN_GREEN(color)*255 + a/2)/a;   if (g > 255) g = 255;
+    uint32_t b = (WREN_BLUE(color)*255 + a/2)/a;    if (b > 255) b = 255;
+    return WREN_RGBA(r, g, b, a);
 }
 
-WRENDEF void wrenTriangle3(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t c1, uint32_t c2, uint32_t c3) {
-    if (y1 > y2) {
-        WREN_SWAP(int, x1, x2);
-        WREN_SWAP(int, y1, y2);
-        WREN_SWAP(int, c1, c2);
+// Both spans hold premultiplied pixels. Every operator gets its own loop so
+// the per-pixel work is a couple of packed multiply-adds and no divisions.
+WRENDEF void wrenCompositeSpan(uint32_t *pixels, const uint32_t *colors, size_t n, WrenCompositeOp op) {
+    switch (op) {
+    case WREN_OP_SRC:
+        for (size_t i = 0; i < n; i++) pixels[i] = colors[i];
+        break;
+    case WREN_OP_OVER:
+        for (size_t i = 0; i < n; i++) {
+            uint32_t s = colors[i];
+            pixels[i] = s + wrenScalePixel(pixels[i], 255 - WREN_ALPHA(s));
+        }
+        break;
+    case WREN_OP_IN:
+        for (size_t i = 0; i < n; i++) pixels[i] = wrenScalePixel(colors[i], WREN_ALPHA(pixels[i]));
+        break;
+    case WREN_OP_OUT:
+        for (size_t i = 0; i < n; i++) pixels[i] = wrenScalePixel(colors[i], 255 - WREN_ALPHA(pixels[i]));
+        break;
+    case WREN_OP_ATOP:
+        for (size_t i = 0; i < n; i++) {
+            uint32_t s = colors[i];
+            uint32_t d = pixels[i];
+            pixels[i] = wrenScalePixel(s, WREN_ALPHA(d)) + wrenScalePixel(d, 255 - WREN_ALPHA(s));
+        }
+        break;
+    case WREN_OP_XOR:
+        for (size_t i = 0; i < n; i++) {
+            uint32_t s = colors[i];
+            uint32_t d = pixels[i];
+            pixels[i] = wrenScalePixel(s, 255 - WREN_ALPHA(d)) + wrenScalePixel(d, 255 - WREN_ALPHA(s));
+        }
+        break;
+    case WREN_OP_ADD:
+        for (size_t i = 0; i < n; i++) pixels[i] = wrenAddPixels(pixels[i], colors[i]);
+        break;
+    case WREN_OP_MULTIPLY:
+        // s*(1 - Da) + d*(1 - Sa) + s*d, which also yields Sa + Da - Sa*Da for alpha.
+        for (size_t i = 0; i < n; i++) {
+            uint32_t s = colors[i];
+            uint32_t d = pixels[i];
+            uint32_t t = wrenAddPixels(wrenScalePixel(s, 255 - WREN_ALPHA(d)), wrenScalePixel(d, 255 - WREN_ALPHA(s)));
+            uint32_t m = WREN_RGBA(wrenMul255(WREN_RED(s), WREN_RED(d)), wrenMul255(WREN_GREEN(s), WREN_GREEN(d)),
+                                   wrenMul255(WREN_BLUE(s), WREN_BLUE(d)), wrenMul255(WREN_ALPHA(s), WREN_ALPHA(d)));
+            pixels[i] = wrenAddPixels(t, m);
+        }
+        break;
+    case WREN_OP_SCREEN:
+        // s + d - s*d, written as s + d*(1 - s) per channel.
+        for (size_t i = 0; i < n; i++) {
+            uint32_t s = colors[i];
+            uint32_t d = pixels[i];
+            pixels[i] = s + WREN_RGBA(wrenMul255(WREN_RED(d), 255 - WREN_RED(s)), wrenMul255(WREN_GREEN(d), 255 - WREN_GREEN(s)),
+                                      wrenMul255(WREN_BLUE(d), 255 - WREN_BLUE(s)), wrenMul255(WREN_ALPHA(d), 255 - WREN_ALPHA(s)));
+        }
+        break;
+    default:
+        break;
     }
+}
 
-    if (y2 > y3) {
-        WREN_SWAP(int, x2, x3);
-        WREN_SWAP(int, y2, y3);
-        WREN_SWAP(int, c2, c3);
+WRENDEF void wrenComposite(WrenCanvas dst, WrenCanvas src, int x, int y, WrenCompositeOp op) {
+    if (src.width == 0 || src.height == 0) return;
+    int x1, x2, y1, y2;
+    if (!wrenNormalizeRect(x, y, src.width, src.height, dst.width, dst.height, &x1, &x2, &y1, &y2)) return;
+
+    for (int py = y1; py <= y2; py++) {
+        wrenCompositeSpan(&WREN_PIXEL(dst, x1, py), &WREN_PIXEL(src, x1 - x, py - y), x2 - x1 + 1, op);
     }
-    
-    if (y1 > y2) {
-        WREN_SWAP(int, x1, x2);
-        WREN_SWAP(int, y1, y2);
-        WREN_SWAP(int, c1, c2);
+}
+
+// Blit classes of source pixels: runs of one class are handled together.
+#define WREN_BLIT_SKIP 0
+#define WREN_BLIT_SOLID 1
+#define WREN_BLIT_PARTIAL 2
+
+static inline int wrenBlitClass(uint32_t c, WrenBlitMode mode, uint32_t key) {
+    switch (mode) {
+    case WREN_BLIT_COPY:
+        return WREN_BLIT_SOLID;
+    case WREN_BLIT_KEY:
+        return ((c ^ key)&0x00FFFFFF) == 0 ? WREN_BLIT_SKIP : WREN_BLIT_SOLID;
+    case WREN_BLIT_OVER:
+    case WREN_BLIT_ADD:
+        break;
     }
+    return WREN_ALPHA(c) == 0 ? WREN_BLIT_SKIP : WREN_ALPHA(c) == 0xFF ? WREN_BLIT_SOLID : WREN_BLIT_PARTIAL;
+}
 
-    int dx12 = x2 - x1;
-    int dy12 = y2 - y1;
-    int dx13 = x3 - x1;
-    int dy13 = y3 - y1;
-
-    for (int y = y1; y <= y2; ++y) {
-        if (0 <= y && (size_t) y < wc.height) {
-            int s1 = dy12 != 0 ? (y - y1)*dx12/dy12 + x1 : x1;
-            int s2 = dy13 != 0 ? (y - y1)*dx13/dy13 + x1 : x1;
-            if (s1 > s2) WREN_SWAP(int, s1, s2);
-            for (int x = s1; x <= s2; ++x) {
-                if (0 <= x && (size_t) x < wc.width) {
-                    int u1, u2, det;
-                    barycentric(x1, y1, x2, y2, x3, y3, x, y, &u1, &u2, &det);
-                    uint32_t color = mixColors3(c1, c2, c3, u1, u2, det - u1 - u2, det);
-                    wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
-                }
+// Blends n source pixels with the given mode and opacity, going through a
+// small buffer that holds them in the destination's alpha format.
+static inline void wrenBlitBlend(WrenCanvas dst, uint32_t *pixels, const uint32_t *colors, size_t n,
+                                 bool premultiplied, WrenBlitMode mode, uint32_t opacity) {
+    uint32_t buffer[64];
+    for (size_t i = 0; i < n; i += 64) {
+        size_t m = n - i < 64 ? n - i : 64;
+        for (size_t k = 0; k < m; k++) {
+            uint32_t c = colors[i + k];
+            if (premultiplied && dst.premultiplied && (mode == WREN_BLIT_OVER || mode == WREN_BLIT_ADD)) {
+                buffer[k] = wrenScalePixel(c, opacity);
+                continue;
             }
+            if (premultiplied) c = wrenUnpremultiply(c);
+            uint32_t a = mode == WREN_BLIT_OVER || mode == WREN_BLIT_ADD ? wrenMul255(WREN_ALPHA(c), opacity) : opacity;
+            c = (c&0x00FFFFFF)|(a << 24);
+            buffer[k] = dst.premultiplied ? wrenPremultiply(c) : c;
         }
-    }
 
-    int dx32 = x2 - x3;
-    int dy32 = y2 - y3;
-    int dx31 = x1 - x3;
-    int dy31 = y1 - y3;
-
-    for (int y = y2; y <= y3; ++y) {
-        if (0 <= y && (size_t) y < wc.height) {
-            int s1 = dy32 != 0 ? (y - y3)*dx32/dy32 + x3 : x3;
-            int s2 = dy31 != 0 ? (y - y3)*dx31/dy31 + x3 : x3;
-            if (s1 > s2) WREN_SWAP(int, s1, s2);
-            for (int x = s1; x <= s2; ++x) {
-                if (0 <= x && (size_t) x < wc.width) {
-                    int u1, u2, det;
-                    barycentric(x1, y1, x2, y2, x3, y3, x, y, &u1, &u2, &det);
-                    uint32_t color = mixColors3(c1, c2, c3, u1, u2, det - u1 - u2, det);
-                    wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
-                }
+        uint32_t *p = pixels + i;
+        if (dst.premultiplied) {
+            wrenCompositeSpan(p, buffer, m, mode == WREN_BLIT_ADD ? WREN_OP_ADD : WREN_OP_OVER);
+        } else if (mode == WREN_BLIT_ADD) {
+            // Adds the color weighted by its alpha and keeps the destination
+            // alpha, like blending does.
+            for (size_t k = 0; k < m; k++) {
+                uint32_t c = wrenScalePixel(buffer[k], WREN_ALPHA(buffer[k]))&0x00FFFFFF;
+                p[k] = (wrenAddPixels(p[k], c)&0x00FFFFFF)|(p[k]&0xFF000000);
             }
+        } else {
+            wrenBlendSpanColors(p, buffer, m);
         }
     }
 }
 
-WRENDEF void wrenTriangle(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t color) {
-    if (y1 > y2) {
-        WREN_SWAP(int, x1, x2);
-        WREN_SWAP(int, y1, y2);
+// Blends n opaque source pixels: the color is replaced and, on straight
+// canvases, the destination alpha is kept like blending does.
+static inline void wrenBlitSolid(WrenCanvas dst, uint32_t *pixels, const uint32_t *colors, size_t n) {
+    if (dst.premultiplied) {
+        wrenCopySpan(pixels, colors, n);
+    } else {
+        for (size_t i = 0; i < n; i++) pixels[i] = (pixels[i]&0xFF000000)|(colors[i]&0x00FFFFFF);
     }
+}
 
-    if (y2 > y3) {
-        WREN_SWAP(int, x2, x3);
-        WREN_SWAP(int, y2, y3);
-    }
-    
-    if (y1 > y2) {
-        WREN_SWAP(int, x1, x2);
-        WREN_SWAP(int, y1, y2);
+// Overwrites n pixels with source pixels, converting their alpha format if
+// the canvases differ.
+static inline void wrenBlitCopy(WrenCanvas dst, uint32_t *pixels, const uint32_t *colors, size_t n, bool premultiplied) {
+    if (premultiplied == dst.premultiplied) {
+        wrenCopySpan(pixels, colors, n);
+    } else if (premultiplied) {
+        for (size_t i = 0; i < n; i++) pixels[i] = wrenUnpremultiply(colors[i]);
+    } else {
+        for (size_t i = 0; i < n; i++) pixels[i] = wrenPremultiply(colors[i]);
     }
+}
+
+// Draws src onto dst with its top left corner at (x, y):
+// - WREN_BLIT_COPY overwrites the destination,
+// - WREN_BLIT_OVER blends the source by its alpha,
+// - WREN_BLIT_ADD adds the source weighted by its alpha,
+// - WREN_BLIT_KEY overwrites the destination except where the source color
+//   equals key, whose alpha is ignored.
+// With an opacity below 255, copied pixels are blended at that opacity and
+// blended ones have their alpha scaled by it. Both canvases may be in either
+// alpha format. Runs of skipped source pixels cost one test per pixel and
+// runs of opaque ones are copied as spans.
+WRENDEF void wrenBlit(WrenCanvas dst, WrenCanvas src, int x, int y, WrenBlitMode mode, uint8_t opacity, uint32_t key) {
+    if (src.width == 0 || src.height == 0 || opacity == 0) return;
+    int x1, x2, y1, y2;
+    if (!wrenNormalizeRect(x, y, src.width, src.height, dst.width, dst.height, &x1, &x2, &y1, &y2)) return;
 
-    int dx12 = x2 - x1;
-    int dy12 = y2 - y1;
-    int dx13 = x3 - x1;
-    int dy13 = y3 - y1;
+    size_t n = x2 - x1 + 1;
+    for (int py = y1; py <= y2; py++) {
+        uint32_t *pixels = &WREN_PIXEL(dst, x1, py);
+        const uint32_t *colors = &WREN_PIXEL(src, x1 - x, py - y);
+        size_t i = 0;
+        while (i < n) {
+            int kind = wrenBlitClass(colors[i], mode, key);
+            size_t j = i + 1;
+            if (mode == WREN_BLIT_COPY) {
+                j = n;
+            } else if (mode != WREN_BLIT_KEY && kind != WREN_BLIT_PARTIAL) {
+                // Four alphas at a time for the long transparent and opaque
+                // runs of sprites.
+                uint32_t want = kind == WREN_BLIT_SKIP ? 0 : 0xFF000000;
+                while (j + 4 <= n &&
+                       (colors[j]&0xFF000000) == want && (colors[j + 1]&0xFF000000) == want &&
+                       (colors[j + 2]&0xFF000000) == want && (colors[j + 3]&0xFF000000) == want) j += 4;
+            }
+            while (j < n && wrenBlitClass(colors[j], mode, key) == kind) j++;
 
-    for (int y = y1; y <= y2; ++y) {
-        if (0 <= y && (size_t) y < wc.height) {
-            int s1 = dy12 != 0 ? (y - y1)*dx12/dy12 + x1 : x1;
-            int s2 = dy13 != 0 ? (y - y1)*dx13/dy13 + x1 : x1;
-            if (s1 > s2) WREN_SWAP(int, s1, s2);
-            for (int x = s1; x <= s2; ++x) {
-                if (0 <= x && (size_t) x < wc.width) {
-                    wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
+            if (kind == WREN_BLIT_SKIP) {
+                // Nothing to draw.
+            } else if (kind == WREN_BLIT_PARTIAL || opacity != 0xFF || mode == WREN_BLIT_ADD) {
+                if (mode == WREN_BLIT_OVER && opacity == 0xFF && src.premultiplied == dst.premultiplied) {
+                    if (dst.premultiplied) {
+                        wrenCompositeSpan(pixels + i, colors + i, j - i, WREN_OP_OVER);
+                    } else {
+                        wrenBlendSpanColors(pixels + i, colors + i, j - i);
+                    }
+                } else {
+                    wrenBlitBlend(dst, pixels + i, colors + i, j - i, src.premultiplied, mode, opacity);
                 }
+            } else if (mode == WREN_BLIT_OVER && !dst.premultiplied) {
+                wrenBlitSolid(dst, pixels + i, colors + i, j - i);
+            } else {
+                wrenBlitCopy(dst, pixels + i, colors + i, j - i, src.premultiplied);
             }
+            i = j;
         }
     }
+}
 
-    int dx32 = x2 - x3;
-    int dy32 = y2 - y3;
-    int dx31 = x1 - x3;
-    int dy31 = y1 - y3;
+// Runs of src encoded as an RLE sprite into out, or only counted when out is
+// null. Returns the number of words.
+static inline size_t wrenRLERows(WrenCanvas src, uint32_t *out) {
+    size_t size = src.height;
+    for (size_t y = 0; y < src.height; y++) {
+        if (out != NULL) out[y] = size;
+        const uint32_t *row = &WREN_PIXEL(src, 0, y);
+        size_t i = 0;
+        while (i < src.width) {
+            uint32_t kind = WREN_RLE_KIND(row[i]);
+            size_t j = i + 1;
+            while (j < src.width && j - i < WREN_RLE_MAX_RUN && WREN_RLE_KIND(row[j]) == kind) j++;
 
-    for (int y = y2; y <= y3; ++y) {
-        if (0 <= y && (size_t) y < wc.height) {
-            int s1 = dy32 != 0 ? (y - y3)*dx32/dy32 + x3 : x3;
-            int s2 = dy31 != 0 ? (y - y3)*dx31/dy31 + x3 : x3;
-            if (s1 > s2) WREN_SWAP(int, s1, s2);
-            for (int x = s1; x <= s2; ++x) {
-                if (0 <= x && (size_t) x < wc.width) {
-                    wrenBlendColors(&WREN_PIXEL(wc, x, y), color);
+            if (out != NULL) {
+                out[size] = (kind << 30)|(uint32_t) (j - i);
+                for (size_t k = i; kind != WREN_RLE_SKIP && k < j; k++) {
+                    out[size + 1 + k - i] = src.premultiplied ? wrenUnpremultiply(row[k]) : row[k];
                 }
             }
+            size += 1 + (kind == WREN_RLE_SKIP ? 0 : j - i);
+            i = j;
         }
     }
+    return size;
 }
 
-WRENDEF void wrenText(WrenCanvas wc, const char *text, int tx, int ty, WrenFont font, size_t size, uint32_t color) {
-    for (size_t i = 0; *text; i++, text++) {
-        int gx = tx + i*font.width*size;
-        int gy = ty;
-        const char *glyph = &font.glyphs[(*text)*sizeof(char)*font.width*font.height];
-        for (int dy = 0; (size_t) dy < font.height; dy++) {
-            for (int dx = 0; (size_t) dx < font.width; dx++) {
-                int px = gx + dx*size;
-                int py = gy + dy*size;
-                if (0 <= px && px < (int) wc.width && 0 <= py && py < (int) wc.height) {
-                    if (glyph[dy*font.width + dx]) {
-                        wrenRect(wc, px, py, size, size, color);
-                    }
+// Encodes src as an RLE sprite into out and returns the number of words it
+// takes; nothing is written unless that fits in capacity. Premultiplied
+// canvases are stored as straight colors.
+WRENDEF size_t wrenEncodeRLE(WrenCanvas src, uint32_t *out, size_t capacity) {
+    size_t size = wrenRLERows(src, NULL);
+    if (size <= capacity) wrenRLERows(src, out);
+    return size;
+}
+
+// Draws an RLE sprite over dst with its top left corner at (x, y), like
+// wrenBlit with WREN_BLIT_OVER. Skip runs cost one step, opaque runs are
+// copied as spans and only translucent runs are blended.
+WRENDEF void wrenBlitRLE(WrenCanvas dst, WrenRLE sprite, int x, int y, uint8_t opacity) {
+    if (sprite.width == 0 || sprite.height == 0 || opacity == 0) return;
+    int x1, x2, y1, y2;
+    if (!wrenNormalizeRect(x, y, sprite.width, sprite.height, dst.width, dst.height, &x1, &x2, &y1, &y2)) return;
+
+    // Source columns [c1, c2] are visible.
+    int64_t c1 = (int64_t) x1 - x, c2 = (int64_t) x2 - x;
+    for (int py = y1; py <= y2; py++) {
+        const uint32_t *run = sprite.data + sprite.data[py - y];
+        uint32_t *pixels = &WREN_PIXEL(dst, x1, py);
+        int64_t c = 0;
+        while (c <= c2) {
+            uint32_t kind = *run >> 30;
+            int64_t n = *run&WREN_RLE_MAX_RUN;
+            const uint32_t *colors = run + 1;
+            run += 1 + (kind == WREN_RLE_SKIP ? 0 : n);
+
+            int64_t a = c < c1 ? c1 : c, b = c + n - 1 > c2 ? c2 : c + n - 1;
+            if (a <= b && kind != WREN_RLE_SKIP) {
+                colors += a - c;
+                uint32_t *p = pixels + (a - c1);
+                if (kind == WREN_RLE_SOLID && opacity == 0xFF) {
+                    wrenBlitSolid(dst, p, colors, b - a + 1);
+                } else if (opacity == 0xFF && !dst.premultiplied) {
+                    wrenBlendSpanColors(p, colors, b - a + 1);
+                } else {
+                    wrenBlitBlend(dst, p, colors, b - a + 1, false, WREN_BLIT_OVER, opacity);
                 }
             }
+            c += n;
         }
     }
 }
 
-WRENDEF void wrenCopy(WrenCanvas src, WrenCanvas dst) {
-    for (size_t y = 0; y < dst.height; y++) {
-        for (size_t x = 0; x < dst.width; x++) {
-            size_t nx = x*src.width/dst.width;
-            size_t ny = y*src.height/dst.height;
-            WREN_PIXEL(dst, x, y) = WREN_PIXEL(src, nx, ny);
+// Visible range [*x1, *x2] of k*x + c >= 0 and k*x + c <= hi for integer x,
+// narrowed in place.
+static inline void wrenAffineRange(int64_t k, int64_t c, int64_t hi, int64_t *x1, int64_t *x2) {
+    if (k == 0) {
+        if (c < 0 || c > hi) *x1 = *x2 + 1;
+        return;
+    }
+    int64_t a, b;
+    if (k > 0) {
+        a = -wrenFloorDiv(c, k);
+        b = wrenFloorDiv(hi - c, k);
+    } else {
+        a = -wrenFloorDiv(hi - c, -k);
+        b = wrenFloorDiv(c, -k);
+    }
+    if (a > *x1) *x1 = a;
+    if (b < *x2) *x2 = b;
+}
+
+// Bilinear sample of src at (u, v) - (1/2, 1/2), in 16.16 pixels.
+static inline uint32_t wrenSampleBilinear(WrenCanvas src, int64_t u, int64_t v) {
+    u -= WREN_FIXED_ONE/2;
+    v -= WREN_FIXED_ONE/2;
+    int64_t i = u >> 16, j = v >> 16;
+    uint32_t f = (u >> 8)&0xFF, g = (v >> 8)&0xFF;
+    int64_t i0 = i < 0 ? 0 : i, i1 = i + 1 < (int64_t) src.width ? i + 1 : (int64_t) src.width - 1;
+    int64_t j0 = j < 0 ? 0 : j, j1 = j + 1 < (int64_t) src.height ? j + 1 : (int64_t) src.height - 1;
+    uint32_t c00 = WREN_PIXEL(src, i0, j0), c10 = WREN_PIXEL(src, i1, j0);
+    uint32_t c01 = WREN_PIXEL(src, i0, j1), c11 = WREN_PIXEL(src, i1, j1);
+
+    // Red and blue, then green and alpha, in the two 16-bit halves of a word.
+    // Rows are rounded to 8 bits before the vertical step.
+    uint32_t result = 0;
+    for (int k = 0; k < 16; k += 8) {
+        uint32_t top = ((c00 >> k)&0x00FF00FF)*(256 - f) + ((c10 >> k)&0x00FF00FF)*f + 0x00800080;
+        uint32_t bottom = ((c01 >> k)&0x00FF00FF)*(256 - f) + ((c11 >> k)&0x00FF00FF)*f + 0x00800080;
+        uint32_t c = ((top >> 8)&0x00FF00FF)*(256 - g) + ((bottom >> 8)&0x00FF00FF)*g + 0x00800080;
+        result |= ((c >> 8)&0x00FF00FF) << k;
+    }
+    return result;
+}
+
+// n*2^32/|d| rounded toward zero for |n| < 2^32 and d != 0, stored in *q
+// with the sign of n. Fails when the result would exceed 2^30.
+static inline bool wrenAffineQuotient(int64_t n, int64_t d, int64_t *q) {
+    uint64_t dd = d < 0 ? -(uint64_t) d : (uint64_t) d;
+    uint64_t r = n < 0 ? -(uint64_t) n : (uint64_t) n;
+    uint64_t quotient = r/dd;
+    r %= dd;
+    for (int i = 0; i < 32; i++) {
+        r <<= 1;
+        quotient <<= 1;
+        if (r >= dd) {
+            r -= dd;
+            quotient |= 1;
+        }
+    }
+    if (quotient > (uint64_t) 1 << 30) return false;
+    *q = n < 0 ? -(int64_t) quotient : (int64_t) quotient;
+    return true;
+}
+
+// Draws src over dst transformed by m, which maps source pixels to
+// destination pixels in 16.16 fixed point. Destination pixel centers are
+// mapped back to the source by stepping the inverse of m, and every row is
+// first clipped to the exact span whose centers land inside the source, so
+// the sampling loop does no bounds tests. Only the rows between the
+// transformed source corners are visited.
+WRENDEF void wrenBlitAffine(WrenCanvas src, WrenCanvas dst, WrenAffine m, WrenFilter filter) {
+    if (src.width == 0 || src.height == 0 || dst.height == 0) return;
+
+    // Inverse of the linear part in 16.16, from the exact 32.32 determinant.
+    // Maps that squash the source too thin to step through draw nothing.
+    int64_t det = (int64_t) m.a*m.d - (int64_t) m.b*m.c;
+    if (det == 0) return;
+    int64_t ia, ib, ic, id;
+    if (!wrenAffineQuotient(m.d, det, &ia) || !wrenAffineQuotient(-(int64_t) m.b, det, &ib) ||
+        !wrenAffineQuotient(-(int64_t) m.c, det, &ic) || !wrenAffineQuotient(m.a, det, &id)) return;
+    if (det < 0) {
+        ia = -ia; ib = -ib;
+        ic = -ic; id = -id;
+    }
+
+    // Rows whose centers lie between the highest and lowest corner, with a
+    // row to spare for the rounding of the inverse.
+    int64_t top = m.ty, bottom = m.ty;
+    for (int k = 1; k < 4; k++) {
+        int64_t cy = (k&1 ? (int64_t) m.c*src.width : 0) + (k&2 ? (int64_t) m.d*src.height : 0) + m.ty;
+        if (cy < top) top = cy;
+        if (cy > bottom) bottom = cy;
+    }
+    int64_t y1 = wrenFloorDiv(top - WREN_FIXED_ONE/2, WREN_FIXED_ONE);
+    int64_t y2 = wrenFloorDiv(bottom - WREN_FIXED_ONE/2, WREN_FIXED_ONE) + 1;
+    if (y1 < 0) y1 = 0;
+    if (y2 > (int64_t) dst.height - 1) y2 = (int64_t) dst.height - 1;
+
+    int64_t uMax = (int64_t) src.width*WREN_FIXED_ONE - 1;
+    int64_t vMax = (int64_t) src.height*WREN_FIXED_ONE - 1;
+    int64_t px = WREN_FIXED_ONE/2 - m.tx;
+    for (int64_t y = y1; y <= y2; y++) {
+        // Source position of the center of pixel (0, y); within the row it
+        // moves by (ia, ic) per pixel.
+        int64_t py = y*WREN_FIXED_ONE + WREN_FIXED_ONE/2 - m.ty;
+        int64_t u = wrenFloorDiv(ia*px + ib*py, WREN_FIXED_ONE);
+        int64_t v = wrenFloorDiv(ic*px + id*py, WREN_FIXED_ONE);
+
+        int64_t x1 = 0, x2 = (int64_t) dst.width - 1;
+        wrenAffineRange(ia, u, uMax, &x1, &x2);
+        wrenAffineRange(ic, v, vMax, &x1, &x2);
+        if (x1 > x2) continue;
+
+        uint32_t buffer[64];
+        u += x1*ia;
+        v += x1*ic;
+        for (int64_t x = x1; x <= x2; x += 64) {
+            size_t n = x2 - x + 1 < 64 ? x2 - x + 1 : 64;
+            if (filter == WREN_FILTER_BILINEAR) {
+                for (size_t k = 0; k < n; k++, u += ia, v += ic) buffer[k] = wrenSampleBilinear(src, u, v);
+            } else {
+                for (size_t k = 0; k < n; k++, u += ia, v += ic) buffer[k] = WREN_PIXEL(src, u >> 16, v >> 16);
+            }
+
+            uint32_t *pixels = &WREN_PIXEL(dst, x, y);
+            if (src.premultiplied != dst.premultiplied) {
+                wrenBlitBlend(dst, pixels, buffer, n, src.premultiplied, WREN_BLIT_OVER, 0xFF);
+            } else if (dst.premultiplied) {
+                wrenCompositeSpan(pixels, buffer, n, WREN_OP_OVER);
+            } else {
+                wrenBlendSpanColors(pixels, buffer, n);
+            }
         }
     }
 }
 
-#endif
\ No newline at end of file
+WRENDEF void wrenPaintSpan(WrenCanvas wc, int x, int y, size_t n, uint32_t color) {
+    uint32_t *pixels = &WREN_PIXEL(wc, x, y);
+    if (!wc.premultiplied) {
+        wrenBlendSpan(pixels, n, color);
+        return;
+    }
+
+    uint32_t a = WREN_ALPHA(color);
+    if (a == 0) return;
+    if (a == 0xFF) {
+        wrenFillSpan(pixels, n, color);
+        return;
+    }
+
+    color = wrenPremultiply(color);
+    for (size_t i = 0; i < n; i++) pixels[i] = color + wrenScalePixel(pixels[i], 255 - a);
+}
+
+WRENDEF void wrenPaintSpanColors(WrenCanvas wc, int x, int y, uint32_t *colors, size_t n) {
+    uint32_t *pixels = &WREN_PIXEL(wc, x, y);
+    if (!wc.premultiplied) {
+        wrenBlendSpanColors(pixels, colors, n);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) colors[i] = wrenPremultiply(colors[i]);
+    wrenCompositeSpan(pixels, colors, n, WREN_OP_OVER);
+}
+
+WRENDEF void wrenFill(WrenCanvas wc, uint32_t color) {
+    if (wc.premultiplied) color = wrenPremultiply(color);
+
+    if (wc.stride == wc.width) {
+        wrenFillSpan(wc.pixels, wc.width*wc.height, color);
+        return;
+    }
+
+    for (size_t y = 0; y < wc.height; y++) {
+        wrenFillSpan(&WREN_PIXEL(wc, 0, y), wc.width, color);
+    }
+}
+
+WRENDEF void wrenRect(WrenCanvas wc, int x, int y, int w, int h, uint32_t color) {
+    int x1, y1, x2, y2;
+    if (!wrenNormalizeRect(x, y, w, h, wc.width, wc.height, &x1, &x2, &y1, &y2)) return;
+
+    if (WREN_ALPHA(color) == 0) return;
+
+    for (int y = y1; y <= y2; y++) {
+        wrenPaintSpan(wc, x1, y, x2 - x1 + 1, color);
+    }
+}
+
+// Floor of the square root of n >= 0.
+static inline int64_t wrenIsqrt(int64_t n) {
+    uint64_t x = n, root = 0, bit = (uint64_t) 1 << 62;
+    if (x < (uint64_t) 1 << 32) bit = (uint64_t) 1 << 30;
+    if (x < (uint64_t) 1 << 16) bit = (uint64_t) 1 << 14;
+    while (bit > x) bit >>= 2;
+    while (bit != 0) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+#define WREN_AA_SAMPLES (WREN_AA_RES*WREN_AA_RES)
+
+WRENDEF WrenMask wrenMask(const uint8_t *values, size_t width, size_t height, size_t stride, uint8_t max) {
+    WrenMask mask = {
+        .values = values,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .max = max,
+    };
+
+    return mask;
+}
+
+// Blends color into the canvas with its alpha scaled by value/max at every
+// mask pixel, values above max counting as max. Runs of max go through the
+// plain span path and zeros are skipped.
+WRENDEF void wrenStampMask(WrenCanvas wc, WrenMask mask, int x, int y, uint32_t color) {
+    int x1, x2, y1, y2;
+    if (mask.width == 0 || mask.height == 0 || mask.max == 0) return;
+    if (!wrenNormalizeRect(x, y, mask.width, mask.height, wc.width, wc.height, &x1, &x2, &y1, &y2)) return;
+
+    uint32_t alpha = WREN_ALPHA(color);
+    uint32_t colors[64];
+    for (int py = y1; py <= y2; py++) {
+        const uint8_t *values = &mask.values[(size_t) (py - y)*mask.stride];
+        size_t n = 0;
+        for (int px = x1; px <= x2; px++) {
+            uint32_t v = values[px - x];
+            if (v > mask.max) v = mask.max;
+            if (v == 0 || v == mask.max) {
+                if (n > 0) wrenPaintSpanColors(wc, px - n, py, colors, n);
+                n = 0;
+                if (v == 0) continue;
+
+                int end = px;
+                while (end < x2 && values[end + 1 - x] >= mask.max) end++;
+                if (alpha != 0) wrenPaintSpan(wc, px, py, end - px + 1, color);
+                px = end;
+                continue;
+            }
+
+            colors[n++] = (color&0x00FFFFFF)|((alpha*v/mask.max)<<(3*8));
+            if (n == sizeof(colors)/sizeof(colors[0])) {
+                wrenPaintSpanColors(wc, px + 1 - n, py, colors, n);
+                n = 0;
+            }
+        }
+        if (n > 0) wrenPaintSpanColors(wc, x2 + 1 - n, py, colors, n);
+    }
+}
+
+WRENDEF WrenBitMask wrenBitMask(const uint32_t *bits, size_t width, size_t height, size_t stride) {
+    WrenBitMask mask = {
+        .bits = bits,
+        .width = width,
+        .height = height,
+        .stride = stride,
+    };
+
+    return mask;
+}
+
+static inline int wrenCountTrailingZeros(uint32_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctz(x);
+#else
+    int n = 0;
+    while ((x&1) == 0) x >>= 1, n++;
+    return n;
+#endif
+}
+
+// Paints spans [starts[i], ends[i]) of canvas rows [y, y + rows). Glyph-sized
+// spans are too short for the span kernels to pay off, so on straight canvases
+// they are blended here with the same arithmetic.
+static inline void wrenStampSpans(WrenCanvas wc, int y, int rows, const int *starts, const int *ends, size_t count, uint32_t color) {
+    uint32_t a = WREN_ALPHA(color), rgb = color&0x00FFFFFF;
+    uint32_t ra = WREN_RED(color)*a, ga = WREN_GREEN(color)*a, ba = WREN_BLUE(color)*a;
+    for (size_t i = 0; i < count; i++) {
+        int n = ends[i] - starts[i];
+        if (wc.premultiplied || n >= (a == 0xFF ? 8 : 4)) {
+            for (int py = y; py < y + rows; py++) wrenPaintSpan(wc, starts[i], py, n, color);
+            continue;
+        }
+        for (int py = y; py < y + rows; py++) {
+            uint32_t *pixels = &WREN_PIXEL(wc, starts[i], py);
+            for (int x = 0; x < n; x++) {
+                uint32_t d = pixels[x];
+                if (a == 0xFF) {
+                    pixels[x] = (d&0xFF000000)|rgb;
+                    continue;
+                }
+                uint32_t r = (WREN_RED(d)*(255 - a) + ra)/255;
+                uint32_t g = (WREN_GREEN(d)*(255 - a) + ga)/255;
+                uint32_t b = (WREN_BLUE(d)*(255 - a) + ba)/255;
+                pixels[x] = WREN_RGBA(r, g, b, WREN_ALPHA(d));
+            }
+        }
+    }
+}
+
+// Paints color over every set pixel of the mask. Rows are scanned a word at a
+// time: empty words are skipped whole and runs of set bits, also across
+// words, become single spans. Rows equal to the one above reuse its spans.
+WRENDEF void wrenStampBits(WrenCanvas wc, WrenBitMask mask, int x, int y, uint32_t color) {
+    int x1, x2, y1, y2;
+    if (mask.width == 0 || mask.height == 0 || WREN_ALPHA(color) == 0) return;
+    if (!wrenNormalizeRect(x, y, mask.width, mask.height, wc.width, wc.height, &x1, &x2, &y1, &y2)) return;
+
+    // Mask columns [c1, c2], at bits [b1, b2] in words [k1, k2], are visible.
+    size_t b1 = mask.offset + (x1 - x), b2 = mask.offset + (x2 - x), k1 = b1/32, k2 = b2/32;
+    uint32_t first = ~(uint32_t) 0 << b1%32, last = ~(uint32_t) 0 >> (31 - b2%32);
+    int starts[32], ends[32];
+    for (int py = y1; py <= y2; py++) {
+        const uint32_t *bits = &mask.bits[(py - y)*mask.stride];
+        size_t count = 0;
+        bool whole = true;
+        for (size_t k = k1; k <= k2; k++) {
+            uint32_t word = bits[k];
+            if (k == k1) word &= first;
+            if (k == k2) word &= last;
+            while (word != 0) {
+                int lo = wrenCountTrailingZeros(word);
+                uint32_t rest = ~(word >> lo);
+                int n = rest == 0 ? 32 - lo : wrenCountTrailingZeros(rest);
+                int c = x + (int) (k*32 + lo - mask.offset);
+                word = lo + n >= 32 ? 0 : word&(~(uint32_t) 0 << (lo + n));
+                if (count > 0 && ends[count - 1] == c) {
+                    ends[count - 1] = c + n;
+                    continue;
+                }
+                if (count == sizeof(starts)/sizeof(starts[0])) {
+                    wrenStampSpans(wc, py, 1, starts, ends, count, color);
+                    count = 0;
+                    whole = false;
+                }
+                starts[count] = c, ends[count] = c + n, count++;
+            }
+        }
+
+        // The spans only carry over to the rows below when they are complete.
+        int rows = 1;
+        while (whole && py + rows <= y2) {
+            const uint32_t *next = &bits[rows*mask.stride];
+            bool same = true;
+            for (size_t k = k1; same && k <= k2; k++) same = next[k] == bits[k];
+            if (!same) break;
+            rows++;
+        }
+        wrenStampSpans(wc, py, rows, starts, ends, count, color);
+        py += rows - 1;
+    }
+}
+
+// Coverage of one circle row: sample i of the pixel at column x is covered
+// when lo[i] <= x <= hi[i]. Columns [anyLo, anyHi] have some samples covered
+// and columns [allLo, allHi] all of them.
+typedef struct {
+    int64_t lo[WREN_AA_SAMPLES], hi[WREN_AA_SAMPLES];
+    int64_t anyLo, anyHi, allLo, allHi;
+} WrenCircleRow;
+
+// Coverage is WREN_AA_RES x WREN_AA_RES samples per pixel, but they are not
+// tested one by one: on every sample row the covered samples of each sample
+// column form a run of pixels whose ends come from one square root.
+static inline void wrenCircleRow(WrenCircleRow *row, int y, int cx, int cy, int r) {
+    int64_t res1 = WREN_AA_RES + 1;
+    int64_t ar = WREN_ABS(int, r);
+    int64_t r2 = res1*res1*ar*ar*2*2;
+
+    row->anyLo = INT64_MAX, row->anyHi = INT64_MIN;
+    row->allLo = INT64_MIN, row->allHi = INT64_MAX;
+    for (int soy = 0; soy < WREN_AA_RES; soy++) {
+        // Sample (sox, soy) of pixel (x, y) sits at (dx, dy) from the center
+        // in units of 1/(2*res1) pixels.
+        int64_t dy = y*res1*2 + 2 + soy*2 - res1*cy*2 - res1;
+        int64_t rest = r2 - dy*dy;
+        int64_t m = rest >= 0 ? wrenIsqrt(rest) : -1;
+
+        // Sample column sox is covered when |x*res1*2 + k + sox*2| <= m. The
+        // sox*2 < res1*2 shift moves each quotient by at most one, so two
+        // divisions serve the whole sample row.
+        int64_t k = 2 - res1*cx*2 - res1;
+        int64_t qlo = wrenFloorDiv(m + k, res1*2), rlo = m + k - qlo*res1*2;
+        int64_t qhi = wrenFloorDiv(m - k, res1*2), rhi = m - k - qhi*res1*2;
+        for (int sox = 0; sox < WREN_AA_RES; sox++) {
+            int i = soy*WREN_AA_RES + sox;
+            if (m < 0) {
+                row->lo[i] = 1, row->hi[i] = 0;
+                row->allLo = INT64_MAX;
+                continue;
+            }
+            row->lo[i] = -(qlo + (rlo + sox*2 >= res1*2));
+            row->hi[i] = qhi - (rhi - sox*2 < 0);
+            if (row->lo[i] < row->anyLo) row->anyLo = row->lo[i];
+            if (row->hi[i] > row->anyHi) row->anyHi = row->hi[i];
+            if (row->lo[i] > row->allLo) row->allLo = row->lo[i];
+            if (row->hi[i] < row->allHi) row->allHi = row->hi[i];
+        }
+    }
+}
+
+static inline int wrenCircleCount(const WrenCircleRow *row, int x) {
+    int count = 0;
+    for (int i = 0; i < WREN_AA_SAMPLES; i++) {
+        count += row->lo[i] <= x && x <= row->hi[i];
+    }
+    return count;
+}
+
+// Paints columns [x1, x2] of a circle row with their sample coverage.
+static inline void wrenCircleEdge(WrenCanvas wc, int y, int x1, int x2, const WrenCircleRow *row, uint32_t color) {
+    uint32_t colors[64];
+    size_t n = 0;
+    for (int x = x1; x <= x2; x++) {
+        int count = wrenCircleCount(row, x);
+        uint32_t alpha = ((color&0xFF000000)>>(3*8))*count/WREN_AA_RES/WREN_AA_RES;
+        colors[n++] = (color&0x00FFFFFF)|(alpha<<(3*8));
+        if (n == sizeof(colors)/sizeof(colors[0]) || x == x2) {
+            wrenPaintSpanColors(wc, x + 1 - n, y, colors, n);
+            n = 0;
+        }
+    }
+}
+
+#if WREN_MASK_CACHE_SLOTS > 0
+// Most recently used circle masks, keyed by radius. Coverage only depends on
+// the position relative to the center, so one mask serves every circle of a
+// radius.
+typedef struct {
+    int keys[WREN_MASK_CACHE_SLOTS];   // radius + 1, 0 for an empty slot
+    uint32_t used[WREN_MASK_CACHE_SLOTS];
+    uint32_t clock;
+    uint8_t values[WREN_MASK_CACHE_SLOTS][WREN_MASK_CACHE_SLOT_SIZE];
+} WrenMaskCache;
+
+static WREN_THREAD_LOCAL WrenMaskCache wrenMaskCache;
+
+// Coverage mask of a circle with radius r >= 0 centered on pixel (r, r), or a
+// mask without values when it does not fit a cache slot.
+static inline WrenMask wrenCircleMask(int r) {
+    size_t size = 2*(size_t) r + 1;
+    if (WREN_AA_SAMPLES > 255 || size*size > WREN_MASK_CACHE_SLOT_SIZE) return (WrenMask) {0};
+
+    WrenMaskCache *cache = &wrenMaskCache;
+    size_t slot = 0;
+    for (size_t i = 0; i < WREN_MASK_CACHE_SLOTS; i++) {
+        if (cache->keys[i] == r + 1) {
+            slot = i;
+            goto found;
+        }
+        if (cache->used[i] < cache->used[slot]) slot = i;
+    }
+
+    for (size_t y = 0; y < size; y++) {
+        WrenCircleRow row;
+        wrenCircleRow(&row, y, r, r, r);
+        for (size_t x = 0; x < size; x++) {
+            cache->values[slot][y*size + x] = wrenCircleCount(&row, x);
+        }
+    }
+    cache->keys[slot] = r + 1;
+
+found:
+    cache->used[slot] = ++cache->clock;
+    return wrenMask(cache->values[slot], size, size, size, WREN_AA_SAMPLES);
+}
+#endif
+
+// Pixels inside all sample runs of a row are painted as one opaque span and
+// only the rest count their samples. Small circles are stamped from a cached
+// mask instead.
+WRENDEF void wrenCircle(WrenCanvas wc, int cx, int cy, int r, uint32_t color) {
+    int ar = WREN_ABS(int, r);
+
+#if WREN_MASK_CACHE_SLOTS > 0
+    WrenMask mask = wrenCircleMask(ar);
+    if (mask.values != NULL) {
+        wrenStampMask(wc, mask, cx - ar, cy - ar, color);
+        return;
+    }
+#endif
+
+    int y1 = cy - ar < 0 ? 0 : cy - ar;
+    int y2 = cy + ar >= (int) wc.height ? (int) wc.height - 1 : cy + ar;
+    for (int y = y1; y <= y2; y++) {
+        WrenCircleRow row;
+        wrenCircleRow(&row, y, cx, cy, r);
+        int64_t anyLo = row.anyLo, anyHi = row.anyHi;
+        int64_t allLo = row.allLo, allHi = row.allHi;
+
+        if (anyLo < 0) anyLo = 0;
+        if (anyHi >= (int) wc.width) anyHi = (int) wc.width - 1;
+        if (anyLo > anyHi) continue;
+
+        if (allLo > allHi || allHi < anyLo || allLo > anyHi) {
+            wrenCircleEdge(wc, y, anyLo, anyHi, &row, color);
+            continue;
+        }
+
+        if (allLo < anyLo) allLo = anyLo;
+        if (allHi > anyHi) allHi = anyHi;
+        if (anyLo < allLo) wrenCircleEdge(wc, y, anyLo, allLo - 1, &row, color);
+        if (WREN_ALPHA(color) != 0) wrenPaintSpan(wc, allLo, y, allHi - allLo + 1, color);
+        if (allHi < anyHi) wrenCircleEdge(wc, y, allHi + 1, anyHi, &row, color);
+    }
+}
+
+// Row offset of column x1 + t of a line is trunc(n*t/d) for d > 0, kept as
+// the floor quotient q and remainder r of n*t so that it steps without
+// divisions.
+typedef struct {
+    int64_t n, d;
+    int64_t q, r;
+    int64_t dq, dr;
+} WrenLineStep;
+
+// Floor quotient of n*t by d > 0 for |n|, |t| <= 2^33, with the remainder in
+// *r. Lines between far end points make n*t pass 2^63, so t is split into
+// 16-bit halves.
+static inline int64_t wrenLineMulDiv(int64_t n, int64_t t, int64_t d, int64_t *r) {
+    int64_t th = t >> 16, tl = t - th*WREN_FIXED_ONE;
+    int64_t q = wrenFloorDiv(n*th, d);
+    int64_t m = (n*th - q*d)*WREN_FIXED_ONE + n*tl;
+    int64_t q2 = wrenFloorDiv(m, d);
+    *r = m - q2*d;
+    return q*WREN_FIXED_ONE + q2;
+}
+
+static inline WrenLineStep wrenLineStep(int64_t n, int64_t d, int64_t t) {
+    WrenLineStep ls = {.n = n, .d = d};
+    ls.q = wrenLineMulDiv(n, t, d, &ls.r);
+    ls.dq = wrenFloorDiv(n, d);
+    ls.dr = n - ls.dq*d;
+    return ls;
+}
+
+static inline int64_t wrenLineRow(const WrenLineStep *ls) {
+    return ls->q + (ls->q < 0 && ls->r != 0);
+}
+
+static inline void wrenLineNext(WrenLineStep *ls) {
+    ls->q += ls->dq;
+    ls->r += ls->dr;
+    if (ls->r >= ls->d) {
+        ls->r -= ls->d;
+        ls->q += 1;
+    }
+}
+
+// Column x1 + t of the line covers the row offsets from trunc(n*t/d) to
+// trunc(n*(t + 1)/d), which never decrease with t for n >= 0. The visible
+// columns are therefore one range, found by bisection before any stepping.
+static inline int64_t wrenLineOffset(int64_t n, int64_t d, int64_t t) {
+    int64_t r, q = wrenLineMulDiv(n, t, d, &r);
+    return q + (q < 0 && r != 0);
+}
+
+// Rows y1..y2 of column x that a polyline segment leaves alone because the
+// previous segment already painted them.
+typedef struct {
+    int64_t x, y1, y2;
+} WrenLineSkip;
+
+#define WREN_LINE_SKIP_NONE ((WrenLineSkip) {0, 0, -1})
+
+static inline void wrenLineSpan(WrenCanvas wc, int64_t x, int64_t y, int64_t n, uint32_t color, WrenLineSkip skip) {
+    if (skip.y1 <= y && y <= skip.y2 && x <= skip.x && skip.x < x + n) {
+        if (skip.x > x) wrenPaintSpan(wc, x, y, skip.x - x, color);
+        if (x + n > skip.x + 1) wrenPaintSpan(wc, skip.x + 1, y, x + n - skip.x - 1, color);
+        return;
+    }
+    wrenPaintSpan(wc, x, y, n, color);
+}
+
+static inline void wrenLineSegment(WrenCanvas wc, int x1, int y1, int x2, int y2, uint32_t color, WrenLineSkip skip) {
+    int64_t dx = (int64_t) x2 - x1;
+    int64_t dy = (int64_t) y2 - y1;
+
+    if (dx == 0) {
+        if (x1 < 0 || x1 >= (int) wc.width) return;
+        if (y1 > y2) WREN_SWAP(int, y1, y2);
+        if (y1 < 0) y1 = 0;
+        if (y2 >= (int) wc.height) y2 = (int) wc.height - 1;
+        for (int y = y1; y <= y2; y++) {
+            wrenLineSpan(wc, x1, y, 1, color, skip);
+        }
+        return;
+    }
+
+    // Rows are measured from the first endpoint so that the line does not
+    // change when it is drawn translated, e.g. on a tile. Offsets are
+    // mirrored to grow downwards; sy maps them back to rows.
+    int64_t d = dx < 0 ? -dx : dx;
+    int64_t n = dx < 0 ? -dy : dy;
+    int sy = n < 0 ? -1 : 1;
+    if (n < 0) n = -n;
+    int64_t lo = sy > 0 ? -(int64_t) y1 : y1 - ((int64_t) wc.height - 1);
+    int64_t hi = sy > 0 ? (int64_t) wc.height - 1 - y1 : y1;
+
+    int64_t ta = (x1 < x2 ? x1 : x2) - (int64_t) x1;
+    int64_t tb = (x1 < x2 ? x2 : x1) - (int64_t) x1;
+    if (ta < -(int64_t) x1) ta = -(int64_t) x1;
+    if (tb > (int64_t) wc.width - 1 - x1) tb = (int64_t) wc.width - 1 - x1;
+    if (ta > tb) return;
+
+    // First column reaching offset lo and last column starting at or
+    // before offset hi.
+    int64_t l = ta, h = tb + 1;
+    while (l < h) {
+        int64_t m = l + (h - l)/2;
+        if (wrenLineOffset(n, d, m + 1) >= lo) h = m; else l = m + 1;
+    }
+    ta = l;
+    l = ta - 1, h = tb;
+    while (l < h) {
+        int64_t m = h - (h - l)/2;
+        if (wrenLineOffset(n, d, m) <= hi) l = m; else h = m - 1;
+    }
+    tb = l;
+    if (ta > tb) return;
+
+    WrenLineStep ls = wrenLineStep(n, d, ta);
+    int64_t a = wrenLineRow(&ls);
+
+    if (n <= d) {
+        // Shallow: offsets grow by at most one per column, so every row is a
+        // horizontal span; a column where the row changes ends the old span
+        // and starts the new one.
+        int64_t start = ta;
+        for (int64_t t = ta; t <= tb; t++) {
+            wrenLineNext(&ls);
+            int64_t b = wrenLineRow(&ls);
+            if (b != a || t == tb) {
+                if (lo <= a && a <= hi) wrenLineSpan(wc, x1 + start, y1 + sy*a, t - start + 1, color, skip);
+                if (b != a && t == tb && lo <= b && b <= hi) wrenLineSpan(wc, x1 + t, y1 + sy*b, 1, color, skip);
+                start = t;
+                a = b;
+            }
+        }
+        return;
+    }
+
+    for (int64_t t = ta; t <= tb; t++) {
+        wrenLineNext(&ls);
+        int64_t b = wrenLineRow(&ls);
+        int64_t r1 = a < lo ? lo : a;
+        int64_t r2 = b > hi ? hi : b;
+        for (int64_t r = r1; r <= r2; r++) {
+            wrenLineSpan(wc, x1 + t, y1 + sy*r, 1, color, skip);
+        }
+        a = b;
+    }
+}
+
+WRENDEF void wrenLine(WrenCanvas wc, int x1, int y1, int x2, int y2, uint32_t color) {
+    wrenLineSegment(wc, x1, y1, x2, y2, color, WREN_LINE_SKIP_NONE);
+}
+
+// Rows painted by the line in the column of its second end point.
+static inline WrenLineSkip wrenLineEnd(int x1, int y1, int x2, int y2) {
+    int64_t dx = (int64_t) x2 - x1;
+    int64_t dy = (int64_t) y2 - y1;
+    if (dx == 0) return (WrenLineSkip) {x2, y1 < y2 ? y1 : y2, y1 < y2 ? y2 : y1};
+
+    int64_t d = dx < 0 ? -dx : dx;
+    int64_t n = dx < 0 ? -dy : dy;
+    int64_t a = y1 + wrenLineOffset(n, d, dx);
+    int64_t b = y1 + wrenLineOffset(n, d, dx + 1);
+    return (WrenLineSkip) {x2, a < b ? a : b, a < b ? b : a};
+}
+
+// Whether the line paints nothing on the canvas. Steep lines reach past the
+// row of their right end point by up to |dy/dx| rows, which is only worked
+// out when the end points alone do not settle it.
+static inline bool wrenLineMisses(WrenCanvas wc, int x1, int y1, int x2, int y2) {
+    if ((x1 < 0 && x2 < 0) || (x1 >= (int) wc.width && x2 >= (int) wc.width)) return true;
+    bool above = y1 < 0 && y2 < 0;
+    bool below = y1 >= (int) wc.height && y2 >= (int) wc.height;
+    if (!above && !below) return false;
+
+    int64_t dx = (int64_t) x2 - x1;
+    int64_t dy = (int64_t) y2 - y1;
+    int64_t right = x1 < x2 ? y2 : y1;
+    if (dx != 0) right += wrenLineOffset(dx < 0 ? -dy : dy, dx < 0 ? -dx : dx, 1);
+    return above ? right < 0 : right >= (int) wc.height;
+}
+
+// Draws the n - 1 segments joining the n points in xy (x and y interleaved)
+// like wrenLine, except that a segment does not paint again the pixels of its
+// start column that the previous segment has painted, so translucent
+// polylines blend once at their vertices.
+WRENDEF void wrenPolyline(WrenCanvas wc, const int *xy, size_t n, uint32_t color) {
+    for (size_t i = 0; i + 1 < n; i++) {
+        const int *p = xy + 2*i;
+        if (wrenLineMisses(wc, p[0], p[1], p[2], p[3])) continue;
+        WrenLineSkip skip = i > 0 ? wrenLineEnd(p[-2], p[-1], p[0], p[1]) : WREN_LINE_SKIP_NONE;
+        wrenLineSegment(wc, p[0], p[1], p[2], p[3], color, skip);
+    }
+}
+
+// Draws n/2 independent segments, each from a pair of points in xy.
+WRENDEF void wrenLines(WrenCanvas wc, const int *xy, size_t n, uint32_t color) {
+    for (size_t i = 0; i + 1 < n; i += 2) {
+        const int *p = xy + 2*i;
+        if (wrenLineMisses(wc, p[0], p[1], p[2], p[3])) continue;
+        wrenLineSegment(wc, p[0], p[1], p[2], p[3], color, WREN_LINE_SKIP_NONE);
+    }
+}
+
+// Antialiased one pixel line after Xiaolin Wu: every column along the major
+// axis splits the line's coverage between the two pixels it falls between.
+WRENDEF void wrenLineAA(WrenCanvas wc, int x1, int y1, int x2, int y2, uint32_t color) {
+    // Major axis u and minor axis v; steep lines swap the roles of x and y.
+    bool steep = WREN_ABS(int64_t, (int64_t) y2 - y1) > WREN_ABS(int64_t, (int64_t) x2 - x1);
+    int64_t u1 = steep ? y1 : x1, v1 = steep ? x1 : y1;
+    int64_t u2 = steep ? y2 : x2, v2 = steep ? x2 : y2;
+    if (u1 > u2) {
+        WREN_SWAP(int64_t, u1, u2);
+        WREN_SWAP(int64_t, v1, v2);
+    }
+    int64_t uSize = steep ? wc.height : wc.width;
+    int64_t vSize = steep ? wc.width : wc.height;
+
+    int64_t d = u2 - u1;
+    if (d == 0) {
+        if (0 <= x1 && x1 < (int) wc.width && 0 <= y1 && y1 < (int) wc.height) {
+            wrenPaintSpan(wc, x1, y1, 1, color);
+        }
+        return;
+    }
+
+    // Column t covers rows v1 + q and v1 + q + 1, where q and r are the floor
+    // quotient and remainder of n*t by d. Both rows move monotonically, so the
+    // visible columns are one range.
+    int64_t n = v2 - v1;
+    int64_t ta = u1 < 0 ? -u1 : 0;
+    int64_t tb = u2 >= uSize ? uSize - 1 - u1 : d;
+    int64_t l = ta, h = tb + 1;
+    while (l < h) {
+        int64_t m = l + (h - l)/2, r;
+        int64_t v = v1 + wrenLineMulDiv(n, m, d, &r);
+        if (n >= 0 ? v + 1 >= 0 : v < vSize) h = m; else l = m + 1;
+    }
+    ta = l;
+    l = ta - 1, h = tb;
+    while (l < h) {
+        int64_t m = h - (h - l)/2, r;
+        int64_t v = v1 + wrenLineMulDiv(n, m, d, &r);
+        if (n >= 0 ? v < vSize : v + 1 >= 0) l = m; else h = m - 1;
+    }
+    tb = l;
+    if (ta > tb) return;
+
+    WrenLineStep ls = wrenLineStep(n, d, ta);
+    uint64_t scale = ((uint64_t) 255 << 32)/d;
+    uint32_t alpha = WREN_ALPHA(color);
+    uint32_t rgb = color&0x00FFFFFF;
+
+    // Shallow lines keep the pixels of both rows in runs until the row
+    // changes, so they go out as spans.
+    uint32_t runs[2][64];
+    size_t count = 0;
+    int64_t runU = 0, runV = 0;
+    for (int64_t t = ta; t <= tb; t++) {
+        int64_t u = u1 + t, v = v1 + ls.q;
+        uint32_t c = (ls.r*scale) >> 32;
+        uint32_t c1 = (rgb|((alpha*(255 - c)/255) << 24));
+        uint32_t c2 = (rgb|((alpha*c/255) << 24));
+        wrenLineNext(&ls);
+
+        if (steep) {
+            if (0 <= v && v < vSize) wrenPaintSpan(wc, v, u, 1, c1);
+            if (0 <= v + 1 && v + 1 < vSize) wrenPaintSpan(wc, v + 1, u, 1, c2);
+            continue;
+        }
+
+        if (count > 0 && (v != runV || count == 64)) {
+            if (0 <= runV && runV < vSize) wrenPaintSpanColors(wc, runU, runV, runs[0], count);
+            if (0 <= runV + 1 && runV + 1 < vSize) wrenPaintSpanColors(wc, runU, runV + 1, runs[1], count);
+            count = 0;
+        }
+        if (count == 0) runU = u, runV = v;
+        runs[0][count] = c1;
+        runs[1][count] = c2;
+        count++;
+    }
+    if (count > 0) {
+        if (0 <= runV && runV < vSize) wrenPaintSpanColors(wc, runU, runV, runs[0], count);
+        if (0 <= runV + 1 && runV + 1 < vSize) wrenPaintSpanColors(wc, runU, runV + 1, runs[1], count);
+    }
+}
+
+// Strokes are the union of convex pieces (segment bodies, caps and joins) in
+// 1/256 pixel units. Each pixel row is rasterized once: every sample row of it
+// collects the sample columns covered by any piece as a sorted list of
+// disjoint ranges, so overlapping pieces are never blended twice.
+#define WREN_STROKE_ONE 256
+
+// Widest strip of columns stroked at once: disjoint ranges leave a sample
+// between them, so 2*(WREN_STROKE_RANGES - 1) sample columns never run out of
+// ranges.
+#define WREN_STROKE_STRIP (2*(WREN_STROKE_RANGES - 1)/WREN_AA_RES)
+
+typedef struct {
+    int64_t s1, s2;
+} WrenSampleRange;
+
+typedef struct {
+    WrenSampleRange ranges[WREN_AA_RES][WREN_STROKE_RANGES];
+    size_t counts[WREN_AA_RES];
+    // Strip of sample columns kept.
+    int64_t s1, s2;
+} WrenSampleRow;
+
+static inline void wrenSampleRowReset(WrenSampleRow *row, int64_t s1, int64_t s2) {
+    for (int soy = 0; soy < WREN_AA_RES; soy++) row->counts[soy] = 0;
+    row->s1 = s1;
+    row->s2 = s2;
+}
+
+// Adds sample columns [s1, s2] within the strip to a sample row.
+static inline void wrenSampleRowAdd(WrenSampleRow *row, int soy, int64_t s1, int64_t s2) {
+    if (s1 < row->s1) s1 = row->s1;
+    if (s2 > row->s2) s2 = row->s2;
+    if (s1 > s2) return;
+    WrenSampleRange *ranges = row->ranges[soy];
+    size_t n = row->counts[soy];
+
+    // First range that ends at or after s1 - 1; everything before it stays.
+    size_t i = 0;
+    while (i < n && ranges[i].s2 < s1 - 1) i++;
+    // Ranges [i, j) touch [s1, s2] and are merged into it.
+    size_t j = i;
+    while (j < n && ranges[j].s1 <= s2 + 1) {
+        if (ranges[j].s1 < s1) s1 = ranges[j].s1;
+        if (ranges[j].s2 > s2) s2 = ranges[j].s2;
+        j++;
+    }
+
+    // Strips are narrow enough for this never to happen.
+    if (i == j && n == WREN_STROKE_RANGES) return;
+
+    // Replace ranges [i, j) with the merged one.
+    size_t removed = j - i;
+    if (removed == 0) {
+        for (size_t k = n; k > i; k--) ranges[k] = ranges[k - 1];
+        row->counts[soy] = n + 1;
+    } else if (removed > 1) {
+        for (size_t k = j; k < n; k++) ranges[k - removed + 1] = ranges[k];
+        row->counts[soy] = n - removed + 1;
+    }
+    ranges[i].s1 = s1;
+    ranges[i].s2 = s2;
+}
+
+// Center of sample row soy of pixel row y, in 1/256 pixels.
+static inline int64_t wrenSampleY(int y, int soy) {
+    return ((int64_t) y*2*WREN_AA_RES + soy*2 + 1)*WREN_STROKE_ONE/(2*WREN_AA_RES);
+}
+
+// Adds the samples with centers in [xl, xr] (1/256 pixels) to sample row soy.
+static inline void wrenSampleRowAddSpan(WrenSampleRow *row, int soy, int64_t xl, int64_t xr) {
+    // Sample column s has its center at (2*s + 1)/(2*WREN_AA_RES) pixels.
+    int64_t a = -wrenFloorDiv(-xl*2*WREN_AA_RES, WREN_STROKE_ONE);
+    int64_t b = wrenFloorDiv(xr*2*WREN_AA_RES, WREN_STROKE_ONE);
+    wrenSampleRowAdd(row, soy, -wrenFloorDiv(-(a - 1), 2), wrenFloorDiv(b - 1, 2));
+}
+
+static inline void wrenSampleRowAddPolygon(WrenSampleRow *row, int y, const int64_t (*p)[2], size_t n) {
+    for (int soy = 0; soy < WREN_AA_RES; soy++) {
+        int64_t ys = wrenSampleY(y, soy);
+        int64_t xl = INT64_MAX, xr = INT64_MIN;
+        for (size_t i = 0; i < n; i++) {
+            const int64_t *a = p[i], *b = p[(i + 1)%n];
+            if ((a[1] <= ys && ys < b[1]) || (b[1] <= ys && ys < a[1])) {
+                int64_t x = a[0] + (ys - a[1])*(b[0] - a[0])/(b[1] - a[1]);
+                if (x < xl) xl = x;
+                if (x > xr) xr = x;
+            }
+        }
+        if (xl <= xr) wrenSampleRowAddSpan(row, soy, xl, xr);
+    }
+}
+
+static inline void wrenSampleRowAddDisk(WrenSampleRow *row, int y, int64_t cx, int64_t cy, int64_t r) {
+    for (int soy = 0; soy < WREN_AA_RES; soy++) {
+        int64_t dy = wrenSampleY(y, soy) - cy;
+        if (dy*dy > r*r) continue;
+        int64_t h = wrenIsqrt(r*r - dy*dy);
+        wrenSampleRowAddSpan(row, soy, cx - h, cx + h);
+    }
+}
+
+// Paints pixel row y from its sample row. Pixels with every sample covered are
+// painted as opaque spans and only partially covered ones count samples.
+static inline void wrenSampleRowPaint(WrenCanvas wc, int y, const WrenSampleRow *row, uint32_t color) {
+    size_t at[WREN_AA_RES] = {0};
+    int64_t start = INT64_MAX, end = INT64_MIN;
+    for (int soy = 0; soy < WREN_AA_RES; soy++) {
+        size_t n = row->counts[soy];
+        if (n == 0) continue;
+        if (row->ranges[soy][0].s1 < start) start = row->ranges[soy][0].s1;
+        if (row->ranges[soy][n - 1].s2 > end) end = row->ranges[soy][n - 1].s2;
+    }
+    if (start > end) return;
+    int64_t x = wrenFloorDiv(start, WREN_AA_RES);
+    end = wrenFloorDiv(end, WREN_AA_RES);
+    if (x < 0) x = 0;
+    if (end >= (int) wc.width) end = (int) wc.width - 1;
+
+    uint32_t colors[64];
+    size_t n = 0;
+    while (x <= end) {
+        // Pixel x covers sample columns [s, s + WREN_AA_RES).
+        int64_t s = x*WREN_AA_RES;
+        int count = 0;
+        int64_t fullEnd = INT64_MAX, next = INT64_MAX;
+        for (int soy = 0; soy < WREN_AA_RES; soy++) {
+            const WrenSampleRange *ranges = row->ranges[soy];
+            while (at[soy] < row->counts[soy] && ranges[at[soy]].s2 < s) at[soy]++;
+            size_t i = at[soy];
+            if (i < row->counts[soy] && ranges[i].s1 <= s && s + WREN_AA_RES - 1 <= ranges[i].s2) {
+                int64_t last = wrenFloorDiv(ranges[i].s2 + 1, WREN_AA_RES) - 1;
+                if (last < fullEnd) fullEnd = last;
+            } else {
+                fullEnd = INT64_MIN;
+            }
+            for (; i < row->counts[soy] && ranges[i].s1 < s + WREN_AA_RES; i++) {
+                int64_t a = ranges[i].s1 < s ? s : ranges[i].s1;
+                int64_t b = ranges[i].s2 > s + WREN_AA_RES - 1 ? s + WREN_AA_RES - 1 : ranges[i].s2;
+                count += b - a + 1;
+            }
+            if (i < row->counts[soy]) {
+                int64_t first = wrenFloorDiv(ranges[i].s1, WREN_AA_RES);
+                if (first < next) next = first;
+            }
+        }
+
+        if (fullEnd >= x || count == 0) {
+            if (n > 0) wrenPaintSpanColors(wc, x - n, y, colors, n);
+            n = 0;
+            if (count == 0) {
+                x = next;
+                continue;
+            }
+            if (fullEnd > end) fullEnd = end;
+            if (WREN_ALPHA(color) != 0) wrenPaintSpan(wc, x, y, fullEnd - x + 1, color);
+            x = fullEnd + 1;
+            continue;
+        }
+
+        uint32_t alpha = WREN_ALPHA(color)*count/WREN_AA_SAMPLES;
+        colors[n++] = (color&0x00FFFFFF)|(alpha<<(3*8));
+        if (n == sizeof(colors)/sizeof(colors[0])) {
+            wrenPaintSpanColors(wc, x + 1 - n, y, colors, n);
+            n = 0;
+        }
+        x++;
+    }
+    if (n > 0) wrenPaintSpanColors(wc, x - n, y, colors, n);
+}
+
+typedef struct {
+    const int *xy;
+    size_t n;
+    int64_t hw;
+    WrenLineCap cap;
+    WrenLineJoin join;
+    int64_t miterLimit;
+    // How far any piece reaches from the segment's end points.
+    int64_t reach;
+} WrenStroke;
+
+// Polyline segment set up for stroking, in 1/256 pixels: its body with the
+// caps of the polyline ends applied, the disks of round caps and joins, and
+// the outer corners of a miter or bevel join at its start.
+typedef struct {
+    int32_t x1, y1, x2, y2;
+    // Left normal scaled to half the width.
+    int32_t nx, ny;
+    int32_t join[3][2];
+    // Pixel rows the pieces reach.
+    int32_t ylo, yhi;
+    uint8_t joinCount;
+    bool body, diskStart, diskEnd;
+} WrenStrokeSegment;
+
+// Pixels polyline segment i can reach, from its end points alone.
+static inline void wrenStrokeBounds(const WrenStroke *st, size_t i, int64_t *xlo, int64_t *ylo, int64_t *xhi, int64_t *yhi) {
+    int64_t x1 = st->xy[2*i], y1 = st->xy[2*i + 1], x2 = st->xy[2*i + 2], y2 = st->xy[2*i + 3];
+    int64_t reach = (st->reach + WREN_STROKE_ONE - 1)/WREN_STROKE_ONE + 1;
+    *xlo = (x1 < x2 ? x1 : x2) - reach;
+    *ylo = (y1 < y2 ? y1 : y2) - reach;
+    *xhi = (x1 > x2 ? x1 : x2) + reach;
+    *yhi = (y1 > y2 ? y1 : y2) + reach;
+}
+
+static inline bool wrenStrokeHasLength(const WrenStroke *st, size_t i) {
+    return st->xy[2*i] != st->xy[2*i + 2] || st->xy[2*i + 1] != st->xy[2*i + 3];
+}
+
+// Left normal of the direction (dx, dy), scaled to hw. Only the direction
+// matters, so long ones are first scaled down to keep the squares in range.
+static inline void wrenStrokeNormal(int64_t dx, int64_t dy, int64_t hw, int64_t *nx, int64_t *ny) {
+    while (WREN_ABS(int64_t, dx) >= (1 << 20) || WREN_ABS(int64_t, dy) >= (1 << 20)) dx /= 2, dy /= 2;
+    int64_t len = wrenIsqrt((dx*dx + dy*dy)*WREN_STROKE_ONE*WREN_STROKE_ONE);
+    *nx = -dy*WREN_STROKE_ONE*hw/len;
+    *ny = dx*WREN_STROKE_ONE*hw/len;
+}
+
+// Center of end point (x1, y1) of the segment to (x2, y2) in 1/256 pixels,
+// moved along the segment onto the guard band around the canvas when it lies
+// beyond. Returns false when the segment misses the band.
+static inline bool wrenStrokeClipEnd(WrenCanvas wc, int64_t x1, int64_t y1, int64_t x2, int64_t y2, int64_t *sx, int64_t *sy, bool *clipped) {
+    int64_t p[2] = {x1, y1}, q[2] = {x2, y2};
+    int64_t lo = -WREN_GUARD_BAND, hi[2] = {(int64_t) wc.width + WREN_GUARD_BAND, (int64_t) wc.height + WREN_GUARD_BAND};
+    *sx = x1*WREN_STROKE_ONE + WREN_STROKE_ONE/2;
+    *sy = y1*WREN_STROKE_ONE + WREN_STROKE_ONE/2;
+    *clipped = x1 < lo || x1 > hi[0] || y1 < lo || y1 > hi[1];
+    if (!*clipped) return true;
+
+    // The segment enters the band on one of the sides the end point is
+    // beyond, where the crossing lies within the other sides.
+    for (int a = 0; a < 2; a++) {
+        int64_t side = p[a] < lo ? lo : p[a] > hi[a] ? hi[a] : p[a];
+        if (side == p[a]) continue;
+        if ((p[a] < lo && q[a] < lo) || (p[a] > hi[a] && q[a] > hi[a])) return false;
+        // The crossing is |side - p|/|q - p| of the way from p to q.
+        int64_t d = WREN_ABS(int64_t, q[a] - p[a]), r;
+        int64_t c = wrenLineMulDiv(q[1 - a] - p[1 - a], WREN_ABS(int64_t, side - p[a]), d, &r);
+        int64_t s[2];
+        s[a] = side*WREN_STROKE_ONE + WREN_STROKE_ONE/2;
+        s[1 - a] = (p[1 - a] + c)*WREN_STROKE_ONE + WREN_STROKE_ONE/2 + (2*r*WREN_STROKE_ONE + d)/(2*d);
+        int b = 1 - a;
+        if (s[b] >= lo*WREN_STROKE_ONE && s[b] <= (hi[b] + 1)*WREN_STROKE_ONE) {
+            *sx = s[0];
+            *sy = s[1];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sets up polyline segment i, with the previous segment that has a length at
+// prev (SIZE_MAX for none). Returns false when it draws nothing.
+static inline bool wrenStrokeSegment(WrenCanvas wc, const WrenStroke *st, size_t i, size_t prev, WrenStrokeSegment *seg) {
+    int64_t x1 = st->xy[2*i], y1 = st->xy[2*i + 1], x2 = st->xy[2*i + 2], y2 = st->xy[2*i + 3];
+    int64_t dx = x2 - x1, dy = y2 - y1;
+    bool first = i == 0, last = i + 2 == st->n;
+    bool clipped1, clipped2;
+    if (!wrenStrokeClipEnd(wc, x1, y1, x2, y2, &x1, &y1, &clipped1)) return false;
+    wrenStrokeClipEnd(wc, x2, y2, st->xy[2*i], st->xy[2*i + 1], &x2, &y2, &clipped2);
+
+    int64_t nx = 0, ny = st->hw, join[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+    size_t joinCount = 0;
+    bool body = true, diskStart = false, diskEnd = false;
+    if (dx == 0 && dy == 0) {
+        // A zero length polyline still shows its round or square caps, the
+        // square one as a body across it.
+        body = st->n == 2 && st->cap == WREN_CAP_SQUARE;
+        diskStart = st->n == 2 && st->cap == WREN_CAP_ROUND;
+        if (!body && !diskStart) return false;
+        if (body) x1 -= st->hw, x2 += st->hw;
+    } else {
+        // Caps and joins at clipped end points lie past the band and are
+        // dropped.
+        wrenStrokeNormal(dx, dy, st->hw, &nx, &ny);
+        int64_t ex = ny, ey = -nx;
+        if (first && !clipped1 && st->cap == WREN_CAP_SQUARE) x1 -= ex, y1 -= ey;
+        if (last && !clipped2 && st->cap == WREN_CAP_SQUARE) x2 += ex, y2 += ey;
+        diskStart = first && !clipped1 && st->cap == WREN_CAP_ROUND;
+        diskEnd = last && !clipped2 && st->cap == WREN_CAP_ROUND;
+        if (!first && !clipped1 && prev != SIZE_MAX && st->join == WREN_JOIN_ROUND) diskStart = true;
+        if (!first && !clipped1 && prev != SIZE_MAX && st->join != WREN_JOIN_ROUND) {
+            // The outer side of the turn is where the two bodies leave a notch.
+            int64_t pnx, pny;
+            wrenStrokeNormal((int64_t) st->xy[2*prev + 2] - st->xy[2*prev], (int64_t) st->xy[2*prev + 3] - st->xy[2*prev + 1], st->hw, &pnx, &pny);
+            int64_t cross = pny*ey + pnx*ex;
+            int64_t o1x = cross > 0 ? -pnx : pnx, o1y = cross > 0 ? -pny : pny;
+            int64_t o2x = cross > 0 ? -nx : nx, o2y = cross > 0 ? -ny : ny;
+            join[0][0] = o1x;
+            join[0][1] = o1y;
+            join[1][0] = join[2][0] = o2x;
+            join[1][1] = join[2][1] = o2y;
+            joinCount = cross != 0 ? 3 : 0;
+            // The miter tip is at (o1 + o2)*hw^2/(hw^2 + o1.o2) from the vertex.
+            int64_t hw2 = st->hw*st->hw;
+            int64_t den = hw2 + o1x*o2x + o1y*o2y;
+            // Since |o1 + o2|^2 = 2*den, |m| <= limit*hw reduces to
+            // 2*hw^2 <= limit^2*den.
+            if (cross != 0 && st->join == WREN_JOIN_MITER && den > 0 && 2*hw2 <= st->miterLimit*st->miterLimit*den) {
+                join[1][0] = (o1x + o2x)*hw2/den;
+                join[1][1] = (o1y + o2y)*hw2/den;
+                joinCount = 4;
+            }
+        }
+    }
+
+    // Pixel rows the pieces reach.
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+    if (body) {
+        lo = (y1 < y2 ? y1 : y2) - WREN_ABS(int64_t, ny);
+        hi = (y1 > y2 ? y1 : y2) + WREN_ABS(int64_t, ny);
+    }
+    int64_t r = diskStart ? st->hw : 0;
+    if (y1 - r < lo) lo = y1 - r;
+    if (y1 + r > hi) hi = y1 + r;
+    if (diskEnd && y2 - st->hw < lo) lo = y2 - st->hw;
+    if (diskEnd && y2 + st->hw > hi) hi = y2 + st->hw;
+    for (size_t k = 0; k + 1 < joinCount; k++) {
+        if (y1 + join[k][1] < lo) lo = y1 + join[k][1];
+        if (y1 + join[k][1] > hi) hi = y1 + join[k][1];
+    }
+
+    // Everything is within the guard band and fits in 32 bits.
+    seg->x1 = (int32_t) x1;
+    seg->y1 = (int32_t) y1;
+    seg->x2 = (int32_t) x2;
+    seg->y2 = (int32_t) y2;
+    seg->nx = (int32_t) nx;
+    seg->ny = (int32_t) ny;
+    for (size_t k = 0; k < 3; k++) {
+        seg->join[k][0] = (int32_t) join[k][0];
+        seg->join[k][1] = (int32_t) join[k][1];
+    }
+    seg->ylo = (int32_t) wrenFloorDiv(lo, WREN_STROKE_ONE);
+    seg->yhi = (int32_t) wrenFloorDiv(hi, WREN_STROKE_ONE);
+    seg->joinCount = (uint8_t) joinCount;
+    seg->body = body;
+    seg->diskStart = diskStart;
+    seg->diskEnd = diskEnd;
+    return true;
+}
+
+// Adds the pieces of a set up segment to pixel row y.
+static inline void wrenStrokeAddSegment(WrenSampleRow *row, int y, const WrenStroke *st, const WrenStrokeSegment *seg) {
+    int64_t x1 = seg->x1, y1 = seg->y1, x2 = seg->x2, y2 = seg->y2;
+    if (seg->body) {
+        int64_t body[4][2] = {
+            {x1 + seg->nx, y1 + seg->ny}, {x2 + seg->nx, y2 + seg->ny},
+            {x2 - seg->nx, y2 - seg->ny}, {x1 - seg->nx, y1 - seg->ny},
+        };
+        wrenSampleRowAddPolygon(row, y, body, 4);
+    }
+    if (seg->diskStart) wrenSampleRowAddDisk(row, y, x1, y1, st->hw);
+    if (seg->diskEnd) wrenSampleRowAddDisk(row, y, x2, y2, st->hw);
+    if (seg->joinCount > 0) {
+        int64_t p[4][2] = {
+            {x1, y1},
+            {x1 + seg->join[0][0], y1 + seg->join[0][1]},
+            {x1 + seg->join[1][0], y1 + seg->join[1][1]},
+            {x1 + seg->join[2][0], y1 + seg->join[2][1]},
+        };
+        wrenSampleRowAddPolygon(row, y, p, seg->joinCount);
+    }
+}
+
+// Adds the segments among [first, last] that reach pixel row y within
+// columns [x1, x2] to a sample row, set up in batches in segs. The previous
+// segment with a length is at prev. Used for rows crossed by more segments
+// than a band of rows holds.
+static inline void wrenStrokeSweepRow(WrenCanvas wc, WrenSampleRow *row, int y, int64_t x1, int64_t x2, const WrenStroke *st, size_t first, size_t last, size_t prev, WrenStrokeSegment *segs) {
+    size_t count = 0;
+    for (size_t i = first; i <= last; i++) {
+        int64_t xlo, ylo, xhi, yhi;
+        wrenStrokeBounds(st, i, &xlo, &ylo, &xhi, &yhi);
+        if (ylo <= y && y <= yhi && xlo <= x2 && xhi >= x1 && wrenStrokeSegment(wc, st, i, prev, &segs[count])) count++;
+        if (wrenStrokeHasLength(st, i)) prev = i;
+        if (count == WREN_STROKE_BATCH || i == last) {
+            for (size_t k = 0; k < count; k++) wrenStrokeAddSegment(row, y, st, &segs[k]);
+            count = 0;
+        }
+    }
+}
+
+// Strokes the strip of columns [x1, x2] from the segments [first, last] that
+// may reach it, within rows [top, bottom]. Segments are set up once per band
+// of rows, the longest one whose segments fit in WREN_STROKE_BATCH, and
+// walked row by row with the ones that reach the row.
+static inline void wrenStrokeStrip(WrenCanvas wc, const WrenStroke *st, int64_t x1, int64_t x2, size_t first, size_t last, int64_t top, int64_t bottom, uint32_t color) {
+    WrenStrokeSegment segs[WREN_STROKE_BATCH];
+    size_t counts[WREN_STROKE_BATCH], order[WREN_STROKE_BATCH], active[WREN_STROKE_BATCH];
+    WrenSampleRow row;
+    size_t before = SIZE_MAX;
+    for (size_t i = first; i > 0 && before == SIZE_MAX; i--) {
+        if (wrenStrokeHasLength(st, i - 1)) before = i - 1;
+    }
+
+    for (int64_t y = top; y <= bottom;) {
+        // Counts the segments by the first row of the band they reach.
+        int64_t end = y + WREN_STROKE_BATCH - 1 < bottom ? y + WREN_STROKE_BATCH - 1 : bottom;
+        for (size_t k = 0; k < WREN_STROKE_BATCH; k++) counts[k] = 0;
+        for (size_t i = first; i <= last; i++) {
+            int64_t a, b, c, d;
+            wrenStrokeBounds(st, i, &a, &b, &c, &d);
+            if (a <= x2 && c >= x1 && d >= y && b <= end) counts[b > y ? b - y : 0]++;
+        }
+        int64_t rows = 0;
+        size_t total = 0;
+        while (y + rows <= end && total + counts[rows] <= WREN_STROKE_BATCH) total += counts[rows++];
+        if (rows == 0) {
+            wrenSampleRowReset(&row, x1*WREN_AA_RES, (x2 + 1)*WREN_AA_RES - 1);
+            wrenStrokeSweepRow(wc, &row, y, x1, x2, st, first, last, before, segs);
+            wrenSampleRowPaint(wc, y, &row, color);
+            y++;
+            continue;
+        }
+        end = y + rows - 1;
+
+        // Sets the band's segments up, ordered by their first row.
+        size_t count = 0, prev = before;
+        for (size_t i = first; i <= last; i++) {
+            int64_t a, b, c, d;
+            wrenStrokeBounds(st, i, &a, &b, &c, &d);
+            if (a <= x2 && c >= x1 && d >= y && b <= end && wrenStrokeSegment(wc, st, i, prev, &segs[count])) {
+                size_t k = count++;
+                for (; k > 0 && segs[order[k - 1]].ylo > segs[count - 1].ylo; k--) order[k] = order[k - 1];
+                order[k] = count - 1;
+            }
+            if (wrenStrokeHasLength(st, i)) prev = i;
+        }
+
+        size_t next = 0, live = 0;
+        for (; y <= end; y++) {
+            while (next < count && segs[order[next]].ylo <= y) active[live++] = order[next++];
+            size_t kept = 0;
+            for (size_t k = 0; k < live; k++) {
+                if (segs[active[k]].yhi >= y) active[kept++] = active[k];
+            }
+            live = kept;
+            if (live == 0) continue;
+            wrenSampleRowReset(&row, x1*WREN_AA_RES, (x2 + 1)*WREN_AA_RES - 1);
+            for (size_t k = 0; k < live; k++) wrenStrokeAddSegment(&row, y, st, &segs[active[k]]);
+            wrenSampleRowPaint(wc, y, &row, color);
+        }
+    }
+}
+
+// Strokes the polyline through the n points in xy (x and y interleaved) with
+// the given width in pixels, at most 8192. Miters longer than
+// WREN_MITER_LIMIT half widths fall back to bevels.
+WRENDEF void wrenThickPolyline(WrenCanvas wc, const int *xy, size_t n, int width, WrenLineCap cap, WrenLineJoin join, uint32_t color) {
+    if (n < 2 || width <= 0) return;
+    // Widths are capped so that pieces stay well inside the guard band that
+    // far end points are clipped to, and the join arithmetic stays in range.
+    int64_t spread = WREN_MITER_LIMIT > 2 ? WREN_MITER_LIMIT : 2;
+    if (width > 8192) width = 8192;
+    if (width > WREN_GUARD_BAND/(2*spread)) width = WREN_GUARD_BAND/(2*spread);
+
+    WrenStroke st = {
+        .xy = xy,
+        .n = n,
+        .hw = (int64_t) width*WREN_STROKE_ONE/2,
+        .cap = cap,
+        .join = join,
+        .miterLimit = WREN_MITER_LIMIT,
+    };
+    // Square caps reach sqrt(2) half widths out and miters up to the limit.
+    st.reach = join == WREN_JOIN_MITER ? st.hw*spread : cap == WREN_CAP_SQUARE ? 2*st.hw : st.hw;
+
+    int64_t xlo = INT64_MAX, ylo = INT64_MAX, xhi = INT64_MIN, yhi = INT64_MIN;
+    for (size_t i = 0; i + 1 < n; i++) {
+        int64_t a, b, c, d;
+        wrenStrokeBounds(&st, i, &a, &b, &c, &d);
+        if (a < xlo) xlo = a;
+        if (b < ylo) ylo = b;
+        if (c > xhi) xhi = c;
+        if (d > yhi) yhi = d;
+    }
+    if (xlo < 0) xlo = 0;
+    if (ylo < 0) ylo = 0;
+    if (xhi >= (int) wc.width) xhi = (int) wc.width - 1;
+    if (yhi >= (int) wc.height) yhi = (int) wc.height - 1;
+
+    // Each window of WREN_STROKE_STRIP columns is cut into strips narrow
+    // enough for their segments to fit in a batch, so that each is set up
+    // once per strip. Two passes over the points find the strips and then
+    // the segments and rows each one may reach, which series ordered along x
+    // keep to a narrow run of segments.
+    int64_t starts[WREN_STROKE_STRIP], ends[WREN_STROKE_STRIP], strips[WREN_STROKE_STRIP + 1];
+    size_t firsts[WREN_STROKE_STRIP], lasts[WREN_STROKE_STRIP];
+    int64_t tops[WREN_STROKE_STRIP], bottoms[WREN_STROKE_STRIP];
+    size_t stripOf[WREN_STROKE_STRIP];
+    for (int64_t wx = xlo; wx <= xhi; wx += WREN_STROKE_STRIP) {
+        int64_t columns = xhi - wx + 1 < WREN_STROKE_STRIP ? xhi - wx + 1 : WREN_STROKE_STRIP;
+        for (int64_t k = 0; k < columns; k++) starts[k] = ends[k] = 0;
+        for (size_t i = 0; i + 1 < n; i++) {
+            int64_t a, b, c, d;
+            wrenStrokeBounds(&st, i, &a, &b, &c, &d);
+            if (c < wx || a >= wx + columns || d < ylo || b > yhi) continue;
+            starts[a > wx ? a - wx : 0]++;
+            ends[c < wx + columns ? c - wx : columns - 1]++;
+        }
+        // Segments reaching columns [k1, k2] number starts[<= k2] - ends[< k1].
+        for (int64_t k = 1; k < columns; k++) starts[k] += starts[k - 1], ends[k] += ends[k - 1];
+        size_t count = 0;
+        for (int64_t k1 = 0, k2; k1 < columns; k1 = k2 + 1) {
+            int64_t ended = k1 > 0 ? ends[k1 - 1] : 0;
+            for (k2 = k1; k2 + 1 < columns && starts[k2 + 1] - ended <= WREN_STROKE_BATCH; k2++) {}
+            for (int64_t k = k1; k <= k2; k++) stripOf[k] = count;
+            firsts[count] = SIZE_MAX;
+            lasts[count] = 0;
+            tops[count] = INT64_MAX;
+            bottoms[count] = INT64_MIN;
+            strips[count++] = k1;
+        }
+        strips[count] = columns;
+
+        for (size_t i = 0; i + 1 < n; i++) {
+            int64_t a, b, c, d;
+            wrenStrokeBounds(&st, i, &a, &b, &c, &d);
+            if (c < wx || a >= wx + columns || d < ylo || b > yhi) continue;
+            size_t s1 = stripOf[a > wx ? a - wx : 0], s2 = stripOf[c < wx + columns ? c - wx : columns - 1];
+            for (size_t s = s1; s <= s2; s++) {
+                if (firsts[s] == SIZE_MAX) firsts[s] = i;
+                lasts[s] = i;
+                if (b < tops[s]) tops[s] = b;
+                if (d > bottoms[s]) bottoms[s] = d;
+            }
+        }
+        for (size_t s = 0; s < count; s++) {
+            if (firsts[s] == SIZE_MAX) continue;
+            int64_t top = tops[s] > ylo ? tops[s] : ylo, bottom = bottoms[s] < yhi ? bottoms[s] : yhi;
+            wrenStrokeStrip(wc, &st, wx + strips[s], wx + strips[s + 1] - 1, firsts[s], lasts[s], top, bottom, color);
+        }
+    }
+}
+
+WRENDEF void wrenThickLine(WrenCanvas wc, int x1, int y1, int x2, int y2, int width, WrenLineCap cap, uint32_t color) {
+    int xy[4] = {x1, y1, x2, y2};
+    wrenThickPolyline(wc, xy, 2, width, cap, WREN_JOIN_MITER, color);
+}
+
+// Half-space of a triangle edge: a pixel passes when a*x + b*y + c >= 0.
+typedef struct {
+    int64_t a, b, c;
+} WrenEdge;
+
+// Part of a triangle between its left and right edge.
+typedef struct {
+    WrenEdge left, right;
+} WrenTriangleHalf;
+
+typedef struct {
+    bool gouraud;
+    uint32_t color;
+    // Gouraud shading: channel k of a pixel is trunc(n[k](x, y)/det), where
+    // n[k] is linear; step[k] and rem[k] are floor(n[k].a/det) and its remainder.
+    WrenEdge n[4];
+    int64_t det;
+    int64_t step[4], rem[4];
+    // Depth test: the depth of a pixel is the average of z weighted by its
+    // barycentric coordinates w[0], w[1] and det - w[0] - w[1]. It is found
+    // exactly at the start of each span and stepped by dz, in 16.16 fixed
+    // point, along it, unless the triangle is too steep for that.
+    bool depth, steep;
+    WrenEdge w[2];
+    uint32_t z[3];
+    int64_t dz;
+    // Hierarchical-Z culling, when the triangle is not steep: the slope along
+    // y and a lower bound of the depth of every pixel, both in 16.16.
+    bool coarse;
+    int64_t dzy, zmin;
+} WrenTriangleShade;
+
+// Slack in 16.16 depth for the rounding of stepped depth against the planes
+// tested against tiles.
+#define WREN_HIZ_MARGIN ((int64_t) 4 << 16)
+
+// Tiles of the current tile row of a triangle: the columns written, which
+// tiles were culled, so each is counted once, which kept a closer pixel, and
+// the columns [fx1, fx2] tested on every one of the rows seen so far.
+typedef struct {
+    int x1, x2;
+    size_t base;
+    uint64_t counted[8], kept[8];
+    int fx1, fx2, y, rows;
+} WrenHiZRow;
+
+static inline int64_t wrenEdgeAt(WrenEdge e, int x, int y) {
+    return e.a*x + e.b*y + e.c;
+}
+
+// Edge walked from the base vertex (xb, yb) towards a vertex dx columns and
+// dy >= 0 rows away; sy is +1 when the walk goes down and -1 when it goes up.
+// The span ends of the half are xb + trunc(t*dx/dy) with t = sy*(y - yb), and
+// the edge accepts exactly the pixels on the inner side of that end.
+static inline WrenEdge wrenTriangleEdge(int xb, int yb, int sy, int dx, int dy, bool left) {
+    if (dy == 0) dx = 0, dy = 1;
+    WrenEdge e = {
+        .a = dy,
+        .b = -(int64_t) sy*dx,
+        .c = -(int64_t) dy*xb + (int64_t) sy*dx*yb,
+    };
+    if (left) {
+        if (dx >= 0) e.c += dy - 1;
+    } else {
+        e.a = -e.a, e.b = -e.b, e.c = -e.c;
+        if (dx < 0) e.c += dy - 1;
+    }
+    return e;
+}
+
+static inline WrenTriangleHalf wrenTriangleHalf(int xb, int yb, int sy, int dxA, int dyA, int dxB, int dyB) {
+    // Spans grow from the base vertex, so the edge with the smaller slope stays
+    // on the left for every row of the half.
+    bool aLeft = (int64_t) dxA*dyB <= (int64_t) dxB*dyA;
+    WrenTriangleHalf half = {
+        .left = aLeft ? wrenTriangleEdge(xb, yb, sy, dxA, dyA, true) : wrenTriangleEdge(xb, yb, sy, dxB, dyB, true),
+        .right = aLeft ? wrenTriangleEdge(xb, yb, sy, dxB, dyB, false) : wrenTriangleEdge(xb, yb, sy, dxA, dyA, false),
+    };
+    return half;
+}
+
+static inline void wrenTriangleGouraudSpan(WrenCanvas wc, const WrenTriangleShade *shade, int x1, int x2, int y) {
+    int64_t q[4], r[4];
+    for (int k = 0; k < 4; k++) {
+        int64_t n = wrenEdgeAt(shade->n[k], x1, y);
+        q[k] = wrenFloorDiv(n, shade->det);
+        r[k] = n - q[k]*shade->det;
+    }
+
+    uint32_t colors[64];
+    size_t n = 0;
+    for (int x = x1; x <= x2; x++) {
+        uint32_t c[4];
+        for (int k = 0; k < 4; k++) {
+            c[k] = (uint32_t) (q[k] + (q[k] < 0 && r[k] != 0));
+            q[k] += shade->step[k];
+            r[k] += shade->rem[k];
+            if (r[k] >= shade->det) {
+                r[k] -= shade->det;
+                q[k] += 1;
+            }
+        }
+        colors[n++] = WREN_RGBA(c[0], c[1], c[2], c[3]);
+        if (n == sizeof(colors)/sizeof(colors[0]) || x == x2) {
+            wrenPaintSpanColors(wc, x + 1 - n, y, colors, n);
+            n = 0;
+        }
+    }
+}
+
+// Span ends [xl, xr] of a half on its current row. They are found once with a
+// division and then stepped from row to row: moving down one row shifts each
+// end by the whole part of its slope, and the edge function values el and er
+// tell whether the fractional part carries one more column.
+typedef struct {
+    WrenEdge l, r;
+    int64_t xl, xr, el, er;
+    int64_t ql, qr, dl, dr;
+} WrenTriangleWalk;
+
+static inline WrenTriangleWalk wrenTriangleWalk(WrenTriangleHalf half, int y) {
+    // The left edge has a > 0 and the right edge a < 0, so the span runs from
+    // the first x where the left function is non-negative to the last x where
+    // the right one is.
+    WrenTriangleWalk w = { .l = half.left, .r = half.right };
+    w.xl = -wrenFloorDiv(w.l.b*y + w.l.c, w.l.a);
+    w.xr = wrenFloorDiv(w.r.b*y + w.r.c, -w.r.a);
+    w.el = wrenEdgeAt(w.l, w.xl, y);
+    w.er = wrenEdgeAt(w.r, w.xr, y);
+    w.ql = wrenFloorDiv(-w.l.b, w.l.a);
+    w.qr = wrenFloorDiv(w.r.b, -w.r.a);
+    w.dl = w.l.b + w.ql*w.l.a;
+    w.dr = w.r.b + w.qr*w.r.a;
+    return w;
+}
+
+// The carries follow the fractional slope and are close to random, so they
+// are applied with masks rather than branches.
+static inline void wrenTriangleWalkStep(WrenTriangleWalk *w) {
+    w->xl += w->ql, w->el += w->dl;
+    int64_t ml = w->el >> 63;
+    w->xl -= ml, w->el += w->l.a & ml;
+    w->xr += w->qr, w->er += w->dr;
+    int64_t mr = ~((w->er + w->r.a) >> 63);
+    w->xr -= mr, w->er += w->r.a & mr;
+}
+
+static inline void wrenTriangleShadeSpan(WrenCanvas wc, const WrenTriangleShade *shade, int x1, int x2, int y) {
+    if (shade->gouraud) {
+        wrenTriangleGouraudSpan(wc, shade, x1, x2, y);
+    } else {
+        wrenPaintSpan(wc, x1, y, x2 - x1 + 1, shade->color);
+    }
+}
+
+// floor(n*2^shift/d) for d > 0 and shift 16 or 32, without forming
+// n*2^shift.
+static inline int64_t wrenScaleDiv(int64_t n, int64_t d, int shift) {
+    int64_t q = wrenFloorDiv(n, d), r = n - q*d;
+    for (int s = 0; s < shift; s += 16) {
+        q = q*WREN_FIXED_ONE + r*WREN_FIXED_ONE/d;
+        r = r*WREN_FIXED_ONE%d;
+    }
+    return q;
+}
+
+static inline int64_t wrenTriangleDepthAt(const WrenTriangleShade *shade, int x, int y) {
+    if (shade->det == 0) return (int64_t) shade->z[0] << 16;
+    // Pixels on the edges can be up to a pixel outside, where the weights go
+    // negative and the depth slightly out of range. Halves of z keep the
+    // weighted sums in range.
+    int64_t w0 = wrenEdgeAt(shade->w[0], x, y), w1 = wrenEdgeAt(shade->w[1], x, y), w2 = shade->det - w0 - w1;
+    int64_t hi = w0*(shade->z[0] >> 16) + w1*(shade->z[1] >> 16) + w2*(shade->z[2] >> 16);
+    int64_t lo = w0*(shade->z[0]&0xFFFF) + w1*(shade->z[1]&0xFFFF) + w2*(shade->z[2]&0xFFFF);
+    return wrenScaleDiv(hi, shade->det, 32) + wrenScaleDiv(lo, shade->det, 16);
+}
+
+// Sets the tiles of the tile row holding row y that the triangle wrote to
+// the farthest depth in them. A tile whose every pixel the triangle wrote
+// only needs the plane at its farthest corner; the tiles on its edges or that
+// kept closer pixels are rescanned. Tiles reaching past the canvas keep
+// theirs, which is farther than the truth once the depth buffer is only
+// written.
+static inline void wrenHiZRefresh(WrenCanvas wc, const WrenTriangleShade *shade, int y, const WrenHiZRow *row) {
+    const int T = WREN_HIZ_TILE_SIZE;
+    const int64_t far = (int64_t) UINT32_MAX << 16;
+    int ty = y - (int) ((y + wc.hizY)%T);
+    if (ty < 0 || ty + T > (int) wc.height) return;
+    int x0 = -1;
+    int64_t z0 = 0;
+    for (int tx = row->x1 - (int) ((row->x1 + wc.hizX)%T); tx <= row->x2; tx += T) {
+        if (tx < 0 || tx + T > (int) wc.width) continue;
+        uint32_t *tile = wrenHiZTile(wc, tx, ty);
+        size_t i = (tx + wc.hizX)/T - row->base;
+        if (row->rows == T && tx >= row->fx1 && tx + T - 1 <= row->fx2 &&
+            i < 64*sizeof(row->kept)/sizeof(row->kept[0]) && !(row->kept[i/64] >> i%64 & 1)) {
+            if (x0 < 0) {
+                x0 = tx;
+                z0 = wrenTriangleDepthAt(shade, tx, ty) + WREN_HIZ_MARGIN;
+                if (shade->dz > 0) z0 += shade->dz*(T - 1);
+                if (shade->dzy > 0) z0 += shade->dzy*(T - 1);
+            }
+            int64_t z = z0 + shade->dz*(tx - x0);
+            *tile = z < 0 ? 0 : z > far ? UINT32_MAX : (uint32_t) (z >> 16);
+            if (wc.depth16 != NULL) *tile &= 0xFFFF0000;
+            continue;
+        }
+        uint32_t max = 0;
+        for (int py = ty; py < ty + T; py++) {
+            for (int px = tx; px < tx + T; px++) {
+                uint32_t d = wc.depth16 != NULL ? (uint32_t) wc.depth16[py*wc.depthStride + px] << 16 : wc.depth32[py*wc.depthStride + px];
+                if (d > max) max = d;
+            }
+        }
+        *tile = max;
+    }
+}
+
+// Pixels closer than the depth buffer pass and store their depth. Only runs
+// of passing pixels are shaded, each with its own setup, so hidden pixels
+// cost a compare. With a tile row, the span is first cut at tile boundaries
+// and the pieces in tiles the triangle lies entirely behind cost nothing.
+static inline void wrenTriangleDepthSpan(WrenCanvas wc, const WrenTriangleShade *shade, int x1, int x2, int y, WrenHiZRow *row) {
+    const int T = WREN_HIZ_TILE_SIZE;
+    const int64_t far = (int64_t) UINT32_MAX << 16;
+    uint16_t *depth16 = wc.depth16 != NULL ? &wc.depth16[y*wc.depthStride] : NULL;
+    uint32_t *depth32 = wc.depth32 != NULL ? &wc.depth32[y*wc.depthStride] : NULL;
+    int64_t z = wrenTriangleDepthAt(shade, x1, y);
+    if (row != NULL) {
+        // A second span on the same row leaves a gap, so no tile counts as
+        // tested throughout.
+        if (row->rows == 0) {
+            row->fx1 = x1, row->fx2 = x2;
+        } else if (y == row->y) {
+            row->fx1 = 1, row->fx2 = 0;
+        } else {
+            if (x1 > row->fx1) row->fx1 = x1;
+            if (x2 < row->fx2) row->fx2 = x2;
+        }
+        if (y != row->y) row->rows++;
+        row->y = y;
+    }
+    int start = -1;
+    for (int x = x1; x <= x2;) {
+        int end = x2;
+        if (row != NULL) {
+            // The plane is closest at a corner of the tile.
+            int tx = x - (int) ((x + wc.hizX)%T), ty = y - (int) ((y + wc.hizY)%T);
+            if (tx + T - 1 < end) end = tx + T - 1;
+            int64_t zmin = z + shade->dz*(tx - x) + shade->dzy*(ty - y) - WREN_HIZ_MARGIN;
+            if (shade->dz < 0) zmin += shade->dz*(T - 1);
+            if (shade->dzy < 0) zmin += shade->dzy*(T - 1);
+            if (zmin >= (int64_t) *wrenHiZTile(wc, tx, ty) << 16) {
+                if (start >= 0) wrenTriangleShadeSpan(wc, shade, start, x - 1, y);
+                start = -1;
+                size_t i = (x + wc.hizX)/T - row->base;
+                if (i < 64*sizeof(row->counted)/sizeof(row->counted[0]) && !(row->counted[i/64] >> i%64 & 1)) {
+                    row->counted[i/64] |= (uint64_t) 1 << i%64;
+                    row->kept[i/64] |= (uint64_t) 1 << i%64;
+                    wc.hiz->culledBlocks++;
+                }
+                z += shade->dz*(end - x + 1);
+                x = end + 1;
+                continue;
+            }
+        }
+        bool kept = false;
+        for (; x <= end; x++, z += shade->dz) {
+            if (shade->steep) z = wrenTriangleDepthAt(shade, x, y);
+            uint32_t d = z < 0 ? 0 : z > far ? UINT32_MAX : (uint32_t) (z >> 16);
+            bool pass;
+            if (depth16 != NULL) {
+                pass = d >> 16 < depth16[x];
+                if (pass) depth16[x] = d >> 16;
+            } else {
+                pass = d < depth32[x];
+                if (pass) depth32[x] = d;
+            }
+            if (pass) {
+                if (start < 0) start = x;
+                if (row != NULL && x < row->x1) row->x1 = x;
+                if (row != NULL && x > row->x2) row->x2 = x;
+            } else {
+                kept = true;
+                if (start >= 0) wrenTriangleShadeSpan(wc, shade, start, x - 1, y);
+                start = -1;
+            }
+        }
+        if (kept && row != NULL) {
+            size_t i = (end + wc.hizX)/T - row->base;
+            if (i < 64*sizeof(row->kept)/sizeof(row->kept[0])) row->kept[i/64] |= (uint64_t) 1 << i%64;
+        }
+    }
+    if (start >= 0) wrenTriangleShadeSpan(wc, shade, start, x2, y);
+}
+
+static inline void wrenTriangleWalkSpan(WrenCanvas wc, const WrenTriangleShade *shade, int64_t x1, int64_t x2, int bx1, int bx2, int y, WrenHiZRow *row) {
+    if (x1 < bx1) x1 = bx1;
+    if (x2 > bx2) x2 = bx2;
+    if (x1 > x2) return;
+    if (shade->depth) {
+        wrenTriangleDepthSpan(wc, shade, x1, x2, y, row);
+    } else if (shade->gouraud) {
+        wrenTriangleGouraudSpan(wc, shade, x1, x2, y);
+    } else {
+        wrenPaintSpan(wc, x1, y, x2 - x1 + 1, shade->color);
+    }
+}
+
+// Rasterizes a triangle with the coverage of the classic two-part scanline
+// walk: rows y1..y2 use the edges leaving vertex 1, rows y2..y3 the edges
+// leaving vertex 3, and the shared row y2 is painted once. Rows are painted
+// top to bottom. Depth tested triangles on a canvas with hierarchical depth
+// are first tested whole against the tiles of their bounding box, and keep
+// the tiles they write up to date one tile row at a time.
+static inline void wrenTriangleRaster(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, const WrenTriangleShade *shade) {
+    int bx1 = x1, bx2 = x1;
+    if (x2 < bx1) bx1 = x2;
+    if (x3 < bx1) bx1 = x3;
+    if (x2 > bx2) bx2 = x2;
+    if (x3 > bx2) bx2 = x3;
+    if (bx1 < 0) bx1 = 0;
+    if (bx2 >= (int) wc.width) bx2 = (int) wc.width - 1;
+    int by1 = y1 < 0 ? 0 : y1;
+    int by2 = y3 >= (int) wc.height ? (int) wc.height - 1 : y3;
+    if (bx1 > bx2 || by1 > by2) return;
+
+    const int T = WREN_HIZ_TILE_SIZE;
+    WrenHiZRow hiz, *row = NULL;
+    if (shade->depth && shade->coarse && wc.hiz != NULL) {
+        // Steps of a tile from the corner visit every tile of the box, and the
+        // clamped last one the tiles of its far edges.
+        uint32_t max = 0;
+        for (int ty = by1; ty < by2 + T; ty += T) {
+            for (int tx = bx1; tx < bx2 + T; tx += T) {
+                uint32_t z = *wrenHiZTile(wc, tx < bx2 ? tx : bx2, ty < by2 ? ty : by2);
+                if (z > max) max = z;
+            }
+        }
+        if (shade->zmin - WREN_HIZ_MARGIN >= (int64_t) max << 16) {
+            wc.hiz->culledTriangles++;
+            return;
+        }
+        hiz = (WrenHiZRow) { .x1 = bx2 + 1, .x2 = bx1 - 1, .base = (bx1 + wc.hizX)/T, .y = -1 };
+        row = &hiz;
+    }
+
+    WrenTriangleHalf top = wrenTriangleHalf(x1, y1, 1, x2 - x1, y2 - y1, x3 - x1, y3 - y1);
+    WrenTriangleHalf bottom = wrenTriangleHalf(x3, y3, -1, x2 - x3, y3 - y2, x1 - x3, y3 - y1);
+
+    WrenTriangleWalk w = wrenTriangleWalk(by1 <= y2 ? top : bottom, by1);
+    for (int y = by1; y <= by2; y++) {
+        int64_t sx1 = w.xl, sx2 = w.xr;
+        if (y == y2) {
+            // Switch to the bottom edges; when the two spans of the shared row
+            // neither overlap nor touch, the top one is painted on its own.
+            w = wrenTriangleWalk(bottom, y);
+            if (sx1 <= sx2 && w.xl <= w.xr && sx1 <= w.xr + 1 && w.xl <= sx2 + 1) {
+                if (w.xl < sx1) sx1 = w.xl;
+                if (w.xr > sx2) sx2 = w.xr;
+            } else {
+                wrenTriangleWalkSpan(wc, shade, sx1, sx2, bx1, bx2, y, row);
+                sx1 = w.xl, sx2 = w.xr;
+            }
+        }
+        wrenTriangleWalkSpan(wc, shade, sx1, sx2, bx1, bx2, y, row);
+        wrenTriangleWalkStep(&w);
+        if (row != NULL && (y == by2 || (y + wc.hizY)%T == (size_t) T - 1)) {
+            if (hiz.x1 <= hiz.x2) wrenHiZRefresh(wc, shade, y, &hiz);
+            hiz = (WrenHiZRow) { .x1 = bx2 + 1, .x2 = bx1 - 1, .base = hiz.base, .y = -1 };
+        }
+    }
+}
+
+// Gouraud shading of a triangle, or flat c1 when it has no area.
+static inline WrenTriangleShade wrenTriangleShading(int x1, int y1, int x2, int y2, int x3, int y3, uint32_t c1, uint32_t c2, uint32_t c3) {
+    WrenTriangleShade shade = {
+        .gouraud = true,
+        .det = (int64_t) (x1 - x3)*(y2 - y3) - (int64_t) (x2 - x3)*(y1 - y3),
+    };
+
+    if (shade.det == 0) {
+        shade.gouraud = false;
+        shade.color = c1;
+    } else {
+        // Barycentric weights u1 and u2 of vertices 1 and 2 are linear in x and
+        // y, and so is c1*u1 + c2*u2 + c3*(det - u1 - u2) for every channel.
+        for (int k = 0; k < 4; k++) {
+            int64_t d1 = (int64_t) ((c1>>(8*k))&0xFF) - ((c3>>(8*k))&0xFF);
+            int64_t d2 = (int64_t) ((c2>>(8*k))&0xFF) - ((c3>>(8*k))&0xFF);
+            WrenEdge n = {
+                .a = d1*(y2 - y3) + d2*(y3 - y1),
+                .b = d1*(x3 - x2) + d2*(x1 - x3),
+            };
+            n.c = (int64_t) ((c3>>(8*k))&0xFF)*shade.det - n.a*x3 - n.b*y3;
+            if (shade.det < 0) n.a = -n.a, n.b = -n.b, n.c = -n.c;
+            shade.n[k] = n;
+        }
+        if (shade.det < 0) shade.det = -shade.det;
+        for (int k = 0; k < 4; k++) {
+            shade.step[k] = wrenFloorDiv(shade.n[k].a, shade.det);
+            shade.rem[k] = shade.n[k].a - shade.step[k]*shade.det;
+        }
+    }
+
+    return shade;
+}
+
+// a*b/c rounded to the nearest integer for 0 < c < 2^34, |a| <= c and
+// |b| < 2^34, without forming a*b.
+static inline int64_t wrenMulDiv(int64_t a, int64_t b, int64_t c) {
+    int64_t bh = b >> 16, bl = b - bh*WREN_FIXED_ONE;
+    int64_t q = wrenFloorDiv(a*bh, c), r = a*bh - q*c;
+    return q*WREN_FIXED_ONE + wrenFloorDiv(r*WREN_FIXED_ONE + a*bl + c/2, c);
+}
+
+// A polygon vertex on its way through guard band clipping.
+typedef struct {
+    int64_t x, y;
+    uint32_t z, color;
+} WrenClipVertex;
+
+// Point where the line coordinate axis == bound crosses the edge from inside
+// vertex a to outside vertex b, with depth and color channels interpolated.
+// Cuts always start from the inside end, so an edge shared by two triangles is
+// cut at the same point in both.
+static inline WrenClipVertex wrenClipEdge(const WrenClipVertex *a, const WrenClipVertex *b, int axis, int64_t bound) {
+    int64_t d = axis ? b->y - a->y : b->x - a->x;
+    int64_t t = bound - (axis ? a->y : a->x);
+    if (d < 0) d = -d, t = -t;
+    WrenClipVertex v = {
+        .x = axis ? a->x + wrenMulDiv(t, b->x - a->x, d) : bound,
+        .y = axis ? bound : a->y + wrenMulDiv(t, b->y - a->y, d),
+        .z = (uint32_t) (a->z + wrenMulDiv(t, (int64_t) b->z - a->z, d)),
+    };
+    for (int k = 0; k < 4; k++) {
+        int64_t ca = (a->color>>(8*k))&0xFF, cb = (b->color>>(8*k))&0xFF;
+        v.color |= (uint32_t) (ca + wrenMulDiv(t, cb - ca, d)) << (8*k);
+    }
+    return v;
+}
+
+// Keeps the part of a convex polygon where sign*(coordinate - bound) <= 0
+// and returns its vertex count, at most one more than n.
+static inline size_t wrenClipPolygon(const WrenClipVertex *in, size_t n, WrenClipVertex *out, int axis, int64_t bound, int sign) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const WrenClipVertex *a = &in[i], *b = &in[(i + 1)%n];
+        bool aIn = sign*((axis ? a->y : a->x) - bound) <= 0;
+        bool bIn = sign*((axis ? b->y : b->x) - bound) <= 0;
+        if (aIn) out[m++] = *a;
+        if (aIn && !bIn) out[m++] = wrenClipEdge(a, b, axis, bound);
+        if (!aIn && bIn) out[m++] = wrenClipEdge(b, a, axis, bound);
+    }
+    return m;
+}
+
+// Median of three rows, where a triangle switches from its upper half to its
+// lower one.
+static inline int wrenMiddle(int a, int b, int c) {
+    if (a > b) WREN_SWAP(int, a, b);
+    if (b > c) b = c;
+    return a > b ? a : b;
+}
+
+static inline bool wrenInGuardBand(WrenCanvas wc, int x, int y) {
+    return x >= -WREN_GUARD_BAND && (int64_t) x <= (int64_t) wc.width + WREN_GUARD_BAND &&
+           y >= -WREN_GUARD_BAND && (int64_t) y <= (int64_t) wc.height + WREN_GUARD_BAND;
+}
+
+// Depth test setup of wrenTriangleZ on top of the shading of a triangle.
+static inline void wrenTriangleDepthShading(WrenTriangleShade *shade, int x1, int y1, uint32_t z1, int x2, int y2, uint32_t z2, int x3, int y3, uint32_t z3) {
+    shade->depth = true;
+    shade->z[0] = z1, shade->z[1] = z2, shade->z[2] = z3;
+    int64_t det = (int64_t) (x1 - x3)*(y2 - y3) - (int64_t) (x2 - x3)*(y1 - y3);
+    if (det != 0) {
+        // Weights of vertices 1 and 2, the areas of the triangles the pixel
+        // makes with the opposite edges, with det's sign dropped as in
+        // shade->det.
+        int64_t sign = det < 0 ? -1 : 1;
+        shade->w[0] = (WrenEdge) {
+            .a = sign*(y2 - y3),
+            .b = -sign*(x2 - x3),
+            .c = sign*((int64_t) (x2 - x3)*y3 - (int64_t) (y2 - y3)*x3),
+        };
+        shade->w[1] = (WrenEdge) {
+            .a = -sign*(y1 - y3),
+            .b = sign*(x1 - x3),
+            .c = sign*((int64_t) (y1 - y3)*x3 - (int64_t) (x1 - x3)*y3),
+        };
+        // Depth slopes beyond 2^32 per pixel are only met on the spans of
+        // slivers, whose pixels get their depth one by one instead.
+        int64_t d1 = (int64_t) z1 - z3, d2 = (int64_t) z2 - z3;
+        int64_t n = sign*(d1*(y2 - y3) + d2*(y3 - y1));
+        int64_t q = wrenFloorDiv(n, shade->det);
+        shade->steep = q > ((int64_t) 1 << 32) || q < -((int64_t) 1 << 32);
+        if (!shade->steep) shade->dz = wrenScaleDiv(n, shade->det, 16);
+        // The slope along y only serves culling, which steep triangles skip.
+        int64_t ny = sign*(d1*(x3 - x2) + d2*(x1 - x3));
+        q = wrenFloorDiv(ny, shade->det);
+        shade->coarse = !shade->steep && q <= ((int64_t) 1 << 32) && q >= -((int64_t) 1 << 32);
+        if (shade->coarse) shade->dzy = wrenScaleDiv(ny, shade->det, 16);
+    } else {
+        shade->coarse = true;
+    }
+    if (shade->coarse) {
+        // Pixels on the edges lie up to a pixel outside the triangle.
+        uint32_t z = z1 < z2 ? z1 : z2;
+        if (z3 < z) z = z3;
+        shade->zmin = ((int64_t) z << 16) - WREN_ABS(int64_t, shade->dz) - WREN_ABS(int64_t, shade->dzy);
+    }
+}
+
+// Edges of a polygon from vertex l1 down to l2 on the left and r1 down to r2
+// on the right, based at their upper ends when sy is 1 and at their lower ends
+// when it is -1, like the two halves of a triangle.
+static inline WrenTriangleHalf wrenPolygonHalf(const WrenClipVertex *l1, const WrenClipVertex *l2, const WrenClipVertex *r1, const WrenClipVertex *r2, int sy) {
+    if (sy < 0) {
+        WREN_SWAP(const WrenClipVertex *, l1, l2);
+        WREN_SWAP(const WrenClipVertex *, r1, r2);
+    }
+    WrenTriangleHalf half = {
+        .left = wrenTriangleEdge(l1->x, l1->y, sy, l2->x - l1->x, sy*(l2->y - l1->y), true),
+        .right = wrenTriangleEdge(r1->x, r1->y, sy, r2->x - r1->x, sy*(r2->y - r1->y), false),
+    };
+    return half;
+}
+
+// Rasterizes a convex polygon within the guard band with the coverage rules
+// of wrenTriangleRaster: its left and right chains are walked down from the
+// top vertex, rows above ysplit take the edges from their upper ends, rows
+// below from their lower ends, and row ysplit is painted once from both. A
+// triangle cut by the band and split at its middle vertex keeps the pixels of
+// its uncut edges.
+static inline void wrenPolygonRaster(WrenCanvas wc, const WrenClipVertex *v, size_t n, int64_t ysplit, const WrenTriangleShade *shade) {
+    int64_t area = 0;
+    size_t top = 0, bottom = 0;
+    for (size_t i = 0; i < n; i++) {
+        const WrenClipVertex *a = &v[i], *b = &v[(i + 1)%n];
+        area += a->x*b->y - b->x*a->y;
+        if (a->y < v[top].y || (a->y == v[top].y && a->x < v[top].x)) top = i;
+        if (a->y > v[bottom].y) bottom = i;
+    }
+
+    int64_t bx1 = v[0].x, bx2 = v[0].x;
+    for (size_t i = 1; i < n; i++) {
+        if (v[i].x < bx1) bx1 = v[i].x;
+        if (v[i].x > bx2) bx2 = v[i].x;
+    }
+    if (bx1 < 0) bx1 = 0;
+    if (bx2 >= (int64_t) wc.width) bx2 = (int64_t) wc.width - 1;
+    int64_t by1 = v[top].y < 0 ? 0 : v[top].y;
+    int64_t by2 = v[bottom].y >= (int64_t) wc.height ? (int64_t) wc.height - 1 : v[bottom].y;
+    if (bx1 > bx2 || by1 > by2) return;
+
+    // With y pointing down, going forward from the top runs down the right
+    // side of a polygon with positive area. Above the split a chain moves on
+    // to its next edge on the row past a vertex, below it on the vertex row.
+    size_t rs = area > 0 ? 1 : n - 1, ls = n - rs;
+    size_t l = top, r = top;
+    WrenTriangleWalk w = {0};
+    for (int y = by1; y <= by2; y++) {
+        int64_t sx1 = 0, sx2 = -1;
+        bool above = y <= ysplit;
+        if (above) {
+            bool changed = y == by1;
+            for (; (l + ls)%n != bottom && v[(l + ls)%n].y < y; l = (l + ls)%n) changed = true;
+            for (; (r + rs)%n != bottom && v[(r + rs)%n].y < y; r = (r + rs)%n) changed = true;
+            if (changed) w = wrenTriangleWalk(wrenPolygonHalf(&v[l], &v[(l + ls)%n], &v[r], &v[(r + rs)%n], 1), y);
+            sx1 = w.xl, sx2 = w.xr;
+        }
+        if (y >= ysplit) {
+            bool changed = y == by1 || y == ysplit;
+            for (; (l + ls)%n != bottom && v[(l + ls)%n].y <= y; l = (l + ls)%n) changed = true;
+            for (; (r + rs)%n != bottom && v[(r + rs)%n].y <= y; r = (r + rs)%n) changed = true;
+            if (changed) w = wrenTriangleWalk(wrenPolygonHalf(&v[l], &v[(l + ls)%n], &v[r], &v[(r + rs)%n], -1), y);
+            if (above && sx1 <= sx2 && w.xl <= w.xr && sx1 <= w.xr + 1 && w.xl <= sx2 + 1) {
+                if (w.xl < sx1) sx1 = w.xl;
+                if (w.xr > sx2) sx2 = w.xr;
+            } else {
+                if (above) wrenTriangleWalkSpan(wc, shade, sx1, sx2, bx1, bx2, y, NULL);
+                sx1 = w.xl, sx2 = w.xr;
+            }
+        }
+        wrenTriangleWalkSpan(wc, shade, sx1, sx2, bx1, bx2, y, NULL);
+        wrenTriangleWalkStep(&w);
+    }
+}
+
+// Draws a convex polygon with the shading of wrenTriangle, wrenTriangle3 or
+// wrenTriangleZ, first clipped to the guard band. The part inside is
+// rasterized as one piece, since the triangles of a fan would paint their
+// shared edges twice, and shaded with the plane of its largest triangle.
+// Edges cut by the band can move by up to half a pixel.
+static inline void wrenDrawPolygon(WrenCanvas wc, const WrenClipVertex *v, size_t n, int64_t ysplit, bool gouraud, bool depth) {
+    const int64_t band = WREN_GUARD_BAND;
+    WrenClipVertex a[16], b[16];
+    for (size_t i = 0; i < n; i++) a[i] = v[i];
+    n = wrenClipPolygon(a, n, b, 0, -band, -1);
+    n = wrenClipPolygon(b, n, a, 0, (int64_t) wc.width + band, 1);
+    n = wrenClipPolygon(a, n, b, 1, -band, -1);
+    n = wrenClipPolygon(b, n, a, 1, (int64_t) wc.height + band, 1);
+    if (n < 3) return;
+
+    size_t k = 1;
+    int64_t largest = 0;
+    for (size_t i = 1; i + 1 < n; i++) {
+        int64_t area = (a[i].x - a[0].x)*(a[i + 1].y - a[0].y) - (a[i + 1].x - a[0].x)*(a[i].y - a[0].y);
+        if (WREN_ABS(int64_t, area) > largest) largest = WREN_ABS(int64_t, area), k = i;
+    }
+    const WrenClipVertex *p = &a[0], *q = &a[k], *r = &a[k + 1];
+    WrenTriangleShade shade = {
+        .color = p->color,
+    };
+    if (gouraud) shade = wrenTriangleShading(p->x, p->y, q->x, q->y, r->x, r->y, p->color, q->color, r->color);
+    if (depth) {
+        wrenTriangleDepthShading(&shade, p->x, p->y, p->z, q->x, q->y, q->z, r->x, r->y, r->z);
+        // The depth bound only holds for the chosen triangle.
+        shade.coarse = false;
+    }
+    wrenPolygonRaster(wc, a, n, ysplit, &shade);
+}
+
+WRENDEF void wrenTriangle3(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t c1, uint32_t c2, uint32_t c3) {
+    if (!wrenInGuardBand(wc, x1, y1) || !wrenInGuardBand(wc, x2, y2) || !wrenInGuardBand(wc, x3, y3)) {
+        WrenClipVertex v[] = {{x1, y1, 0, c1}, {x2, y2, 0, c2}, {x3, y3, 0, c3}};
+        wrenDrawPolygon(wc, v, 3, wrenMiddle(y1, y2, y3), true, false);
+        return;
+    }
+
+    if (y1 > y2) {
+        WREN_SWAP(int, x1, x2);
+        WREN_SWAP(int, y1, y2);
+        WREN_SWAP(int, c1, c2);
+    }
+
+    if (y2 > y3) {
+        WREN_SWAP(int, x2, x3);
+        WREN_SWAP(int, y2, y3);
+        WREN_SWAP(int, c2, c3);
+    }
+    
+    if (y1 > y2) {
+        WREN_SWAP(int, x1, x2);
+        WREN_SWAP(int, y1, y2);
+        WREN_SWAP(int, c1, c2);
+    }
+
+    WrenTriangleShade shade = wrenTriangleShading(x1, y1, x2, y2, x3, y3, c1, c2, c3);
+    wrenTriangleRaster(wc, x1, y1, x2, y2, x3, y3, &shade);
+}
+
+WRENDEF void wrenTriangle(WrenCanvas wc, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t color) {
+    if (!wrenInGuardBand(wc, x1, y1) || !wrenInGuardBand(wc, x2, y2) || !wrenInGuardBand(wc, x3, y3)) {
+        WrenClipVertex v[] = {{x1, y1, 0, color}, {x2, y2, 0, color}, {x3, y3, 0, color}};
+        wrenDrawPolygon(wc, v, 3, wrenMiddle(y1, y2, y3), false, false);
+        return;
+    }
+
+    if (y1 > y2) {
+        WREN_SWAP(int, x1, x2);
+        WREN_SWAP(int, y1, y2);
+    }
+
+    if (y2 > y3) {
+        WREN_SWAP(int, x2, x3);
+        WREN_SWAP(int, y2, y3);
+    }
+    
+    if (y1 > y2) {
+        WREN_SWAP(int, x1, x2);
+        WREN_SWAP(int, y1, y2);
+    }
+
+    WrenTriangleShade shade = {
+        .gouraud = false,
+        .color = color,
+    };
+    wrenTriangleRaster(wc, x1, y1, x2, y2, x3, y3, &shade);
+}
+
+// Gouraud shaded triangle with a depth test against the canvas depth buffer:
+// depth is interpolated linearly from z1, z2 and z3, 0 being the closest.
+// Without a depth buffer this is wrenTriangle3.
+WRENDEF void wrenTriangleZ(WrenCanvas wc, int x1, int y1, uint32_t z1, int x2, int y2, uint32_t z2, int x3, int y3, uint32_t z3, uint32_t c1, uint32_t c2, uint32_t c3) {
+    if (wc.depth16 == NULL && wc.depth32 == NULL) {
+        wrenTriangle3(wc, x1, y1, x2, y2, x3, y3, c1, c2, c3);
+        return;
+    }
+
+    if (!wrenInGuardBand(wc, x1, y1) || !wrenInGuardBand(wc, x2, y2) || !wrenInGuardBand(wc, x3, y3)) {
+        WrenClipVertex v[] = {{x1, y1, z1, c1}, {x2, y2, z2, c2}, {x3, y3, z3, c3}};
+        wrenDrawPolygon(wc, v, 3, wrenMiddle(y1, y2, y3), true, true);
+        return;
+    }
+
+    if (y1 > y2) {
+        WREN_SWAP(int, x1, x2);
+        WREN_SWAP(int, y1, y2);
+        WREN_SWAP(uint32_t, z1, z2);
+        WREN_SWAP(uint32_t, c1, c2);
+    }
+
+    if (y2 > y3) {
+        WREN_SWAP(int, x2, x3);
+        WREN_SWAP(int, y2, y3);
+        WREN_SWAP(uint32_t, z2, z3);
+        WREN_SWAP(uint32_t, c2, c3);
+    }
+
+    if (y1 > y2) {
+        WREN_SWAP(int, x1, x2);
+        WREN_SWAP(int, y1, y2);
+        WREN_SWAP(uint32_t, z1, z2);
+        WREN_SWAP(uint32_t, c1, c2);
+    }
+
+    WrenTriangleShade shade = wrenTriangleShading(x1, y1, x2, y2, x3, y3, c1, c2, c3);
+    wrenTriangleDepthShading(&shade, x1, y1, z1, x2, y2, z2, x3, y3, z3);
+    wrenTriangleRaster(wc, x1, y1, x2, y2, x3, y3, &shade);
+}
+
+// Vertex index k of a mesh's index list.
+static inline size_t wrenMeshIndex(WrenMeshIndices indices, size_t k) {
+    return indices.i16 != NULL ? indices.i16[k] : indices.i32[k];
+}
+
+// Sides of the canvas a point lies beyond, one bit each.
+static inline unsigned wrenMeshOutside(WrenCanvas wc, int x, int y) {
+    return (x < 0) | (x >= (int) wc.width) << 1 | (y < 0) << 2 | (y >= (int) wc.height) << 3;
+}
+
+// Draws count indexed triangles with Gouraud shading, and a depth test when
+// the positions have depth, exactly as wrenTriangle3 or wrenTriangleZ would
+// one by one. Triangles wholly past one side of the canvas are dropped before
+// any setup.
+WRENDEF void wrenDrawMesh(WrenCanvas wc, WrenMeshPositions positions, const uint32_t *colors, WrenMeshIndices indices, size_t count) {
+    for (size_t t = 0; t < count; t++) {
+        size_t a = wrenMeshIndex(indices, 3*t), b = wrenMeshIndex(indices, 3*t + 1), c = wrenMeshIndex(indices, 3*t + 2);
+        const int *x = positions.x, *y = positions.y;
+        if ((wrenMeshOutside(wc, x[a], y[a])&wrenMeshOutside(wc, x[b], y[b])&wrenMeshOutside(wc, x[c], y[c])) != 0) continue;
+        if (positions.z != NULL) {
+            const uint32_t *z = positions.z;
+            wrenTriangleZ(wc, x[a], y[a], z[a], x[b], y[b], z[b], x[c], y[c], z[c], colors[a], colors[b], colors[c]);
+        } else {
+            wrenTriangle3(wc, x[a], y[a], x[b], y[b], x[c], y[c], colors[a], colors[b], colors[c]);
+        }
+    }
+}
+
+// Vertices wrenTransformVertices takes through the matrix at a time.
+#define WREN_TRANSFORM_BATCH 8
+
+// Clip coordinates of n <= WREN_TRANSFORM_BATCH points, clip[r][i] being row
+// r for point i in 16.16. Products are summed exactly and floored once.
+static inline void wrenTransformClip(const WrenMatrix *m, const int32_t *x, const int32_t *y, const int32_t *z, size_t n, int64_t clip[4][WREN_TRANSFORM_BATCH]) {
+    size_t i = 0;
+#if defined(WREN_SIMD_AVX2)
+    // Four points per register in 64-bit lanes. AVX2 has no 64-bit arithmetic
+    // shift, so the floor is taken on the one's complement of negative sums.
+    for (; i < (n&~(size_t) 3); i += 4) {
+        __m256i px = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *) &x[i]));
+        __m256i py = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *) &y[i]));
+        __m256i pz = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *) &z[i]));
+        for (int r = 0; r < 4; r++) {
+            const int32_t *row = &m->m[4*r];
+            __m256i sum = _mm256_add_epi64(_mm256_mul_epi32(px, _mm256_set1_epi64x(row[0])), _mm256_mul_epi32(py, _mm256_set1_epi64x(row[1])));
+            sum = _mm256_add_epi64(sum, _mm256_mul_epi32(pz, _mm256_set1_epi64x(row[2])));
+            sum = _mm256_add_epi64(sum, _mm256_set1_epi64x((int64_t) row[3]*WREN_FIXED_ONE));
+            __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), sum);
+            sum = _mm256_xor_si256(_mm256_srli_epi64(_mm256_xor_si256(sum, sign), 16), sign);
+            _mm256_storeu_si256((__m256i *) &clip[r][i], sum);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (int r = 0; r < 4; r++) {
+            const int32_t *row = &m->m[4*r];
+            clip[r][i] = ((int64_t) row[0]*x[i] + (int64_t) row[1]*y[i] + (int64_t) row[2]*z[i] + (int64_t) row[3]*WREN_FIXED_ONE) >> 16;
+        }
+    }
+}
+
+static inline int wrenCountLeadingZeros64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while ((x >> 63) == 0) x <<= 1, n++;
+    return n;
+#endif
+}
+
+// Reciprocal of w > 0 for the divide by w: w*2^shift lies in [2^30, 2^31)
+// and r is 2^62 over it, so c/w is about c*2^shift*r/2^62.
+typedef struct {
+    int64_t r;
+    int shift;
+} WrenReciprocal;
+
+// c*2^shift, floored.
+static inline int64_t wrenReciprocalScale(int64_t c, WrenReciprocal q) {
+    return q.shift >= 0 ? c*((int64_t) 1 << q.shift) : c >> -q.shift;
+}
+
+static inline WrenReciprocal wrenReciprocal(int64_t w) {
+    WrenReciprocal q = {.shift = wrenCountLeadingZeros64(w) - 33};
+    q.r = ((int64_t) 1 << 62)/wrenReciprocalScale(w, q);
+    return q;
+}
+
+// floor(c*2^s/w) from the reciprocal q of w, for s = 16 with |c| <=
+// WREN_NDC_LIMIT*w or s = 32 with 0 <= c < w. The product with q.r is
+// usually off by at most a unit; the remainder, found with multiplies in two
+// parts when w had to be scaled down, puts it right.
+static inline int64_t wrenReciprocalDiv(int64_t c, int64_t w, WrenReciprocal q, int s) {
+    // c*2^shift is under 2^43 for s = 16, so it is multiplied in two parts.
+    int64_t cs = wrenReciprocalScale(c, q), f, rem;
+    if (s == 16) {
+        int64_t hi = cs >> 21, lo = cs - hi*((int64_t) 1 << 21);
+        f = (hi*q.r + (lo*q.r >> 21)) >> 25;
+    } else {
+        f = cs*q.r >> 30;
+    }
+    if (q.shift >= 0) {
+        rem = c*((int64_t) 1 << s) - f*w;
+    } else {
+        int k = -q.shift;
+        int64_t ch = c >> k, cl = c - ch*((int64_t) 1 << k);
+        int64_t wh = w >> k, wl = w - wh*((int64_t) 1 << k);
+        rem = (ch*((int64_t) 1 << s) - f*wh)*((int64_t) 1 << k) + cl*((int64_t) 1 << s) - f*wl;
+    }
+    // A step either way is taken with masks rather than branches.
+    int64_t m = rem >> 63;
+    f += m, rem += w & m;
+    m = ~((rem - w) >> 63);
+    f -= m, rem -= w & m;
+    while (rem < 0) f--, rem += w;
+    while (rem >= w) f++, rem -= w;
+    return f;
+}
+
+// floor((c/w + 1)*size/2) for w > 0, with c/w clamped to WREN_NDC_LIMIT and
+// found in 16.16 first, from the reciprocal q of w.
+static inline int wrenProjectAxis(int64_t c, int64_t w, WrenReciprocal q, size_t size) {
+    const int64_t limit = (int64_t) WREN_NDC_LIMIT*WREN_FIXED_ONE;
+    int64_t f;
+    if (c > WREN_NDC_LIMIT*w) {
+        f = limit;
+    } else if (c < -WREN_NDC_LIMIT*w) {
+        f = -limit;
+    } else {
+        f = wrenReciprocalDiv(c, w, q, 16);
+    }
+    if (f > limit) f = limit;
+    if (f < -limit) f = -limit;
+    return (int) wrenFloorDiv((f + WREN_FIXED_ONE)*(int64_t) size, 2*WREN_FIXED_ONE);
+}
+
+// Viewport transform of clip coordinates (cx, cy, cz, cw) with cw > 0: x/w
+// and y/w from -1 to 1 span the canvas from its top left corner, and z/w
+// from 0 to 1 spans the depth range. The only division is for 1/w.
+static inline void wrenProjectVertex(WrenCanvas wc, int64_t cx, int64_t cy, int64_t cz, int64_t cw, int *sx, int *sy, uint32_t *sz) {
+    WrenReciprocal q = wrenReciprocal(cw);
+    *sx = wrenProjectAxis(cx, cw, q, wc.width);
+    *sy = wrenProjectAxis(cy, cw, q, wc.height);
+    *sz = cz <= 0 ? 0 : cz >= cw ? UINT32_MAX : (uint32_t) wrenReciprocalDiv(cz, cw, q, 32);
+}
+
+// Takes count points with 16.16 coordinates through m, divides by w and maps
+// them onto the canvas, ready for wrenTriangleZ or wrenDrawMesh. Coordinates
+// and matrix entries must stay within +-16384. Points farther out than
+// WREN_NDC_LIMIT are clamped to it. Points with w <= 0 are at or behind the
+// eye and cannot be projected; they get (0, 0) and the farthest depth, and
+// their number is returned.
+WRENDEF size_t wrenTransformVertices(WrenCanvas wc, WrenMatrix m, const int32_t *x, const int32_t *y, const int32_t *z, size_t count, int *sx, int *sy, uint32_t *sz) {
+    int64_t clip[4][WREN_TRANSFORM_BATCH];
+    size_t behind = 0;
+    for (size_t i = 0; i < count; i += WREN_TRANSFORM_BATCH) {
+        size_t n = count - i < WREN_TRANSFORM_BATCH ? count - i : WREN_TRANSFORM_BATCH;
+        wrenTransformClip(&m, &x[i], &y[i], &z[i], n, clip);
+        for (size_t k = 0; k < n; k++) {
+            if (clip[3][k] <= 0) {
+                sx[i + k] = sy[i + k] = 0;
+                sz[i + k] = UINT32_MAX;
+                behind++;
+            } else {
+                wrenProjectVertex(wc, clip[0][k], clip[1][k], clip[2][k], clip[3][k], &sx[i + k], &sy[i + k], &sz[i + k]);
+            }
+        }
+    }
+    return behind;
+}
+
+// A mesh vertex in clip coordinates on its way through near plane clipping.
+typedef struct {
+    int64_t c[4];
+    uint32_t color;
+} WrenClipPoint;
+
+// Signed distance of a point from clipping plane 0, the near plane z = 0, or
+// planes 1 to 4, x and y at WREN_NDC_LIMIT times w on either side; it is not
+// negative inside.
+static inline int64_t wrenClipDistance(const WrenClipPoint *v, int plane) {
+    if (plane == 0) return v->c[2];
+    int64_t c = v->c[(plane - 1)/2];
+    return (int64_t) WREN_NDC_LIMIT*v->c[3] + (plane%2 ? -c : c);
+}
+
+// a + (b - a)*t/2^32, floored, for |b - a| < 2^48 and 0 <= t <= 2^32.
+static inline int64_t wrenClipLerp(int64_t a, int64_t b, int64_t t) {
+    int64_t d = b - a, hi = d >> 24, lo = d - hi*((int64_t) 1 << 24);
+    return a + ((hi*t + ((lo*t) >> 24)) >> 8);
+}
+
+// Point where a clipping plane crosses the edge from inside point a, at
+// distance da >= 0, to outside point b, at distance db < 0. Like wrenClipEdge,
+// cuts start from the inside end.
+static inline WrenClipPoint wrenClipPointEdge(const WrenClipPoint *a, const WrenClipPoint *b, int64_t da, int64_t db) {
+    // The distances can reach 2^59; the cut only needs their ratio.
+    int64_t d = da - db;
+    while (d >= ((int64_t) 1 << 46)) da >>= 1, d >>= 1;
+    int64_t t = wrenScaleDiv(da, d, 32);
+    WrenClipPoint v;
+    v.color = 0;
+    for (int k = 0; k < 4; k++) v.c[k] = wrenClipLerp(a->c[k], b->c[k], t);
+    for (int k = 0; k < 4; k++) {
+        int64_t ca = (a->color>>(8*k))&0xFF, cb = (b->color>>(8*k))&0xFF;
+        v.color |= (uint32_t) (ca + (((cb - ca)*t) >> 32)) << (8*k);
+    }
+    return v;
+}
+
+// Keeps the part of a convex polygon inside a clipping plane and returns its
+// vertex count, at most one more than n.
+static inline size_t wrenClipPoints(const WrenClipPoint *in, size_t n, WrenClipPoint *out, int plane) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const WrenClipPoint *a = &in[i], *b = &in[(i + 1)%n];
+        int64_t da = wrenClipDistance(a, plane), db = wrenClipDistance(b, plane);
+        if (da >= 0) out[m++] = *a;
+        if (da >= 0 && db < 0) out[m++] = wrenClipPointEdge(a, b, da, db);
+        if (da < 0 && db >= 0) out[m++] = wrenClipPointEdge(b, a, db, da);
+    }
+    return m;
+}
+
+// A mesh vertex once transformed, with the frustum planes it lies beyond and
+// whether it needs clipping before it can be projected.
+typedef struct {
+    WrenClipPoint p;
+    int x, y;
+    uint32_t z;
+    unsigned outside;
+    bool clipped;
+} WrenProjectedVertex;
+
+// Takes the n <= WREN_TRANSFORM_BATCH vertices index[k] of a mesh through m
+// together and stores them in *out[k], projected unless they need clipping.
+static inline void wrenProjectMeshVertices(WrenCanvas wc, const WrenMatrix *m, const int32_t *x, const int32_t *y, const int32_t *z, const uint32_t *colors, const size_t *index, size_t n, WrenProjectedVertex *const *out) {
+    const int64_t g = WREN_NDC_LIMIT;
+    int32_t px[WREN_TRANSFORM_BATCH], py[WREN_TRANSFORM_BATCH], pz[WREN_TRANSFORM_BATCH];
+    for (size_t k = 0; k < n; k++) px[k] = x[index[k]], py[k] = y[index[k]], pz[k] = z[index[k]];
+    int64_t clip[4][WREN_TRANSFORM_BATCH];
+    wrenTransformClip(m, px, py, pz, n, clip);
+    for (size_t k = 0; k < n; k++) {
+        WrenProjectedVertex *e = out[k];
+        int64_t cx = clip[0][k], cy = clip[1][k], cz = clip[2][k], cw = clip[3][k];
+        e->p = (WrenClipPoint) {{cx, cy, cz, cw}, colors[index[k]]};
+        e->outside = (cx > cw) | (cx < -cw) << 1 | (cy > cw) << 2 | (cy < -cw) << 3 | (cz < 0) << 4;
+        e->clipped = cz < 0 || cw <= 0 || cx > g*cw || cx < -g*cw || cy > g*cw || cy < -g*cw;
+        if (cw > 0) wrenProjectVertex(wc, cx, cy, cz, cw, &e->x, &e->y, &e->z);
+    }
+}
+
+// Draws a triangle of transformed mesh vertices, clipped first if it needs it.
+static inline void wrenProjectTriangle(WrenCanvas wc, const WrenProjectedVertex *v0, const WrenProjectedVertex *v1, const WrenProjectedVertex *v2, bool depth) {
+    const WrenProjectedVertex *v[3] = {v0, v1, v2};
+    if ((v0->outside&v1->outside&v2->outside) != 0) return;
+    if (!v0->clipped && !v1->clipped && !v2->clipped) {
+        wrenTriangleZ(wc, v0->x, v0->y, v0->z, v1->x, v1->y, v1->z, v2->x, v2->y, v2->z, v0->p.color, v1->p.color, v2->p.color);
+        return;
+    }
+
+    WrenClipPoint a[8], b[8];
+    for (size_t k = 0; k < 3; k++) a[k] = v[k]->p;
+    size_t n = wrenClipPoints(a, 3, b, 0);
+    n = wrenClipPoints(b, n, a, 1);
+    n = wrenClipPoints(a, n, b, 2);
+    n = wrenClipPoints(b, n, a, 3);
+    n = wrenClipPoints(a, n, b, 4);
+    // Inside the side planes w >= 0, and w = 0 only at the eye.
+    bool visible = n >= 3;
+    for (size_t i = 0; i < n; i++) visible = visible && b[i].c[3] > 0;
+    if (!visible) return;
+    WrenClipVertex p[8];
+    for (size_t i = 0; i < n; i++) {
+        int px, py;
+        wrenProjectVertex(wc, b[i].c[0], b[i].c[1], b[i].c[2], b[i].c[3], &px, &py, &p[i].z);
+        p[i].x = px, p[i].y = py, p[i].color = b[i].color;
+    }
+    // Edges left whole then land on the pixels wrenTriangleZ gives them.
+    bool front = v0->p.c[3] > 0 && v1->p.c[3] > 0 && v2->p.c[3] > 0;
+    wrenDrawPolygon(wc, p, n, front ? wrenMiddle(v0->y, v1->y, v2->y) : INT64_MIN, true, depth);
+}
+
+// Draws count indexed triangles of a mesh with 16.16 coordinates taken
+// through m, as wrenTransformVertices and wrenDrawMesh would, with a depth
+// test when the canvas has a depth buffer. Triangles crossing the near plane
+// z = 0, or reaching past WREN_NDC_LIMIT, are clipped before the divide by w
+// instead of dropped or clamped, and triangles wholly outside one side of the
+// view are dropped before any setup.
+//
+// Triangles are taken a run at a time: the vertices of the run missing from
+// the cache, up to WREN_TRANSFORM_BATCH of them, are transformed together,
+// then the run is drawn. A run ends before a vertex that would evict one the
+// run still needs.
+WRENDEF void wrenProjectMesh(WrenCanvas wc, WrenMatrix m, const int32_t *x, const int32_t *y, const int32_t *z, const uint32_t *colors, WrenMeshIndices indices, size_t count) {
+    bool depth = wc.depth16 != NULL || wc.depth32 != NULL;
+    // Tags are the vertex index plus one, so that zero marks an empty slot;
+    // slots the current run uses hold its number in runs.
+    size_t tags[WREN_MESH_CACHE_SIZE], runs[WREN_MESH_CACHE_SIZE];
+    WrenProjectedVertex cache[WREN_MESH_CACHE_SIZE];
+    for (size_t i = 0; i < WREN_MESH_CACHE_SIZE; i++) tags[i] = runs[i] = 0;
+
+    size_t run = 0;
+    for (size_t t = 0; t < count;) {
+        run++;
+        size_t pending[WREN_TRANSFORM_BATCH], n = 0, end = t;
+        WrenProjectedVertex *slots[WREN_TRANSFORM_BATCH];
+        for (bool fits = true; fits && end < count; end += fits) {
+            for (size_t k = 0; fits && k < 3; k++) {
+                size_t i = wrenMeshIndex(indices, 3*end + k), slot = i%WREN_MESH_CACHE_SIZE;
+                if (tags[slot] == i + 1) {
+                    runs[slot] = run;
+                } else if (runs[slot] == run || n == WREN_TRANSFORM_BATCH) {
+                    fits = false;
+                } else {
+                    tags[slot] = i + 1;
+                    runs[slot] = run;
+                    slots[n] = &cache[slot];
+                    pending[n++] = i;
+                }
+            }
+        }
+        if (n > 0) wrenProjectMeshVertices(wc, &m, x, y, z, colors, pending, n, slots);
+
+        if (end == t) {
+            // Two vertices of the triangle share a slot, so it gets its own.
+            WrenProjectedVertex own[3];
+            size_t index[3];
+            for (size_t k = 0; k < 3; k++) index[k] = wrenMeshIndex(indices, 3*t + k), slots[k] = &own[k];
+            wrenProjectMeshVertices(wc, &m, x, y, z, colors, index, 3, slots);
+            wrenProjectTriangle(wc, &own[0], &own[1], &own[2], depth);
+            t++;
+        }
+        for (; t < end; t++) {
+            const WrenProjectedVertex *v[3];
+            for (size_t k = 0; k < 3; k++) v[k] = &cache[wrenMeshIndex(indices, 3*t + k)%WREN_MESH_CACHE_SIZE];
+            wrenProjectTriangle(wc, v[0], v[1], v[2], depth);
+        }
+    }
+}
+
+// Glyph of character c; characters without one are blank and advance by the
+// font width.
+static inline WrenGlyph wrenFontGlyph(WrenFont font, int c) {
+    if (font.glyphs != NULL) {
+        return (WrenGlyph) {
+            .width = font.width,
+            .height = font.height,
+            .advance = font.width,
+        };
+    }
+    if (c >= 0 && (size_t) c < font.count) return font.metrics[c];
+    return (WrenGlyph) {.advance = font.width};
+}
+
+static inline bool wrenGlyphCell(WrenFont font, int c, WrenGlyph g, size_t cx, size_t cy) {
+    if (font.glyphs != NULL) return font.glyphs[(c*font.height + cy)*font.width + cx] != 0;
+    size_t b = g.x + cx;
+    return (font.bits[cy*font.stride + b/32] >> b%32)&1;
+}
+
+#if WREN_GLYPH_CACHE_SLOTS > 0
+typedef struct {
+    const void *source;
+    size_t width, height, size;
+    int glyph;
+} WrenGlyphKey;
+
+// Glyph masks, with every font cell scaled up to size x size pixels. A key
+// hashes to a set of WREN_GLYPH_CACHE_WAYS slots, and the least recently used
+// slot of the set is replaced, so lookups stay constant time.
+#define WREN_GLYPH_CACHE_WAYS (WREN_GLYPH_CACHE_SLOTS < 4 ? WREN_GLYPH_CACHE_SLOTS : 4)
+#define WREN_GLYPH_CACHE_SETS (WREN_GLYPH_CACHE_SLOTS/WREN_GLYPH_CACHE_WAYS)
+
+typedef struct {
+    WrenGlyphKey keys[WREN_GLYPH_CACHE_SLOTS];   // size 0 for an empty slot
+    uint32_t used[WREN_GLYPH_CACHE_SLOTS];
+    uint32_t clock;
+    uint32_t bits[WREN_GLYPH_CACHE_SLOTS][WREN_GLYPH_CACHE_SLOT_SIZE];
+} WrenGlyphCache;
+
+static WREN_THREAD_LOCAL WrenGlyphCache wrenGlyphCache;
+
+// Mask of glyph g of character c at the given size, or a mask without bits
+// when it does not fit a cache slot.
+static inline WrenBitMask wrenGlyphMask(WrenFont font, int c, WrenGlyph g, size_t size) {
+    size_t w = g.width*size, h = g.height*size, stride = (w + 31)/32;
+    if (w == 0 || h == 0 || h > WREN_GLYPH_CACHE_SLOT_SIZE/stride) return (WrenBitMask) {0};
+
+    WrenGlyphCache *cache = &wrenGlyphCache;
+    const void *source = font.glyphs != NULL ? (const void *) font.glyphs : (const void *) font.bits;
+    uint32_t hash = ((uint32_t) c*31 + (uint32_t) size)*0x9E3779B1u ^ (uint32_t) (uintptr_t) source;
+    size_t set = (hash*0x9E3779B1u >> 16)%WREN_GLYPH_CACHE_SETS*WREN_GLYPH_CACHE_WAYS;
+    size_t slot = set;
+    for (size_t i = set; i < set + WREN_GLYPH_CACHE_WAYS; i++) {
+        const WrenGlyphKey *key = &cache->keys[i];
+        if (key->glyph == c && key->size == size && key->source == source &&
+            key->width == g.width && key->height == g.height) {
+            slot = i;
+            goto found;
+        }
+        if (cache->used[i] < cache->used[slot]) slot = i;
+    }
+
+    uint32_t *bits = cache->bits[slot];
+    for (size_t cy = 0; cy < g.height; cy++) {
+        uint32_t *row = &bits[cy*size*stride];
+        for (size_t k = 0; k < stride; k++) row[k] = 0;
+        for (size_t px = 0; px < w; px++) {
+            if (wrenGlyphCell(font, c, g, px/size, cy)) row[px/32] |= (uint32_t) 1 << px%32;
+        }
+        for (size_t k = stride; k < size*stride; k++) row[k] = row[k - stride];
+    }
+    cache->keys[slot] = (WrenGlyphKey) {
+        .source = source,
+        .width = g.width,
+        .height = g.height,
+        .size = size,
+        .glyph = c,
+    };
+
+found:
+    cache->used[slot] = ++cache->clock;
+    return wrenBitMask(cache->bits[slot], w, h, stride);
+}
+#endif
+
+// Draws the lit cells of a glyph one horizontal run at a time.
+static inline void wrenGlyphRuns(WrenCanvas wc, WrenFont font, int c, WrenGlyph g, int gx, int gy, size_t size, uint32_t color) {
+    for (size_t cy = 0; cy < g.height; cy++) {
+        for (size_t cx = 0; cx < g.width; cx++) {
+            if (!wrenGlyphCell(font, c, g, cx, cy)) continue;
+            size_t end = cx;
+            while (end + 1 < g.width && wrenGlyphCell(font, c, g, end + 1, cy)) end++;
+            wrenRect(wc, gx + cx*size, gy + cy*size, (end - cx + 1)*size, size, color);
+            cx = end;
+        }
+    }
+}
+
+// Advance adjustment from character left to character right.
+static inline int wrenKerning(WrenFont font, int left, int right) {
+    size_t lo = 0, hi = font.kerningCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        const WrenKerning *k = &font.kerning[mid];
+        if (k->left == left && k->right == right) return k->amount;
+        if (k->left < left || (k->left == left && k->right < right)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+// Draws the cells of a glyph from an 8-bit atlas as size x size squares.
+static inline void wrenGlyphCoverage(WrenCanvas wc, WrenFont font, WrenGlyph g, int gx, int gy, size_t size, uint32_t color) {
+    for (size_t cy = 0; cy < g.height; cy++) {
+        const uint8_t *row = &font.coverage[cy*font.stride + g.x];
+        for (size_t cx = 0; cx < g.width; cx++) {
+            if (row[cx] == 0) continue;
+            uint32_t alpha = WREN_ALPHA(color)*row[cx]/255;
+            wrenRect(wc, gx + cx*size, gy + cy*size, size, size, (color&0x00FFFFFF)|(alpha<<(3*8)));
+        }
+    }
+}
+
+// Glyphs of packed fonts at size 1 are stamped straight from the atlas, all
+// others from cached masks. Glyphs entirely outside the canvas are skipped
+// before they are looked up.
+static inline void wrenTextGlyph(WrenCanvas wc, WrenFont font, int c, WrenGlyph g, int gx, int gy, size_t size, uint32_t color) {
+    int gw = g.width*size, gh = g.height*size;
+    if (gw == 0 || gh == 0) return;
+    if (gx >= (int) wc.width || gx + gw <= 0 || gy >= (int) wc.height || gy + gh <= 0) return;
+
+    if (font.coverage != NULL) {
+        if (size == 1) {
+            wrenStampMask(wc, wrenMask(&font.coverage[g.x], g.width, g.height, font.stride, 255), gx, gy, color);
+        } else {
+            wrenGlyphCoverage(wc, font, g, gx, gy, size, color);
+        }
+        return;
+    }
+    if (font.glyphs == NULL && size == 1) {
+        WrenBitMask mask = wrenBitMask(font.bits, g.width, g.height, font.stride);
+        mask.offset = g.x;
+        wrenStampBits(wc, mask, gx, gy, color);
+        return;
+    }
+#if WREN_GLYPH_CACHE_SLOTS > 0
+    WrenBitMask mask = wrenGlyphMask(font, c, g, size);
+    if (mask.bits != NULL) {
+        wrenStampBits(wc, mask, gx, gy, color);
+        return;
+    }
+#endif
+    wrenGlyphRuns(wc, font, c, g, gx, gy, size, color);
+}
+
+WRENDEF void wrenText(WrenCanvas wc, const char *text, int tx, int ty, WrenFont font, size_t size, uint32_t color) {
+    if (size == 0) return;
+
+    int pen = tx, prev = -1;
+    for (; *text; text++) {
+        int c = font.glyphs != NULL ? *text : (unsigned char) *text;
+        WrenGlyph g = wrenFontGlyph(font, c);
+        if (prev >= 0 && font.kerningCount > 0) pen += wrenKerning(font, prev, c)*(int) size;
+        prev = c;
+        wrenTextGlyph(wc, font, c, g, pen + g.bearingX*(int) size, ty + g.bearingY*(int) size, size, color);
+        pen += g.advance*(int) size;
+    }
+}
+
+// Finds the end of the line of text that starts at text and fits in maxWidth
+// pixels. Lines end at '\n', after the last space that fits or, when there is
+// none, before the first character that does not, but always hold at least
+// one character. Sets *end to the end and *width to the advance width of the
+// line, without the space it breaks at, and returns the start of the next.
+static inline const char *wrenTextLine(const char *text, WrenFont font, size_t size, int maxWidth, const char **end, int *width) {
+    const char *space = NULL;
+    int pen = 0, spacePen = 0, prev = -1;
+    const char *p = text;
+    for (; *p && *p != '\n'; p++) {
+        int c = font.glyphs != NULL ? *p : (unsigned char) *p;
+        WrenGlyph g = wrenFontGlyph(font, c);
+        int next = pen + g.advance*(int) size;
+        if (prev >= 0 && font.kerningCount > 0) next += wrenKerning(font, prev, c)*(int) size;
+        if (*p == ' ') {
+            space = p, spacePen = pen;
+        } else if (next > maxWidth && p > text) {
+            if (space != NULL) {
+                *end = space, *width = spacePen;
+                return space + 1;
+            }
+            *end = p, *width = pen;
+            return p;
+        }
+        pen = next, prev = c;
+    }
+    *end = p, *width = pen;
+    return *p == '\n' ? p + 1 : p;
+}
+
+// Size of the box wrenLayoutText would lay text out in without wrapping: the
+// widest line and the height of all of them, lines being split at '\n'. Both
+// are 0 for an empty text.
+WRENDEF void wrenTextMeasure(const char *text, WrenFont font, size_t size, int *width, int *height) {
+    *width = *height = 0;
+    if (size == 0 || *text == '\0') return;
+
+    const char *end;
+    do {
+        int w;
+        text = wrenTextLine(text, font, size, INT32_MAX, &end, &w);
+        if (w > *width) *width = w;
+        *height += font.height*size;
+    } while (*end != '\0');
+}
+
+// Lays text out in the box at (x, y) of w x h pixels: lines wrap to w as in
+// wrenTextLine, stack font.height*size apart from y and are aligned within w.
+// Only glyphs with pixels inside the box are kept, so wrenDrawTextLayout never
+// looks at the others. Returns how many there are; the first capacity of them
+// go into glyphs. layout->width and layout->height receive the size of the
+// whole text, clipped or not.
+WRENDEF size_t wrenLayoutText(WrenTextLayout *layout, const char *text, int x, int y, int w, int h, WrenTextAlign align, WrenFont font, size_t size, WrenPlacedGlyph *glyphs, size_t capacity) {
+    *layout = (WrenTextLayout) {
+        .font = font,
+        .size = size,
+        .glyphs = glyphs,
+        .x = x,
+        .y = y,
+        .w = w,
+        .h = h,
+    };
+    if (size == 0 || *text == '\0' || w <= 0 || h <= 0) return 0;
+
+    size_t count = 0;
+    int top = y;
+    const char *end;
+    do {
+        int width;
+        const char *line = text;
+        text = wrenTextLine(line, font, size, w, &end, &width);
+        if (width > layout->width) layout->width = width;
+
+        int pen = x + (align == WREN_ALIGN_CENTER ? (w - width)/2 : align == WREN_ALIGN_RIGHT ? w - width : 0);
+        int prev = -1;
+        for (const char *p = line; p < end; p++) {
+            int c = font.glyphs != NULL ? *p : (unsigned char) *p;
+            WrenGlyph g = wrenFontGlyph(font, c);
+            if (prev >= 0 && font.kerningCount > 0) pen += wrenKerning(font, prev, c)*(int) size;
+            prev = c;
+            int gx = pen + g.bearingX*(int) size, gy = top + g.bearingY*(int) size;
+            int gw = g.width*size, gh = g.height*size;
+            pen += g.advance*(int) size;
+            if (gw == 0 || gh == 0) continue;
+            if (gx >= x + w || gx + gw <= x || gy >= y + h || gy + gh <= y) continue;
+            if (count < capacity) glyphs[count] = (WrenPlacedGlyph) {gx, gy, c};
+            count++;
+        }
+        top += font.height*size;
+    } while (*end != '\0');
+
+    layout->height = top - y;
+    layout->count = count < capacity ? count : capacity;
+    return count;
+}
+
+// Draws the glyphs of a layout clipped to its box.
+WRENDEF void wrenDrawTextLayout(WrenCanvas wc, const WrenTextLayout *layout, uint32_t color) {
+    int x1, x2, y1, y2;
+    if (!wrenNormalizeRect(layout->x, layout->y, layout->w, layout->h, wc.width, wc.height, &x1, &x2, &y1, &y2)) return;
+
+    WrenCanvas box = wrenSubcanvas(wc, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+    for (size_t i = 0; i < layout->count; i++) {
+        WrenPlacedGlyph p = layout->glyphs[i];
+        wrenTextGlyph(box, layout->font, p.c, wrenFontGlyph(layout->font, p.c), p.x - x1, p.y - y1, layout->size, color);
+    }
+}
+
+// Inclusive bounds of the pixels wrenText may touch, or the pixel at (x, y)
+// when it touches none.
+static inline WrenRect wrenTextBounds(const char *text, int x, int y, WrenFont font, size_t size) {
+    WrenRect r = {x, y, x, y};
+    bool empty = true;
+    int pen = x, prev = -1;
+    for (; *text && size > 0; text++) {
+        int c = font.glyphs != NULL ? *text : (unsigned char) *text;
+        WrenGlyph g = wrenFontGlyph(font, c);
+        if (prev >= 0 && font.kerningCount > 0) pen += wrenKerning(font, prev, c)*(int) size;
+        prev = c;
+        int gx = pen + g.bearingX*(int) size, gy = y + g.bearingY*(int) size;
+        int gw = g.width*size, gh = g.height*size;
+        pen += g.advance*(int) size;
+        if (gw == 0 || gh == 0) continue;
+        if (empty || gx < r.x1) r.x1 = gx;
+        if (empty || gy < r.y1) r.y1 = gy;
+        if (empty || gx + gw - 1 > r.x2) r.x2 = gx + gw - 1;
+        if (empty || gy + gh - 1 > r.y2) r.y2 = gy + gh - 1;
+        empty = false;
+    }
+    return r;
+}
+
+// Little-endian word at data[i].
+static inline uint32_t wrenReadU32(const uint8_t *data, size_t i) {
+    return data[i] | (uint32_t) data[i + 1] << 8 | (uint32_t) data[i + 2] << 16 | (uint32_t) data[i + 3] << 24;
+}
+
+// Packs the glyphs of the PC Screen Font 2 in data that have a character code
+// below count into a 1-bit atlas. metrics receives count glyphs and bits the
+// atlas. Returns the number of words the atlas needs, which makes the font
+// usable when it is at most capacity, or 0 when data is not a valid font.
+// Characters are Unicode code points through the font's table when it has
+// one, glyph indices otherwise.
+WRENDEF size_t wrenLoadPSF2(WrenFont *font, const uint8_t *data, size_t size, WrenGlyph *metrics, size_t count, uint32_t *bits, size_t capacity) {
+    if (size < 32 || wrenReadU32(data, 0) != 0x864AB572) return 0;
+    uint32_t headerSize = wrenReadU32(data, 8), flags = wrenReadU32(data, 12);
+    uint32_t glyphCount = wrenReadU32(data, 16), glyphSize = wrenReadU32(data, 20);
+    uint32_t height = wrenReadU32(data, 24), width = wrenReadU32(data, 28);
+    size_t rowSize = (width + 7)/8;
+    if (width == 0 || width > 0xFFFF || height == 0 || height > 0xFFFF || glyphSize < rowSize*height) return 0;
+    if (headerSize > size || (size - headerSize)/glyphSize < glyphCount) return 0;
+
+    // Glyph index of every character first, kept in x until the layout.
+    for (size_t c = 0; c < count; c++) metrics[c] = (WrenGlyph) {.x = UINT32_MAX, .advance = width};
+    if (flags&1) {
+        size_t i = headerSize + (size_t) glyphCount*glyphSize;
+        for (uint32_t glyph = 0; glyph < glyphCount && i < size; glyph++) {
+            // UTF-8 code points up to 0xFF; sequences after 0xFE are skipped.
+            bool sequence = false;
+            while (i < size && data[i] != 0xFF) {
+                uint8_t b = data[i];
+                if (b == 0xFE) {
+                    sequence = true;
+                    i++;
+                    continue;
+                }
+                size_t n = b < 0x80 ? 1 : b < 0xE0 ? 2 : b < 0xF0 ? 3 : 4;
+                uint32_t cp = n == 1 ? b : b&(0xFF >> (n + 1));
+                for (size_t k = 1; k < n && i + k < size; k++) cp = cp << 6 | (data[i + k]&0x3F);
+                if (!sequence && cp < count && metrics[cp].x == UINT32_MAX) metrics[cp].x = glyph;
+                i += n;
+            }
+            i++;
+        }
+    } else {
+        for (size_t c = 0; c < count && c < glyphCount; c++) metrics[c].x = c;
+    }
+
+    uint32_t x = 0;
+    for (size_t c = 0; c < count; c++) {
+        if (metrics[c].x == UINT32_MAX) {
+            metrics[c].x = 0;
+            continue;
+        }
+        metrics[c].width = width;
+        metrics[c].height = height;
+        x += width;
+    }
+    size_t stride = (x + 31)/32, needed = stride*height;
+    *font = (WrenFont) {
+        .width = width,
+        .height = height,
+        .metrics = metrics,
+        .count = count,
+        .bits = bits,
+        .stride = stride,
+    };
+    if (needed == 0 || needed > capacity) return needed;
+
+    for (size_t i = 0; i < needed; i++) bits[i] = 0;
+    x = 0;
+    for (size_t c = 0; c < count; c++) {
+        if (metrics[c].width == 0) continue;
+        const uint8_t *glyph = &data[headerSize + (size_t) metrics[c].x*glyphSize];
+        metrics[c].x = x;
+        for (size_t y = 0; y < height; y++) {
+            for (size_t px = 0; px < width; px++) {
+                if ((glyph[y*rowSize + px/8] >> (7 - px%8))&1) bits[y*stride + (x + px)/32] |= (uint32_t) 1 << (x + px)%32;
+            }
+        }
+        x += width;
+    }
+    return needed;
+}
+
+// Reader of the lines of a BDF font.
+typedef struct {
+    const char *p, *end;
+} WrenBDF;
+
+// Consumes word when the current line starts with it.
+static inline bool wrenBDFKeyword(WrenBDF *bdf, const char *word) {
+    const char *p = bdf->p;
+    for (; *word; word++, p++) {
+        if (p == bdf->end || *p != *word) return false;
+    }
+    if (p != bdf->end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') return false;
+    bdf->p = p;
+    return true;
+}
+
+static inline int wrenBDFInt(WrenBDF *bdf) {
+    while (bdf->p != bdf->end && (*bdf->p == ' ' || *bdf->p == '\t')) bdf->p++;
+    bool negative = bdf->p != bdf->end && *bdf->p == '-';
+    if (negative) bdf->p++;
+    int n = 0;
+    while (bdf->p != bdf->end && *bdf->p >= '0' && *bdf->p <= '9' && n < 100000) n = n*10 + (*bdf->p++ - '0');
+    return negative ? -n : n;
+}
+
+static inline void wrenBDFNextLine(WrenBDF *bdf) {
+    while (bdf->p != bdf->end && *bdf->p++ != '\n') {}
+}
+
+static inline int wrenHexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Goes over the glyphs of a BDF font, laying out those with a character code
+// below count. The first pass fills metrics and returns the atlas width; the
+// second one, with bits set, draws the bitmaps into the atlas.
+static inline uint32_t wrenBDFGlyphs(WrenBDF bdf, int ascent, WrenGlyph *metrics, size_t count, uint32_t *bits, size_t stride) {
+    uint32_t x = 0;
+    int code = -1, advance = 0, w = 0, h = 0, xoff = 0, yoff = 0;
+    while (bdf.p != bdf.end) {
+        if (wrenBDFKeyword(&bdf, "STARTCHAR")) {
+            code = -1, advance = 0, w = 0, h = 0, xoff = 0, yoff = 0;
+        } else if (wrenBDFKeyword(&bdf, "ENCODING")) {
+            code = wrenBDFInt(&bdf);
+        } else if (wrenBDFKeyword(&bdf, "DWIDTH")) {
+            advance = wrenBDFInt(&bdf);
+        } else if (wrenBDFKeyword(&bdf, "BBX")) {
+            w = wrenBDFInt(&bdf), h = wrenBDFInt(&bdf);
+            xoff = wrenBDFInt(&bdf), yoff = wrenBDFInt(&bdf);
+            if (w < 0 || w > 0xFFFF) w = 0;
+            if (h < 0 || h > 0xFFFF) h = 0;
+        } else if (wrenBDFKeyword(&bdf, "BITMAP")) {
+            if (code < 0 || (size_t) code >= count) continue;
+            WrenGlyph *g = &metrics[code];
+            if (bits == NULL) {
+                *g = (WrenGlyph) {
+                    .x = x,
+                    .width = w,
+                    .height = h,
+                    .bearingX = xoff,
+                    .bearingY = ascent - yoff - h,
+                    .advance = advance,
+                };
+            } else if (g->x == x) {
+                // Later glyphs with the same code replace this one.
+                wrenBDFNextLine(&bdf);
+                for (int y = 0; y < h && bdf.p != bdf.end; y++) {
+                    for (int px = 0; bdf.p != bdf.end && wrenHexDigit(*bdf.p) >= 0; px += 4, bdf.p++) {
+                        int digit = wrenHexDigit(*bdf.p);
+                        for (int k = 0; k < 4; k++) {
+                            if (px + k >= w || !((digit >> (3 - k))&1)) continue;
+                            uint32_t b = x + px + k;
+                            bits[y*stride + b/32] |= (uint32_t) 1 << b%32;
+                        }
+                    }
+                    wrenBDFNextLine(&bdf);
+                }
+                x += w;
+                continue;
+            }
+            x += w;
+        }
+        wrenBDFNextLine(&bdf);
+    }
+    return x;
+}
+
+// Packs the glyphs of the BDF font in data that have an encoding below count
+// into a 1-bit atlas, with the same contract as wrenLoadPSF2.
+WRENDEF size_t wrenLoadBDF(WrenFont *font, const char *data, size_t size, WrenGlyph *metrics, size_t count, uint32_t *bits, size_t capacity) {
+    WrenBDF bdf = {data, data + size};
+    if (!wrenBDFKeyword(&bdf, "STARTFONT")) return 0;
+
+    // Font metrics come before the first glyph.
+    int boxWidth = 0, boxHeight = 0, boxYoff = 0, ascent = -1, descent = -1;
+    while (bdf.p != bdf.end && !wrenBDFKeyword(&bdf, "CHARS")) {
+        if (wrenBDFKeyword(&bdf, "FONTBOUNDINGBOX")) {
+            boxWidth = wrenBDFInt(&bdf), boxHeight = wrenBDFInt(&bdf);
+            wrenBDFInt(&bdf), boxYoff = wrenBDFInt(&bdf);
+        } else if (wrenBDFKeyword(&bdf, "FONT_ASCENT")) {
+            ascent = wrenBDFInt(&bdf);
+        } else if (wrenBDFKeyword(&bdf, "FONT_DESCENT")) {
+            descent = wrenBDFInt(&bdf);
+        }
+        wrenBDFNextLine(&bdf);
+    }
+    if (bdf.p == bdf.end || boxWidth <= 0 || boxHeight <= 0) return 0;
+    if (ascent < 0 || descent < 0) ascent = boxHeight + boxYoff, descent = -boxYoff;
+
+    for (size_t c = 0; c < count; c++) metrics[c] = (WrenGlyph) {.advance = boxWidth};
+    uint32_t width = wrenBDFGlyphs(bdf, ascent, metrics, count, NULL, 0);
+    size_t height = 0;
+    for (size_t c = 0; c < count; c++) {
+        if (metrics[c].height > height) height = metrics[c].height;
+    }
+    size_t stride = (width + 31)/32, needed = stride*height;
+    *font = (WrenFont) {
+        .width = boxWidth,
+        .height = ascent + descent,
+        .metrics = metrics,
+        .count = count,
+        .bits = bits,
+        .stride = stride,
+    };
+    if (needed == 0 || needed > capacity) return needed;
+
+    for (size_t i = 0; i < needed; i++) bits[i] = 0;
+    wrenBDFGlyphs(bdf, ascent, metrics, count, bits, stride);
+    return needed;
+}
+
+// Tables of a TrueType font that wrenLoadTrueType reads, as offsets into data.
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    uint32_t cmap, loca, glyf, hmtx, kern;
+    uint32_t cmapFormat, unitsPerEm, glyphCount, metricCount;
+    int32_t ascent, descent, lineGap;
+    bool longLoca;
+} WrenTrueType;
+
+// Big-endian unsigned integer of n bytes at offset, 0 past the end.
+static inline uint32_t wrenTTRead(const WrenTrueType *tt, size_t offset, size_t n) {
+    if (offset > tt->size || tt->size - offset < n) return 0;
+    uint32_t v = 0;
+    for (size_t i = 0; i < n; i++) v = v << 8 | tt->data[offset + i];
+    return v;
+}
+
+static inline int32_t wrenTTInt16(const WrenTrueType *tt, size_t offset) {
+    return (int16_t) wrenTTRead(tt, offset, 2);
+}
+
+static inline bool wrenTrueTypeInit(WrenTrueType *tt, const uint8_t *data, size_t size) {
+    *tt = (WrenTrueType) {.data = data, .size = size};
+    uint32_t version = wrenTTRead(tt, 0, 4);
+    if (version != 0x00010000 && version != 0x74727565) return false;
+
+    uint32_t head = 0, hhea = 0, maxp = 0;
+    for (uint32_t i = 0, n = wrenTTRead(tt, 4, 2); i < n; i++) {
+        size_t record = 12 + 16*(size_t) i;
+        uint32_t tag = wrenTTRead(tt, record, 4), offset = wrenTTRead(tt, record + 8, 4);
+        if (offset >= size) continue;
+        switch (tag) {
+        case 0x636D6170: tt->cmap = offset; break;   // cmap
+        case 0x6C6F6361: tt->loca = offset; break;   // loca
+        case 0x676C7966: tt->glyf = offset; break;   // glyf
+        case 0x686D7478: tt->hmtx = offset; break;   // hmtx
+        case 0x6B65726E: tt->kern = offset; break;   // kern
+        case 0x68656164: head = offset; break;       // head
+        case 0x68686561: hhea = offset; break;       // hhea
+        case 0x6D617870: maxp = offset; break;       // maxp
+        }
+    }
+    if (!tt->cmap || !tt->loca || !tt->glyf || !tt->hmtx || !head || !hhea || !maxp) return false;
+
+    tt->unitsPerEm = wrenTTRead(tt, head + 18, 2);
+    tt->longLoca = wrenTTInt16(tt, head + 50) != 0;
+    tt->glyphCount = wrenTTRead(tt, maxp + 4, 2);
+    tt->ascent = wrenTTInt16(tt, hhea + 4);
+    tt->descent = wrenTTInt16(tt, hhea + 6);
+    tt->lineGap = wrenTTInt16(tt, hhea + 8);
+    tt->metricCount = wrenTTRead(tt, hhea + 34, 2);
+    if (tt->unitsPerEm == 0 || tt->metricCount == 0) return false;
+
+    // Unicode subtable: format 12 covers every plane, format 4 the first.
+    uint32_t cmap = tt->cmap, best = 0;
+    for (uint32_t i = 0, n = wrenTTRead(tt, cmap + 2, 2); i < n; i++) {
+        uint32_t platform = wrenTTRead(tt, cmap + 4 + 8*i, 2), encoding = wrenTTRead(tt, cmap + 6 + 8*i, 2);
+        uint32_t offset = cmap + wrenTTRead(tt, cmap + 8 + 8*i, 4);
+        uint32_t format = wrenTTRead(tt, offset, 2);
+        bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+        if (!unicode || (format != 4 && format != 12)) continue;
+        if (best == 0 || format == 12) best = offset, tt->cmapFormat = format;
+    }
+    tt->cmap = best;
+    return best != 0;
+}
+
+// Glyph index of code point c, 0 for the missing glyph.
+static inline uint32_t wrenTrueTypeGlyph(const WrenTrueType *tt, uint32_t c) {
+    uint32_t t = tt->cmap;
+    if (tt->cmapFormat == 12) {
+        for (uint32_t i = 0, n = wrenTTRead(tt, t + 12, 4); i < n && i < tt->size/12; i++) {
+            uint32_t group = t + 16 + 12*i;
+            uint32_t start = wrenTTRead(tt, group, 4), end = wrenTTRead(tt, group + 4, 4);
+            if (c >= start && c <= end) return wrenTTRead(tt, group + 8, 4) + (c - start);
+        }
+        return 0;
+    }
+
+    uint32_t segments = wrenTTRead(tt, t + 6, 2)/2;
+    uint32_t ends = t + 14, starts = ends + 2*segments + 2;
+    uint32_t deltas = starts + 2*segments, ranges = deltas + 2*segments;
+    for (uint32_t i = 0; i < segments; i++) {
+        if (c > wrenTTRead(tt, ends + 2*i, 2)) continue;
+        uint32_t start = wrenTTRead(tt, starts + 2*i, 2);
+        if (c < start) return 0;
+        uint32_t delta = wrenTTRead(tt, deltas + 2*i, 2), range = wrenTTRead(tt, ranges + 2*i, 2);
+        if (range == 0) return (c + delta)&0xFFFF;
+        uint32_t glyph = wrenTTRead(tt, ranges + 2*i + range + 2*(c - start), 2);
+        return glyph == 0 ? 0 : (glyph + delta)&0xFFFF;
+    }
+    return 0;
+}
+
+// Offset of the outline of glyph in data, or 0 when it has none.
+static inline uint32_t wrenTrueTypeOutlineAt(const WrenTrueType *tt, uint32_t glyph) {
+    if (glyph >= tt->glyphCount) return 0;
+    uint32_t start, end;
+    if (tt->longLoca) {
+        start = wrenTTRead(tt, tt->loca + 4*glyph, 4), end = wrenTTRead(tt, tt->loca + 4*glyph + 4, 4);
+    } else {
+        start = 2*wrenTTRead(tt, tt->loca + 2*glyph, 2), end = 2*wrenTTRead(tt, tt->loca + 2*glyph + 2, 2);
+    }
+    if (start >= end || end > tt->size - tt->glyf) return 0;
+    return tt->glyf + start;
+}
+
+// Horizontal kerning in font units from format 0 'kern' subtables.
+static inline int32_t wrenTrueTypeKerning(const WrenTrueType *tt, uint32_t left, uint32_t right) {
+    if (tt->kern == 0 || wrenTTRead(tt, tt->kern, 2) != 0) return 0;
+    int32_t amount = 0;
+    uint32_t table = tt->kern + 4;
+    for (uint32_t i = 0, n = wrenTTRead(tt, tt->kern + 2, 2); i < n; i++) {
+        uint32_t length = wrenTTRead(tt, table + 2, 2), coverage = wrenTTRead(tt, table + 4, 2);
+        if ((coverage&0xFF07) == 0x0001) {
+            // Pairs are sorted by (left << 16) | right.
+            uint32_t key = left << 16 | right, lo = 0, hi = wrenTTRead(tt, table + 6, 2);
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo)/2, pair = table + 14 + 6*mid;
+                uint32_t k = wrenTTRead(tt, pair, 4);
+                if (k == key) {
+                    amount += wrenTTInt16(tt, pair + 4);
+                    break;
+                }
+                if (k < key) lo = mid + 1; else hi = mid;
+            }
+        }
+        if (length < 6) break;
+        table += length;
+    }
+    return amount;
+}
+
+// Coverage of one pixel row of a glyph. Outline coordinates are in 1/256
+// pixels from the top left of the glyph box, and acc gathers the signed area
+// of every outline piece in the row in units of 1/65536 pixels, spread over
+// the pixel the piece crosses and the one after it, so that its prefix sums
+// are the coverage. budget bounds the points and parts a row walks, since
+// composites of damaged fonts can nest into huge trees.
+typedef struct {
+    const WrenTrueType *tt;
+    int64_t pixels;
+    int64_t ox, oy;   // glyph box origin in pixels, y down
+    int32_t width, row;
+    int32_t *acc;
+    uint32_t budget;
+} WrenOutlineRow;
+
+#define WREN_TRUETYPE_BUDGET (1 << 16)
+
+static inline void wrenOutlineLine(WrenOutlineRow *o, int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+    int64_t top = (int64_t) o->row*256, bottom = top + 256;
+    if (y0 == y1 || (y0 <= top && y1 <= top) || (y0 >= bottom && y1 >= bottom)) return;
+
+    int64_t dir = y0 < y1 ? 1 : -1;
+    if (y0 > y1) {
+        WREN_SWAP(int64_t, x0, x1);
+        WREN_SWAP(int64_t, y0, y1);
+    }
+    int64_t ys = y0 < top ? top : y0, ye = y1 > bottom ? bottom : y1;
+    int64_t xs = x0 + wrenFloorDiv((x1 - x0)*(ys - y0), y1 - y0);
+    int64_t xe = x0 + wrenFloorDiv((x1 - x0)*(ye - y0), y1 - y0);
+    int64_t limit = (int64_t) o->width*256;
+    if (xs < 0) xs = 0;
+    if (xe < 0) xe = 0;
+    if (xs > limit) xs = limit;
+    if (xe > limit) xe = limit;
+
+    // Split at pixel boundaries, left to right, stepping y along.
+    if (xs > xe) {
+        WREN_SWAP(int64_t, xs, xe);
+        WREN_SWAP(int64_t, ys, ye);
+    }
+    int64_t px = xs, py = ys;
+    while (true) {
+        int64_t cell = px >> 8;
+        int64_t nx = (cell + 1)*256 < xe ? (cell + 1)*256 : xe;
+        int64_t ny = xe == xs ? ye : ys + wrenFloorDiv((ye - ys)*(nx - xs), xe - xs);
+        int64_t d = WREN_ABS(int64_t, ny - py)*dir;
+        int64_t mid = (px + nx)/2 - cell*256;
+        o->acc[cell] += (int32_t) (d*(256 - mid));
+        o->acc[cell + 1] += (int32_t) (d*mid);
+        if (nx >= xe) break;
+        px = nx, py = ny;
+    }
+}
+
+// Flattens a quadratic curve into enough lines to stay within about 1/8
+// pixel of it.
+static inline void wrenOutlineQuad(WrenOutlineRow *o, int64_t x0, int64_t y0, int64_t x1, int64_t y1, int64_t x2, int64_t y2) {
+    int64_t top = (int64_t) o->row*256, bottom = top + 256;
+    if ((y0 <= top && y1 <= top && y2 <= top) || (y0 >= bottom && y1 >= bottom && y2 >= bottom)) return;
+
+    int64_t dd = WREN_ABS(int64_t, x0 - 2*x1 + x2) + WREN_ABS(int64_t, y0 - 2*y1 + y2);
+    int64_t n = 1 + wrenIsqrt(dd >> 8);
+    if (n > 32) n = 32;
+    int64_t px = x0, py = y0;
+    for (int64_t i = 1; i <= n; i++) {
+        int64_t j = n - i;
+        int64_t nx = wrenFloorDiv(x0*j*j + 2*x1*i*j + x2*i*i, n*n);
+        int64_t ny = wrenFloorDiv(y0*j*j + 2*y1*i*j + y2*i*i, n*n);
+        wrenOutlineLine(o, px, py, nx, ny);
+        px = nx, py = ny;
+    }
+}
+
+// Composite glyphs place their parts with x' = (a*x + c*y)/16384 + e and
+// y' = (b*x + d*y)/16384 + f in font units.
+typedef struct {
+    int64_t a, b, c, d, e, f;
+} WrenOutlineTransform;
+
+// Walks the outline of glyph through the row, in font units transformed by
+// m. Points are streamed from the flag and coordinate arrays, and off-curve
+// points between two others get the implied on-curve point in between.
+static inline void wrenOutlineGlyph(WrenOutlineRow *o, uint32_t glyph, WrenOutlineTransform m, int depth) {
+    const WrenTrueType *tt = o->tt;
+    uint32_t at = wrenTrueTypeOutlineAt(tt, glyph);
+    if (at == 0) return;
+    int32_t contours = wrenTTInt16(tt, at);
+
+    if (contours < 0) {
+        if (depth >= 4) return;
+        uint32_t p = at + 10, flags;
+        do {
+            if (o->budget == 0) return;
+            o->budget--;
+            flags = wrenTTRead(tt, p, 2);
+            uint32_t part = wrenTTRead(tt, p + 2, 2);
+            p += 4;
+            int64_t dx = 0, dy = 0;
+            if (flags&0x0001) {
+                dx = wrenTTInt16(tt, p), dy = wrenTTInt16(tt, p + 2);
+                p += 4;
+            } else {
+                dx = (int8_t) wrenTTRead(tt, p, 1), dy = (int8_t) wrenTTRead(tt, p + 1, 1);
+                p += 2;
+            }
+            if (!(flags&0x0002)) dx = dy = 0;   // points matched by index are not supported
+            WrenOutlineTransform t = {16384, 0, 0, 16384, dx, dy};
+            if (flags&0x0008) {
+                t.a = t.d = wrenTTInt16(tt, p);
+                p += 2;
+            } else if (flags&0x0040) {
+                t.a = wrenTTInt16(tt, p), t.d = wrenTTInt16(tt, p + 2);
+                p += 4;
+            } else if (flags&0x0080) {
+                t.a = wrenTTInt16(tt, p), t.b = wrenTTInt16(tt, p + 2);
+                t.c = wrenTTInt16(tt, p + 4), t.d = wrenTTInt16(tt, p + 6);
+                p += 8;
+            }
+            WrenOutlineTransform n = {
+                .a = wrenFloorDiv(m.a*t.a + m.c*t.b, 16384),
+                .b = wrenFloorDiv(m.b*t.a + m.d*t.b, 16384),
+                .c = wrenFloorDiv(m.a*t.c + m.c*t.d, 16384),
+                .d = wrenFloorDiv(m.b*t.c + m.d*t.d, 16384),
+                .e = wrenFloorDiv(m.a*t.e + m.c*t.f, 16384) + m.e,
+                .f = wrenFloorDiv(m.b*t.e + m.d*t.f, 16384) + m.f,
+            };
+            wrenOutlineGlyph(o, part, n, depth + 1);
+        } while ((flags&0x0020) && p < tt->size);
+        return;
+    }
+
+    uint32_t points = contours == 0 ? 0 : wrenTTRead(tt, at + 10 + 2*(contours - 1), 2) + 1;
+    uint32_t flagAt = at + 12 + 2*contours + wrenTTRead(tt, at + 10 + 2*contours, 2);
+
+    // Sizes of the flag and x arrays give the start of the x and y arrays.
+    uint32_t p = flagAt, xSize = 0;
+    for (uint32_t i = 0; i < points && p < tt->size;) {
+        uint32_t flag = wrenTTRead(tt, p++, 1), repeat = 1;
+        if (flag&8) repeat += wrenTTRead(tt, p++, 1);
+        uint32_t size = flag&2 ? 1 : flag&16 ? 0 : 2;
+        for (uint32_t k = 0; k < repeat && i < points; k++, i++) xSize += size;
+    }
+    uint32_t xAt = p, yAt = xAt + xSize;
+
+    uint32_t flagsLeft = 0, flag = 0, contour = 0;
+    uint32_t contourEnd = wrenTTRead(tt, at + 10, 2);
+    int64_t x = 0, y = 0;
+    bool started = false, haveFirstControl = false, haveControl = false;
+    int64_t sx = 0, sy = 0, cx = 0, cy = 0, fx = 0, fy = 0, qx = 0, qy = 0;
+    p = flagAt;
+    if (points > o->budget) return;
+    o->budget -= points;
+    for (uint32_t i = 0; i < points; i++) {
+        if (flagsLeft == 0) {
+            flag = wrenTTRead(tt, p++, 1);
+            flagsLeft = 1;
+            if (flag&8) flagsLeft += wrenTTRead(tt, p++, 1);
+        }
+        flagsLeft--;
+        if (flag&2) {
+            int64_t v = wrenTTRead(tt, xAt++, 1);
+            x += flag&16 ? v : -v;
+        } else if (!(flag&16)) {
+            x += wrenTTInt16(tt, xAt), xAt += 2;
+        }
+        if (flag&4) {
+            int64_t v = wrenTTRead(tt, yAt++, 1);
+            y += flag&32 ? v : -v;
+        } else if (!(flag&32)) {
+            y += wrenTTInt16(tt, yAt), yAt += 2;
+        }
+
+        // To pixels: 1/256 units, y down, relative to the glyph box.
+        int64_t ux = wrenFloorDiv(m.a*x + m.c*y, 16384) + m.e;
+        int64_t uy = wrenFloorDiv(m.b*x + m.d*y, 16384) + m.f;
+        int64_t px = wrenFloorDiv(ux*o->pixels*256, tt->unitsPerEm) - o->ox*256;
+        int64_t py = wrenFloorDiv(-uy*o->pixels*256, tt->unitsPerEm) - o->oy*256;
+        bool on = flag&1;
+
+        if (!started) {
+            if (on) {
+                sx = qx = px, sy = qy = py;
+                started = true;
+            } else if (!haveFirstControl) {
+                fx = px, fy = py;
+                haveFirstControl = true;
+            } else {
+                sx = qx = (fx + px)/2, sy = qy = (fy + py)/2;
+                cx = px, cy = py;
+                started = haveControl = true;
+            }
+        } else if (on) {
+            if (haveControl) {
+                wrenOutlineQuad(o, qx, qy, cx, cy, px, py);
+            } else {
+                wrenOutlineLine(o, qx, qy, px, py);
+            }
+            qx = px, qy = py;
+            haveControl = false;
+        } else {
+            if (haveControl) {
+                int64_t mx = (cx + px)/2, my = (cy + py)/2;
+                wrenOutlineQuad(o, qx, qy, cx, cy, mx, my);
+                qx = mx, qy = my;
+            }
+            cx = px, cy = py;
+            haveControl = true;
+        }
+
+        if (i == contourEnd) {
+            if (started) {
+                if (haveFirstControl) {
+                    if (haveControl) {
+                        int64_t mx = (cx + fx)/2, my = (cy + fy)/2;
+                        wrenOutlineQuad(o, qx, qy, cx, cy, mx, my);
+                        qx = mx, qy = my;
+                    }
+                    wrenOutlineQuad(o, qx, qy, fx, fy, sx, sy);
+                } else if (haveControl) {
+                    wrenOutlineQuad(o, qx, qy, cx, cy, sx, sy);
+                } else {
+                    wrenOutlineLine(o, qx, qy, sx, sy);
+                }
+            }
+            started = haveFirstControl = haveControl = false;
+            if (++contour < (uint32_t) contours) contourEnd = wrenTTRead(tt, at + 10 + 2*contour, 2);
+        }
+    }
+}
+
+static inline int64_t wrenRoundDiv(int64_t n, int64_t d) {
+    return wrenFloorDiv(2*n + d, 2*d);
+}
+
+// Rasterizes the TrueType font in data with an em of pixels pixels. The glyphs
+// of the characters below count, which are Unicode code points, go into an
+// 8-bit atlas, and their metrics into metrics. Horizontal kerning between
+// them is rounded to whole pixels and kept in kerning, up to kerningCapacity
+// pairs. Returns the number of atlas bytes needed, with the same contract as
+// wrenLoadPSF2. Only quadratic outlines ('glyf') are read and there is no
+// hinting.
+WRENDEF size_t wrenLoadTrueType(WrenFont *font, const uint8_t *data, size_t size, size_t pixels, WrenGlyph *metrics, size_t count, WrenKerning *kerning, size_t kerningCapacity, uint8_t *atlas, size_t capacity) {
+    WrenTrueType tt;
+    if (pixels == 0 || pixels > 0x7FFF || !wrenTrueTypeInit(&tt, data, size)) return 0;
+    int64_t em = tt.unitsPerEm, px = pixels;
+
+    // Boxes and advances first; glyph indices wait in x until the layout.
+    uint32_t width = 0, height = 0;
+    int64_t ascent = wrenRoundDiv(tt.ascent*px, em);
+    for (size_t c = 0; c < count; c++) {
+        uint32_t glyph = wrenTrueTypeGlyph(&tt, c);
+        uint32_t metric = glyph < tt.metricCount ? glyph : tt.metricCount - 1;
+        int64_t advance = wrenRoundDiv(wrenTTRead(&tt, tt.hmtx + 4*metric, 2)*px, em);
+        metrics[c] = (WrenGlyph) {.x = glyph, .advance = advance};
+        uint32_t at = wrenTrueTypeOutlineAt(&tt, glyph);
+        if (glyph == 0 || at == 0) continue;
+
+        int64_t x0 = wrenFloorDiv(wrenTTInt16(&tt, at + 2)*px, em), y0 = wrenFloorDiv(-wrenTTInt16(&tt, at + 8)*px, em);
+        int64_t x1 = -wrenFloorDiv(-wrenTTInt16(&tt, at + 6)*px, em), y1 = -wrenFloorDiv(wrenTTInt16(&tt, at + 4)*px, em);
+        if (x1 <= x0 || y1 <= y0 || x1 - x0 > WREN_TRUETYPE_MAX_WIDTH || y1 - y0 > 0x7FFF) continue;
+        metrics[c].width = x1 - x0;
+        metrics[c].height = y1 - y0;
+        metrics[c].bearingX = x0;
+        metrics[c].bearingY = y0 + ascent;
+        width += x1 - x0;
+        if (y1 - y0 > height) height = y1 - y0;
+    }
+
+    size_t space = count > ' ' ? (size_t) metrics[' '].advance : (size_t) px/2;
+    *font = (WrenFont) {
+        .width = space,
+        .height = wrenRoundDiv((tt.ascent - tt.descent + tt.lineGap)*px, em),
+        .metrics = metrics,
+        .count = count,
+        .coverage = atlas,
+        .stride = width,
+        .kerning = kerning,
+    };
+
+    // Pairs come out sorted since left and right are walked in order.
+    for (size_t left = 0; left < count && tt.kern != 0; left++) {
+        if (metrics[left].advance == 0 && metrics[left].width == 0) continue;
+        for (size_t right = 0; right < count; right++) {
+            int32_t units = wrenTrueTypeKerning(&tt, metrics[left].x, metrics[right].x);
+            int64_t amount = units == 0 ? 0 : wrenRoundDiv(units*px, em);
+            if (amount == 0 || font->kerningCount == kerningCapacity) continue;
+            kerning[font->kerningCount++] = (WrenKerning) {left, right, amount};
+        }
+    }
+
+    size_t needed = (size_t) width*height;
+    if (needed == 0 || needed > capacity) return needed;
+
+    int32_t acc[WREN_TRUETYPE_MAX_WIDTH + 2];
+    uint32_t x = 0;
+    for (size_t c = 0; c < count; c++) {
+        WrenGlyph *g = &metrics[c];
+        uint32_t glyph = g->x;
+        g->x = x;
+        for (size_t y = 0; y < height; y++) {
+            for (size_t i = 0; i < g->width; i++) atlas[y*width + x + i] = 0;
+        }
+        if (g->width == 0) continue;
+
+        WrenOutlineRow o = {
+            .tt = &tt,
+            .pixels = px,
+            .ox = g->bearingX,
+            .oy = g->bearingY - ascent,
+            .width = g->width,
+            .acc = acc,
+        };
+        for (o.row = 0; o.row < g->height; o.row++) {
+            for (size_t i = 0; i < (size_t) g->width + 2; i++) acc[i] = 0;
+            o.budget = WREN_TRUETYPE_BUDGET;
+            wrenOutlineGlyph(&o, glyph, (WrenOutlineTransform) {16384, 0, 0, 16384, 0, 0}, 0);
+            int64_t sum = 0;
+            uint8_t *row = &atlas[o.row*width + x];
+            for (size_t i = 0; i < g->width; i++) {
+                sum += acc[i];
+                int64_t v = WREN_ABS(int64_t, sum);
+                if (v > 65536) v = 65536;
+                row[i] = (v*255 + 32768) >> 16;
+            }
+        }
+        x += g->width;
+    }
+    return needed;
+}
+
+// Nearest neighbour scaling: destination pixel (x, y) takes source pixel
+// (x*src.width/dst.width, y*src.height/dst.height). Both quotients are stepped
+// exactly with their remainders instead of divided per pixel, unscaled rows
+// are copied whole and destination rows that repeat a source row copy the row
+// above them.
+WRENDEF void wrenCopy(WrenCanvas src, WrenCanvas dst) {
+    if (dst.width == 0 || dst.height == 0) return;
+
+    size_t dxq = src.width/dst.width, dxr = src.width%dst.width;
+    size_t dyq = src.height/dst.height, dyr = src.height%dst.height;
+    size_t ny = 0, ry = 0, prev = 0;
+    for (size_t y = 0; y < dst.height; y++) {
+        uint32_t *row = &WREN_PIXEL(dst, 0, y);
+        if (y > 0 && ny == prev) {
+            wrenCopySpan(row, row - dst.stride, dst.width);
+        } else if (src.width == dst.width) {
+            wrenCopySpan(row, &WREN_PIXEL(src, 0, ny), dst.width);
+        } else {
+            const uint32_t *srcRow = &WREN_PIXEL(src, 0, ny);
+            size_t nx = 0, rx = 0;
+            for (size_t x = 0; x < dst.width; x++) {
+                row[x] = srcRow[nx];
+                nx += dxq;
+                rx += dxr;
+                if (rx >= dst.width) {
+                    rx -= dst.width;
+                    nx += 1;
+                }
+            }
+        }
+
+        prev = ny;
+        ny += dyq;
+        ry += dyr;
+        if (ry >= dst.height) {
+            ry -= dst.height;
+            ny += 1;
+        }
+    }
+}
+
+// Source row y of a bilinear blit resampled horizontally. Column x of the
+// destination samples between source pixels map[x] >> 8 and the one after it
+// with weight map[x]&0xFF on the latter.
+static inline void wrenBilinearRow(WrenCanvas src, size_t y, const uint32_t *map, uint32_t *out, size_t n) {
+    const uint32_t *row = &WREN_PIXEL(src, 0, y);
+    for (size_t x = 0; x < n; x++) {
+        size_t i = map[x] >> 8;
+        uint32_t f = map[x]&0xFF;
+        uint32_t a = row[i], b = row[i + 1 < src.width ? i + 1 : i];
+        out[4*x + 0] = WREN_RED(a)*(256 - f) + WREN_RED(b)*f;
+        out[4*x + 1] = WREN_GREEN(a)*(256 - f) + WREN_GREEN(b)*f;
+        out[4*x + 2] = WREN_BLUE(a)*(256 - f) + WREN_BLUE(b)*f;
+        out[4*x + 3] = WREN_ALPHA(a)*(256 - f) + WREN_ALPHA(b)*f;
+    }
+}
+
+// Source position of destination pixel center i in 1/256 pixels, clamped to
+// the source: ((i + 1/2)*from/to - 1/2)*256, rounded.
+static inline uint32_t wrenBilinearAt(size_t i, size_t from, size_t to) {
+    int64_t u = (int64_t) (((2*(uint64_t) i + 1)*from*128 + to/2)/to) - 128;
+    if (u < 0) u = 0;
+    if (u > ((int64_t) from - 1)*256) u = ((int64_t) from - 1)*256;
+    return (uint32_t) u;
+}
+
+// Bilinear resampling of src onto dst. The scratch buffer holds
+// WREN_RESAMPLE_SCRATCH(dst.width) pixels: a column map and the two source
+// rows around the current destination row, resampled horizontally. Each
+// source row is resampled once however many destination rows use it.
+WRENDEF void wrenCopyBilinear(WrenCanvas src, WrenCanvas dst, uint32_t *scratch) {
+    if (src.width == 0 || src.height == 0 || dst.width == 0 || dst.height == 0) return;
+
+    size_t n = dst.width;
+    uint32_t *map = scratch;
+    uint32_t *top = scratch + n, *bottom = scratch + 5*n;
+    size_t topRow = SIZE_MAX, bottomRow = SIZE_MAX;
+    for (size_t x = 0; x < n; x++) map[x] = wrenBilinearAt(x, src.width, dst.width);
+
+    for (size_t y = 0; y < dst.height; y++) {
+        uint32_t v = wrenBilinearAt(y, src.height, dst.height);
+        size_t j0 = v >> 8, j1 = j0 + 1 < src.height ? j0 + 1 : j0;
+        uint32_t g = v&0xFF;
+
+        if (topRow != j0) {
+            if (bottomRow == j0) {
+                WREN_SWAP(uint32_t *, top, bottom);
+                bottomRow = topRow;
+            } else {
+                wrenBilinearRow(src, j0, map, top, n);
+            }
+            topRow = j0;
+        }
+        if (bottomRow != j1) {
+            wrenBilinearRow(src, j1, map, bottom, n);
+            bottomRow = j1;
+        }
+
+        uint32_t *row = &WREN_PIXEL(dst, 0, y);
+        for (size_t x = 0; x < n; x++) {
+            uint32_t c[4];
+            for (int k = 0; k < 4; k++) {
+                c[k] = (top[4*x + k]*(256 - g) + bottom[4*x + k]*g + 32768) >> 16;
+            }
+            row[x] = WREN_RGBA(c[0], c[1], c[2], c[3]);
+        }
+    }
+}
+
+// Source row y of a box filtered blit averaged over the source columns under
+// each destination pixel, as 16-bit channels. Destination pixel x covers
+// [x*sw, (x + 1)*sw) and source pixel i covers [i*dw, (i + 1)*dw) in units of
+// 1/(sw*dw) of the row, so the weights are exact integers. The averages are
+// taken with the reciprocal ceil(2^32/sw), which is exact for whole source
+// pixels and otherwise at most one 16-bit step low.
+static inline void wrenBoxRow(WrenCanvas src, size_t y, uint32_t *out, size_t n) {
+    const uint32_t *row = &WREN_PIXEL(src, 0, y);
+    size_t sw = src.width;
+    uint64_t inv = (((uint64_t) 1 << 32) + sw - 1)/sw;
+    size_t i = 0, edge = n, pos = 0;
+    for (size_t x = 0; x < n; x++) {
+        size_t end = pos + sw;
+        uint32_t sum[4] = {0}, whole[4] = {0};
+
+        // Source pixel i, of which only [pos, edge) is left, may be cut by
+        // either end of the destination pixel; those in between weigh n.
+        if (pos + n != edge || edge > end) {
+            size_t stop = edge < end ? edge : end;
+            uint32_t c = row[i], w = stop - pos;
+            sum[0] += WREN_RED(c)*w;
+            sum[1] += WREN_GREEN(c)*w;
+            sum[2] += WREN_BLUE(c)*w;
+            sum[3] += WREN_ALPHA(c)*w;
+            pos = stop;
+            if (pos == edge) {
+                i += 1;
+                edge += n;
+            }
+        }
+        for (; edge <= end; i++, edge += n) {
+            uint32_t c = row[i];
+            whole[0] += WREN_RED(c);
+            whole[1] += WREN_GREEN(c);
+            whole[2] += WREN_BLUE(c);
+            whole[3] += WREN_ALPHA(c);
+            pos = edge;
+        }
+        if (pos < end) {
+            uint32_t c = row[i], w = end - pos;
+            sum[0] += WREN_RED(c)*w;
+            sum[1] += WREN_GREEN(c)*w;
+            sum[2] += WREN_BLUE(c)*w;
+            sum[3] += WREN_ALPHA(c)*w;
+            pos = end;
+        }
+        for (int k = 0; k < 4; k++) out[4*x + k] = ((sum[k] + whole[k]*n)*inv) >> 24;
+    }
+}
+
+// Area averaging of src onto dst: every destination pixel is the mean of the
+// source area it covers, weighted by overlap. Meant for downscaling, where it
+// does not alias like wrenCopy and wrenCopyBilinear. The scratch buffer holds
+// WREN_RESAMPLE_SCRATCH(dst.width) pixels: one source row resampled
+// horizontally and the column sums of the destination row. Source heights
+// are limited to 65535 pixels.
+WRENDEF void wrenCopyBox(WrenCanvas src, WrenCanvas dst, uint32_t *scratch) {
+    if (src.width == 0 || src.height == 0 || dst.width == 0 || dst.height == 0) return;
+
+    size_t n = dst.width, sh = src.height, dh = dst.height;
+    uint32_t *h = scratch, *sums = scratch + 4*n;
+    size_t hRow = SIZE_MAX;
+    uint64_t inv = (((uint64_t) 1 << 32) + sh - 1)/sh;
+
+    // Rows are weighted like columns: destination row y covers
+    // [y*sh, (y + 1)*sh) and source row j covers [j*dh, (j + 1)*dh).
+    size_t j = 0, edge = dh, pos = 0;
+    for (size_t y = 0; y < dh; y++) {
+        size_t end = pos + sh;
+        for (size_t k = 0; k < 4*n; k++) sums[k] = 0;
+        while (pos < end) {
+            size_t stop = edge < end ? edge : end;
+            uint32_t w = stop - pos;
+            if (hRow != j) {
+                wrenBoxRow(src, j, h, n);
+                hRow = j;
+            }
+            for (size_t k = 0; k < 4*n; k++) sums[k] += h[k]*w;
+            pos = stop;
+            if (pos == edge) {
+                j += 1;
+                edge += dh;
+            }
+        }
+
+        // Rounds sums/(sh*256) with the reciprocal ceil(2^32/sh).
+        uint32_t *row = &WREN_PIXEL(dst, 0, y);
+        for (size_t x = 0; x < n; x++) {
+            uint32_t c[4];
+            for (int k = 0; k < 4; k++) c[k] = ((sums[4*x + k] + (uint64_t) sh*128)*inv) >> 40;
+            row[x] = WREN_RGBA(c[0], c[1], c[2], c[3]);
+        }
+    }
+}
+
+WRENDEF WrenCommandBuffer wrenCommandBuffer(WrenCommand *commands, size_t capacity) {
+    WrenCommandBuffer cb = {
+        .commands = commands,
+        .count = 0,
+        .capacity = capacity,
+    };
+
+    return cb;
+}
+
+// Command buffer that owns copies of its text, for keeping a frame around and
+// diffing the next one against it.
+WRENDEF WrenCommandBuffer wrenDisplayList(WrenCommand *commands, size_t capacity, char *chars, size_t charCapacity) {
+    WrenCommandBuffer cb = wrenCommandBuffer(commands, capacity);
+    cb.chars = chars;
+    cb.charCapacity = charCapacity;
+    return cb;
+}
+
+WRENDEF void wrenClearCommands(WrenCommandBuffer *cb) {
+    cb->count = 0;
+    cb->charCount = 0;
+}
+
+static inline WrenCommand *wrenPushCommand(WrenCommandBuffer *cb, WrenCommandKind kind, int x1, int y1, int x2, int y2) {
+    if (cb->count >= cb->capacity) return NULL;
+    WrenCommand *cmd = &cb->commands[cb->count++];
+    *cmd = (WrenCommand) {
+        .kind = kind,
+        .x1 = x1 < x2 ? x1 : x2,
+        .y1 = y1 < y2 ? y1 : y2,
+        .x2 = x1 < x2 ? x2 : x1,
+        .y2 = y1 < y2 ? y2 : y1,
+    };
+    return cmd;
+}
+
+WRENDEF bool wrenRecordFill(WrenCommandBuffer *cb, uint32_t color) {
+    WrenCommand *cmd = wrenPushCommand(cb, WREN_COMMAND_FILL, 0, 0, 0, 0);
+    if (cmd == NULL) return false;
+    cmd->colors[0] = color;
+    return true;
+}
+
+WRENDEF bool wrenRecordRect(WrenCommandBuffer *cb, int x, int y, int w, int h, uint32_t color) {
+    int x2 = x + WREN_SIGN(int, w)*(WREN_ABS(int, w) - 1);
+    int y2 = y + WREN_SIGN(int, h)*(WREN_ABS(int, h) - 1);
+    WrenCommand *cmd = wrenPushCommand(cb, WREN_COMMAND_RECT, x, y, x2, y2);
+    if (cmd == NULL) return false;
+    cmd->args[0] = x;
+    cmd->args[1] = y;
+    cmd->args[2] = w;
+    cmd->args[3] = h;
+    cmd->colors[0] = color;
+    return true;
+}
+
+WRENDEF bool wrenRecordCircle(WrenCommandBuffer *cb, int cx, int cy, int r, uint32_t color) {
+    int r1 = WREN_ABS(int, r) + 1;
+    WrenCommand *cmd = wrenPushCommand(cb, WREN_COMMAND_CIRCLE, cx - r1, cy - r1, cx + r1, cy + r1);
+    if (cmd == NULL) return false;
+    cmd->args[0] = cx;
+    cmd->args[1] = cy;
+    cmd->args[2] = r;
+    cmd->colors[0] = color;
+    return true;
+}
+
+WRENDEF bool wrenRecordLine(WrenCommandBuffer *cb, int x1, int y1, int x2, int y2, uint32_t color) {
+    // A column of the line reaches the row of the next column, which can be
+    // up to |dy/dx| rows past the endpoint.
+    int dx = WREN_ABS(int, x2 - x1);
+    int overshoot = dx != 0 ? WREN_ABS(int, y2 - y1)/dx + 1 : 0;
+    int ylo = y1 < y2 ? y1 : y2;
+    int yhi = y1 < y2 ? y2 : y1;
+    WrenCommand *cmd = wrenPushCommand(cb, WREN_COMMAND_LINE, x1, ylo - overshoot, x2, yhi + overshoot);
+    if (cmd == NULL) return false;
+    cmd->args[0] = x1;
+    cmd->args[1] = y1;
+    cmd->args[2] = x2;
+    cmd->args[3] = y2;
+    cmd->colors[0] = color;
+    return true;
+}
+
+WRENDEF bool wrenRecordTriangle3(WrenCommandBuffer *cb, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t c1, uint32_t c2, uint32_t c3) {
+    int bx1 = x1 < x2 ? x1 : x2, bx2 = x1 < x2 ? x2 : x1;
+    int by1 = y1 < y2 ? y1 : y2, by2 = y1 < y2 ? y2 : y1;
+    if (x3 < bx1) bx1 = x3;
+    if (x3 > bx2) bx2 = x3;
+    if (y3 < by1) by1 = y3;
+    if (y3 > by2) by2 = y3;
+    WrenCommand *cmd = wrenPushCommand(cb, WREN_COMMAND_TRIANGLE3, bx1, by1, bx2, by2);
+    if (cmd == NULL) return false;
+    cmd->args[0] = x1;
+    cmd->args[1] = y1;
+    cmd->args[2] = x2;
+    cmd->args[3] = y2;
+    cmd->args[4] = x3;
+    cmd->args[5] = y3;
+    cmd->colors[0] = c1;
+    cmd->colors[1] = c2;
+    cmd->colors[2] = c3;
+    return true;
+}
+
+WRENDEF bool wrenRecordTriangle(WrenCommandBuffer *cb, int x1, int y1, int x2, int y2, int x3, int y3, uint32_t color) {
+    if (!wrenRecordTriangle3(cb, x1, y1, x2, y2, x3, y3, color, color, color)) return false;
+    cb->commands[cb->count - 1].kind = WREN_COMMAND_TRIANGLE;
+    return true;
+}
+
+WRENDEF bool wrenRecordText(WrenCommandBuffer *cb, const char *text, int x, int y, WrenFont font, size_t size, uint32_t color) {
+    size_t n = 0;
+    while (text[n]) n++;
+    if (cb->chars != NULL) {
+        if (cb->count >= cb->capacity || cb->charCapacity - cb->charCount < n + 1) return false;
+        char *copy = &cb->chars[cb->charCount];
+        for (size_t i = 0; i <= n; i++) copy[i] = text[i];
+        cb->charCount += n + 1;
+        text = copy;
+    }
+    WrenRect r = wrenTextBounds(text, x, y, font, size);
+    WrenCommand *cmd = wrenPushCommand(cb, WREN_COMMAND_TEXT, r.x1, r.y1, r.x2, r.y2);
+    if (cmd == NULL) return false;
+    cmd->args[0] = x;
+    cmd->args[1] = y;
+    cmd->colors[0] = color;
+    cmd->text = text;
+    cmd->font = font;
+    cmd->size = size;
+    return true;
+}
+
+// Runs a command with its coordinates moved by (dx, dy). Every primitive
+// gives the same pixels when the canvas and the coordinates are translated
+// together, which is what makes tiles match immediate mode.
+WRENDEF void wrenRunCommand(WrenCanvas wc, const WrenCommand *cmd, int dx, int dy) {
+    const int *a = cmd->args;
+    const uint32_t *c = cmd->colors;
+    switch (cmd->kind) {
+    case WREN_COMMAND_FILL:
+        wrenFill(wc, c[0]);
+        break;
+    case WREN_COMMAND_RECT:
+        wrenRect(wc, a[0] + dx, a[1] + dy, a[2], a[3], c[0]);
+        break;
+    case WREN_COMMAND_CIRCLE:
+        wrenCircle(wc, a[0] + dx, a[1] + dy, a[2], c[0]);
+        break;
+    case WREN_COMMAND_LINE:
+        wrenLine(wc, a[0] + dx, a[1] + dy, a[2] + dx, a[3] + dy, c[0]);
+        break;
+    case WREN_COMMAND_TRIANGLE:
+        wrenTriangle(wc, a[0] + dx, a[1] + dy, a[2] + dx, a[3] + dy, a[4] + dx, a[5] + dy, c[0]);
+        break;
+    case WREN_COMMAND_TRIANGLE3:
+        wrenTriangle3(wc, a[0] + dx, a[1] + dy, a[2] + dx, a[3] + dy, a[4] + dx, a[5] + dy, c[0], c[1], c[2]);
+        break;
+    case WREN_COMMAND_TEXT:
+        wrenText(wc, cmd->text, a[0] + dx, a[1] + dy, cmd->font, cmd->size, c[0]);
+        break;
+    }
+}
+
+WRENDEF void wrenReplay(WrenCanvas wc, const WrenCommandBuffer *cb) {
+    for (size_t i = 0; i < cb->count; i++) {
+        wrenRunCommand(wc, &cb->commands[i], 0, 0);
+    }
+}
+
+static inline bool wrenCommandTouches(const WrenCommand *cmd, WrenRect rect) {
+    if (cmd->kind == WREN_COMMAND_FILL) return true;
+    return cmd->x2 >= rect.x1 && cmd->y2 >= rect.y1 && cmd->x1 <= rect.x2 && cmd->y1 <= rect.y2;
+}
+
+// Replays only the pixels inside rect, skipping commands that cannot touch it.
+// Nothing is cleared first: lists that start with an opaque wrenRecordFill
+// redraw the rect from scratch.
+WRENDEF void wrenReplayRect(WrenCanvas wc, const WrenCommandBuffer *cb, WrenRect rect) {
+    WrenCanvas sub = wrenSubcanvas(wc, rect.x1, rect.y1, rect.x2 - rect.x1 + 1, rect.y2 - rect.y1 + 1);
+    if (sub.pixels == NULL) return;
+    if (rect.x1 < 0) rect.x1 = 0;
+    if (rect.y1 < 0) rect.y1 = 0;
+
+    for (size_t i = 0; i < cb->count; i++) {
+        const WrenCommand *cmd = &cb->commands[i];
+        if (wrenCommandTouches(cmd, rect)) wrenRunCommand(sub, cmd, -rect.x1, -rect.y1);
+    }
+}
+
+WRENDEF bool wrenCommandEqual(const WrenCommand *a, const WrenCommand *b) {
+    if (a->kind != b->kind) return false;
+    for (size_t i = 0; i < sizeof(a->args)/sizeof(a->args[0]); i++) {
+        if (a->args[i] != b->args[i]) return false;
+    }
+    for (size_t i = 0; i < sizeof(a->colors)/sizeof(a->colors[0]); i++) {
+        if (a->colors[i] != b->colors[i]) return false;
+    }
+    if (a->kind != WREN_COMMAND_TEXT) return true;
+
+    if (a->size != b->size) return false;
+    if (a->font.width != b->font.width || a->font.height != b->font.height || a->font.glyphs != b->font.glyphs) return false;
+    if (a->font.metrics != b->font.metrics || a->font.count != b->font.count || a->font.bits != b->font.bits) return false;
+    if (a->font.coverage != b->font.coverage || a->font.kerning != b->font.kerning || a->font.kerningCount != b->font.kerningCount) return false;
+    const char *s = a->text, *t = b->text;
+    while (*s && *s == *t) s++, t++;
+    return *s == *t;
+}
+
+// Adds the part of r that lies on the canvas. Replaying does not clear, so
+// the rects are kept disjoint: r absorbs every rect it overlaps, and the
+// union is checked again since it can reach further ones. Returns false when
+// the rects do not fit in capacity.
+static inline bool wrenAddDirtyRect(WrenCanvas wc, WrenRect *rects, size_t *count, size_t capacity, WrenRect r) {
+    if (r.x1 < 0) r.x1 = 0;
+    if (r.y1 < 0) r.y1 = 0;
+    if (r.x2 >= (int) wc.width) r.x2 = (int) wc.width - 1;
+    if (r.y2 >= (int) wc.height) r.y2 = (int) wc.height - 1;
+    if (r.x1 > r.x2 || r.y1 > r.y2) return true;
+
+    for (size_t i = 0; i < *count;) {
+        WrenRect u = rects[i];
+        if (r.x1 > u.x2 || r.y1 > u.y2 || u.x1 > r.x2 || u.y1 > r.y2) {
+            i++;
+            continue;
+        }
+        if (u.x1 < r.x1) r.x1 = u.x1;
+        if (u.y1 < r.y1) r.y1 = u.y1;
+        if (u.x2 > r.x2) r.x2 = u.x2;
+        if (u.y2 > r.y2) r.y2 = u.y2;
+        rects[i] = rects[--*count];
+        i = 0;
+    }
+
+    if (*count == capacity) return false;
+    rects[(*count)++] = r;
+    return true;
+}
+
+static inline bool wrenAddDirtyCommand(WrenCanvas wc, WrenRect *rects, size_t *count, size_t capacity, const WrenCommand *cmd) {
+    WrenRect r = {cmd->x1, cmd->y1, cmd->x2, cmd->y2};
+    if (cmd->kind == WREN_COMMAND_FILL) {
+        r = (WrenRect) {0, 0, (int) wc.width - 1, (int) wc.height - 1};
+    }
+    return wrenAddDirtyRect(wc, rects, count, capacity, r);
+}
+
+// Computes the rects of wc where replaying next gives different pixels than
+// replaying prev, and returns how many were written to rects. Commands are
+// matched after the common prefix and suffix are stripped, pairwise by
+// position; each mismatched pair dirties the bounds of both commands.
+// Outside those bounds the same commands run in the same order, so the
+// pixels there cannot have changed. The rects are disjoint, so each can be
+// redrawn with wrenReplayRect. When they do not fit in capacity, the result
+// is a single rect covering the canvas, counted even when capacity is 0 so
+// that 0 always means nothing changed.
+WRENDEF size_t wrenDiffCommands(WrenCanvas wc, const WrenCommandBuffer *prev, const WrenCommandBuffer *next, WrenRect *rects, size_t capacity) {
+    size_t count = 0;
+    size_t head = 0;
+    while (head < prev->count && head < next->count && wrenCommandEqual(&prev->commands[head], &next->commands[head])) {
+        head++;
+    }
+
+    size_t tail = 0;
+    while (tail < prev->count - head && tail < next->count - head &&
+           wrenCommandEqual(&prev->commands[prev->count - 1 - tail], &next->commands[next->count - 1 - tail])) {
+        tail++;
+    }
+
+    size_t n = prev->count - head - tail;
+    size_t m = next->count - head - tail;
+    for (size_t i = 0; i < n || i < m; i++) {
+        const WrenCommand *a = i < n ? &prev->commands[head + i] : NULL;
+        const WrenCommand *b = i < m ? &next->commands[head + i] : NULL;
+        if (a != NULL && b != NULL && wrenCommandEqual(a, b)) continue;
+        bool fits = true;
+        if (a != NULL) fits = wrenAddDirtyCommand(wc, rects, &count, capacity, a);
+        if (b != NULL && fits) fits = wrenAddDirtyCommand(wc, rects, &count, capacity, b);
+        if (!fits) {
+            if (capacity > 0) rects[0] = (WrenRect) {0, 0, (int) wc.width - 1, (int) wc.height - 1};
+            return 1;
+        }
+    }
+
+    return count;
+}
+
+WRENDEF WrenBins wrenBins(uint32_t *starts, uint32_t *entries, size_t capacity) {
+    WrenBins bins = {
+        .starts = starts,
+        .entries = entries,
+        .capacity = capacity,
+    };
+
+    return bins;
+}
+
+// Tile range [tx1, tx2]x[ty1, ty2] covered by the bounds of a command.
+static inline bool wrenCommandTiles(const WrenBins *bins, const WrenCommand *cmd, size_t *tx1, size_t *tx2, size_t *ty1, size_t *ty2) {
+    if (cmd->kind == WREN_COMMAND_FILL) {
+        *tx1 = 0, *tx2 = bins->columns - 1;
+        *ty1 = 0, *ty2 = bins->rows - 1;
+        return true;
+    }
+
+    int width = bins->columns*WREN_TILE_SIZE;
+    int height = bins->rows*WREN_TILE_SIZE;
+    if (cmd->x2 < 0 || cmd->y2 < 0 || cmd->x1 >= width || cmd->y1 >= height) return false;
+    *tx1 = cmd->x1 < 0 ? 0 : (size_t) cmd->x1/WREN_TILE_SIZE;
+    *ty1 = cmd->y1 < 0 ? 0 : (size_t) cmd->y1/WREN_TILE_SIZE;
+    *tx2 = cmd->x2 >= width ? bins->columns - 1 : (size_t) cmd->x2/WREN_TILE_SIZE;
+    *ty2 = cmd->y2 >= height ? bins->rows - 1 : (size_t) cmd->y2/WREN_TILE_SIZE;
+    return true;
+}
+
+// Counting sort of the commands into their tiles, which keeps every tile in
+// recording order.
+WRENDEF void wrenBinCommands(WrenBins *bins, WrenCanvas wc, const WrenCommandBuffer *cb) {
+    bins->columns = (wc.width + WREN_TILE_SIZE - 1)/WREN_TILE_SIZE;
+    bins->rows = (wc.height + WREN_TILE_SIZE - 1)/WREN_TILE_SIZE;
+    size_t tiles = bins->columns*bins->rows;
+
+    for (size_t i = 0; i <= tiles; i++) bins->starts[i] = 0;
+
+    size_t total = 0;
+    for (size_t i = 0; i < cb->count; i++) {
+        size_t tx1, tx2, ty1, ty2;
+        if (!wrenCommandTiles(bins, &cb->commands[i], &tx1, &tx2, &ty1, &ty2)) continue;
+        for (size_t ty = ty1; ty <= ty2; ty++) {
+            for (size_t tx = tx1; tx <= tx2; tx++) {
+                bins->starts[ty*bins->columns + tx + 1] += 1;
+            }
+        }
+        total += (tx2 - tx1 + 1)*(ty2 - ty1 + 1);
+    }
+
+    bins->overflow = total > bins->capacity;
+    if (bins->overflow) return;
+
+    for (size_t i = 0; i < tiles; i++) bins->starts[i + 1] += bins->starts[i];
+
+    // starts[i] is used as the write cursor of tile i and ends up at the start
+    // of tile i + 1, so shift everything back by one afterwards.
+    for (size_t i = 0; i < cb->count; i++) {
+        size_t tx1, tx2, ty1, ty2;
+        if (!wrenCommandTiles(bins, &cb->commands[i], &tx1, &tx2, &ty1, &ty2)) continue;
+        for (size_t ty = ty1; ty <= ty2; ty++) {
+            for (size_t tx = tx1; tx <= tx2; tx++) {
+                bins->entries[bins->starts[ty*bins->columns + tx]++] = i;
+            }
+        }
+    }
+    for (size_t i = tiles; i > 0; i--) bins->starts[i] = bins->starts[i - 1];
+    bins->starts[0] = 0;
+}
+
+WRENDEF void wrenRenderTile(WrenCanvas wc, const WrenCommandBuffer *cb, const WrenBins *bins, size_t tile) {
+    int tx = (tile%bins->columns)*WREN_TILE_SIZE;
+    int ty = (tile/bins->columns)*WREN_TILE_SIZE;
+    WrenCanvas sub = wrenSubcanvas(wc, tx, ty, WREN_TILE_SIZE, WREN_TILE_SIZE);
+    if (sub.pixels == NULL) return;
+
+    if (bins->overflow) {
+        WrenRect rect = {tx, ty, tx + WREN_TILE_SIZE - 1, ty + WREN_TILE_SIZE - 1};
+        wrenReplayRect(wc, cb, rect);
+        return;
+    }
+
+    for (uint32_t i = bins->starts[tile]; i < bins->starts[tile + 1]; i++) {
+        wrenRunCommand(sub, &cb->commands[bins->entries[i]], -tx, -ty);
+    }
+}
+
+WRENDEF void wrenRender(WrenCanvas wc, const WrenCommandBuffer *cb, WrenBins *bins) {
+    wrenBinCommands(bins, wc, cb);
+    for (size_t i = 0; i < bins->columns*bins->rows; i++) {
+        wrenRenderTile(wc, cb, bins, i);
+    }
+}
+
+#ifdef WREN_THREADS
+static void *wrenThreadPoolWorker(void *arg) {
+    WrenThreadPool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && pool->next >= pool->jobCount) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stopping) break;
+
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->job(pool->data, index);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->jobCount) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+WRENDEF bool wrenThreadPoolStart(WrenThreadPool *pool, size_t threads) {
+    if (threads > WREN_MAX_THREADS) threads = WREN_MAX_THREADS;
+    pool->count = 0;
+    pool->stopping = false;
+    pool->jobCount = pool->next = pool->finished = 0;
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) return false;
+    if (pthread_cond_init(&pool->wake, NULL) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        return false;
+    }
+    if (pthread_cond_init(&pool->done, NULL) != 0) {
+        pthread_cond_destroy(&pool->wake);
+        pthread_mutex_destroy(&pool->lock);
+        return false;
+    }
+
+    for (; pool->count < threads; pool->count++) {
+        if (pthread_create(&pool->threads[pool->count], NULL, wrenThreadPoolWorker, pool) != 0) {
+            wrenThreadPoolStop(pool);
+            return false;
+        }
+    }
+    return true;
+}
+
+WRENDEF void wrenThreadPoolStop(WrenThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->count; i++) pthread_join(pool->threads[i], NULL);
+    pool->count = 0;
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// Runs job(data, i) for every i in [0, count) on the workers and the calling
+// thread, and returns when all of them are done.
+WRENDEF void wrenThreadPoolRun(WrenThreadPool *pool, void (*job)(void *data, size_t index), void *data, size_t count) {
+    if (count == 0) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->data = data;
+    pool->jobCount = count;
+    pool->next = 0;
+    pool->finished = 0;
+    pthread_cond_broadcast(&pool->wake);
+
+    while (pool->next < pool->jobCount) {
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        job(data, index);
+        pthread_mutex_lock(&pool->lock);
+        pool->finished++;
+    }
+    while (pool->finished < pool->jobCount) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+typedef struct {
+    WrenCanvas wc;
+    const WrenCommandBuffer *cb;
+    const WrenBins *bins;
+} WrenTileJob;
+
+static void wrenTileJob(void *data, size_t index) {
+    WrenTileJob *job = data;
+    wrenRenderTile(job->wc, job->cb, job->bins, index);
+}
+
+WRENDEF void wrenRenderThreaded(WrenThreadPool *pool, WrenCanvas wc, const WrenCommandBuffer *cb, WrenBins *bins) {
+    wrenBinCommands(bins, wc, cb);
+    WrenTileJob job = {
+        .wc = wc,
+        .cb = cb,
+        .bins = bins,
+    };
+    wrenThreadPoolRun(pool, wrenTileJob, &job, bins->columns*bins->rows);
+}
+#endif
+
+#endif